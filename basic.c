@@ -13,12 +13,14 @@
  *  modified by Petri Kutvonen
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 
 #include "input.h"
 #include "mlout.h"
+#include "page.h"
 #include "random.h"
 #include "terminal.h"
 #include "window.h"
@@ -40,23 +42,14 @@ getgoal (line_p dlp)
   int idx;
   const int len = llength (dlp);
 
-  col = 0;
-  idx = 0;
+  idx = lcolstart (dlp, INT_MAX, curgoal, &col);
   while (idx < len)
     {
       unicode_t c;
       unsigned int width = utf8_to_unicode (dlp->l_text, idx, len, &c);
 
       /* Take tabs, ^X and \xx hex characters into account */
-      if (c == '\t')
-        col += tabwidth - col % tabwidth;
-      else if (c < 0x20 || c == 0x7F)
-        col += 2;
-      else if (c >= 0x80 && c <= 0xA0)
-        col += 3;
-      else
-        col += 1;
-
+      col = lcolnext (c, col);
       if (col > curgoal)
         break;
 
@@ -82,6 +75,9 @@ gotoeol (bool f, int n)
 int
 gotobob (bool f, int n)
 {
+  if (curbp->b_pgr != NULL)
+    pgline (curbp, 0L);
+
   curwp->w_dotp = lforw (curbp->b_linep);
   curwp->w_doto = 0;
   curwp->w_flag |= WFHARD;
@@ -90,6 +86,9 @@ gotobob (bool f, int n)
 int
 gotoeob (bool f, int n)
 {
+  if (curbp->b_pgr != NULL)
+    pgline (curbp, LONG_MAX);
+
   curwp->w_dotp = curbp->b_linep;
   curwp->w_doto = 0;
   curwp->w_flag |= WFHARD;
@@ -152,8 +151,11 @@ forwline (bool f, int n)
   /* Flag this command as a line move.  */
   thisflag |= CFCPCN;
 
-  /* Move the point down.  */
+  /* Move the point down, through the index if paged.  */
   dlp = curwp->w_dotp;
+  if (curbp->b_pgr != NULL)
+    n = pgmove (curbp, &dlp, n);
+
   while (n != 0 && dlp != curbp->b_linep)
     {
       dlp = lforw (dlp);
@@ -185,8 +187,11 @@ backline (bool f, int n)
   /* Flag this command as a line move.  */
   thisflag |= CFCPCN;
 
-  /* Move the point up.  */
+  /* Move the point up, through the index if paged.  */
   dlp = curwp->w_dotp;
+  if (curbp->b_pgr != NULL)
+    n = -pgmove (curbp, &dlp, -n);
+
   while (n != 0 && lback (dlp) != curbp->b_linep)
     {
       dlp = lback (dlp);
@@ -231,6 +236,9 @@ forwpage (bool f, int n)
 
   /* lp = curwp->w_linep; */
   lp = curwp->w_dotp;
+  if (curbp->b_pgr != NULL)
+    n = pgmove (curbp, &lp, n);
+
   while (n != 0 && lp != curbp->b_linep)
     {
       lp = lforw (lp);
@@ -291,6 +299,9 @@ backpage (bool f, int n)
 
   /* lp = curwp->w_linep; */
   lp = curwp->w_dotp;
+  if (curbp->b_pgr != NULL)
+    n = -pgmove (curbp, &lp, -n);
+
   while (n != 0 && lback (lp) != curbp->b_linep)
     {
       lp = lback (lp);
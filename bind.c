@@ -341,6 +341,7 @@ buildlist (const char *mstring)
   mlwrite ("(Building binding list)");
 
   /* disconect the current buffer */
+  wdetach (curwp);
   if (--curbp->b_nwnd == 0)
     { /* Last use.            */
       curbp->b_dotp = curwp->w_dotp;
@@ -355,6 +356,7 @@ buildlist (const char *mstring)
   bp->b_nwnd++;   /* mark us as more in use */
   wp = curwp;
   wp->w_bufp = bp;
+  wattach (wp);
   wp->w_linep = bp->b_linep;
   wp->w_flag = WFHARD | WFFORCE;
   wp->w_dotp = bp->b_dotp;
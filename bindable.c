@@ -11,6 +11,7 @@
 #include "estruct.h"
 #include "file.h"
 #include "input.h"
+#include "journal.h"
 #include "lock.h"
 #include "mlout.h"
 #include "terminal.h"
@@ -120,6 +121,8 @@ quit (bool f, int n)
           exit (EXIT_FAILURE);
         }
 #endif
+      if (!f) /* Changes left unsaved are given up.  */
+        jrndiscardall ();
       vttidy ();
       if (f)
         exit (n);
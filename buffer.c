@@ -20,8 +20,12 @@
 #include "defines.h"
 #include "estruct.h"
 #include "file.h"
+#include "follow.h"
 #include "input.h"
+#include "journal.h"
 #include "mlout.h"
+#include "page.h"
+#include "undo.h"
 #include "utf8.h"
 #include "util.h"
 #include "window.h"
@@ -31,11 +35,20 @@ buffer_p bheadp; /* Head of list of buffers.  */
 buffer_p blistp; /* Buffer for "C-X C-B".  */
 buffer_p bscratchp; /* *scratch* */
 
+#define NBHASH 64 /* # of name hash chains to begin with.  */
+
+/* The buffers by name, on chains linked by b_hnext.  */
+static buffer_p bhash0[NBHASH];
+static buffer_p *bhash = bhash0;
+static unsigned int nbhash = NBHASH; /* # of chains.  */
+static unsigned int nbhashed;        /* # of buffers on them.  */
+
 /* Name of modes.  */
 const char *modename[] =
 {
   "Wrap",  "C-mode", "Exact", "View", "Over",
-  "Magic", "Asave",  "UTF-8", "DOS"
+  "Magic", "Asave",  "UTF-8", "DOS",  "Hilite",
+  "Follow"
 };
 
 int gmode = 0; /* global editor mode           */
@@ -43,6 +56,8 @@ int gmode = 0; /* global editor mode           */
 static int makelist (bool iflag);
 static int addline (char *text);
 static void l2a (char *buf, int width, long num);
+static void bhashin (buffer_p bp);
+static void bhashout (buffer_p bp);
 
 /*
  * Attach a buffer to a window. The
@@ -125,6 +140,7 @@ swbuffer (buffer_p bp)
 {
   window_p wp;
 
+  wdetach (curwp);
   if (--curbp->b_nwnd == 0)
     { /* Last use.            */
       curbp->b_dotp = curwp->w_dotp;
@@ -133,6 +149,8 @@ swbuffer (buffer_p bp)
       curbp->b_marko = curwp->w_marko;
     }
   curbp = bp; /* Switch.              */
+  curwp->w_bufp = bp;
+  wattach (curwp); /* Before a journal is replayed through dot.  */
   if (!curbp->b_active)
     {
       /* Buffer not active yet.  */
@@ -143,7 +161,6 @@ swbuffer (buffer_p bp)
       curbp->b_active = TRUE;
       curbp->b_mode |= gmode; /* P.K. */
     }
-  curwp->w_bufp = bp;
   curwp->w_linep = bp->b_linep;               /* For macros, ignored. */
   curwp->w_flag |= WFMODE | WFFORCE | WFHARD; /* Quite nasty.         */
   if (bp->b_nwnd++ == 0)
@@ -234,6 +251,8 @@ zotbuf (buffer_p bp)
     bheadp = bp2;
   else
     bp1->b_bufp = bp2;
+  bhashout (bp);
+  free (bp->b_bname);
   free (bp); /* Release buffer block */
   return SUCCESS;
 }
@@ -257,25 +276,19 @@ ask:
     return status;
 
   /* and check for duplicates */
-  bp = bheadp;
-  while (bp != NULL)
+  bp = bfind (bufn, 0);
+  if (bp != NULL && bp != curbp)
     {
-      if (bp != curbp)
-        {
-          /* retry if the names are the same */
-          if (strcmp (bufn, bp->b_bname) == 0)
-            {
-              free (bufn);
-              goto ask; /* try again */
-            }
-        }
-
-      bp = bp->b_bufp; /* onward */
+      /* retry if the names are the same */
+      free (bufn);
+      goto ask; /* try again */
     }
 
   /* copy buffer name to structure */
-  strscpy (curbp->b_bname, bufn, sizeof (bname_t));
+  status = bsetname (curbp, bufn);
   free (bufn);
+  if (status != TRUE)
+    return status;
 
   curwp->w_flag |= WFMODE; /* make mode line replot */
   mloutstr ("");           /* erase message line */
@@ -307,6 +320,7 @@ listbuffers (bool f, int n)
       if ((wp = wpopup ()) == NULL)
         return FALSE;
       bp = wp->w_bufp;
+      wdetach (wp);
       if (--bp->b_nwnd == 0)
         {
           bp->b_dotp = wp->w_dotp;
@@ -315,6 +329,7 @@ listbuffers (bool f, int n)
           bp->b_marko = wp->w_marko;
         }
       wp->w_bufp = blistp;
+      wattach (wp);
       blistp->b_nwnd++;
     }
   wp = wheadp;
@@ -349,8 +364,10 @@ listbuffers (bool f, int n)
 /* Layout: "ACT MODES          Size Buffer          File"
             AAA MMMMMMMMMSSSSSSSSSS BBBBBBBBBBBBBBB FFF...
    FNAMSTART ---------------------------------------^
+   Longer buffer names push their file names right.
 */
-#define FNAMSTART (3 + 1 + NUMMODES + 10 + 1 + (sizeof (bname_t) - 1) + 1)
+#define NBNCOL 15 /* Width of the buffer name column.  */
+#define FNAMSTART (3 + 1 + NUMMODES + 10 + 1 + NBNCOL + 1)
 
 static void
 do_layout (char *line, int mode)
@@ -358,7 +375,7 @@ do_layout (char *line, int mode)
   int i;
 
   /* build line to report global mode settings */
-  strcpy (line, "    WCEVOMAUD           Global Modes");
+  strcpy (line, "    WCEVOMAUDHF           Global Modes");
 
   /* output the mode codes */
   for (i = 0; i < NUMMODES; i++)
@@ -377,7 +394,7 @@ utf8_disp_len (const char *s)
       unicode_t c;
 
       s += utf8_to_unicode (s, 0, 4, &c);
-      len++; /* Single width unicode for now.  */
+      len += unicode_width (c);
     }
 
   return len;
@@ -388,7 +405,7 @@ makelist (bool iflag)
 {
   buffer_p bp;
   int s;
-  char line[FNAMSTART + sizeof (fname_t)];
+  char line[FNAMSTART + sizeof (bname_t) + sizeof (fname_t)];
 
   blistp->b_flag &= ~BFCHG; /* Do not complain! Mute bclear().  */
   if ((s = bclear (blistp)) != TRUE) /* Blow old text away.  */
@@ -396,8 +413,8 @@ makelist (bool iflag)
 
   blistp->b_fname[0] = 0; /* In case of user override.  */
 
-  if (   addline ("ACT MODES          Size Buffer          File") == FALSE
-      || addline ("--- -----          ---- ------          ----") == FALSE)
+  if (   addline ("ACT MODES            Size Buffer          File") == FALSE
+      || addline ("--- -----            ---- ------          ----") == FALSE)
     return FALSE;
 
   /* Report global mode settings.  */
@@ -411,9 +428,6 @@ makelist (bool iflag)
       /* For all buffers.  */
       char *cp1, *cp2;
       int c;
-      line_p lp;
-      size_t nbytes; /* # of bytes in current buffer */
-      size_t nlines; /* # of lines in current buffer */
       int len;
 
       /* skip invisible buffers if iflag is false */
@@ -433,19 +447,8 @@ makelist (bool iflag)
       *cp1 = ((bp->b_flag & BFCHG) != 0) ? '*' : ' ';
 
       /* Buffer size.  */
-      nbytes = 0; /* Count bytes in buf.  */
-      nlines = 0;
-      for (lp = lforw (bp->b_linep); lp != bp->b_linep; lp = lforw (lp))
-        {
-          nbytes += llength (lp) + 1;
-          nlines++;
-        }
-
-      if (bp->b_mode & MDDOS)
-        nbytes += nlines;
-
-      l2a (&line[13], 10 + 1, nbytes); /* "%10d" formatted numbers */
-      cp1 = &line[23];
+      l2a (&line[4 + NUMMODES], 10 + 1, bsize (bp)); /* "%10d" formatted numbers */
+      cp1 = &line[14 + NUMMODES];
       *cp1++ = ' ';
 
       /* Display buffer name.  */
@@ -453,9 +456,11 @@ makelist (bool iflag)
       while ((c = *cp2++) != 0)
         *cp1++ = c;
 
-      /* Pad with spaces to max buffer name length */
-      len = sizeof (bp->b_bname);
+      /* Pad with spaces to the file name column */
+      len = NBNCOL + 1;
       len -= utf8_disp_len (bp->b_bname);
+      if (len < 1)
+        len = 1;
       while (len-- != 0)
         *cp1++ = ' ';
 
@@ -516,6 +521,7 @@ addline (char *text)
   lp->l_bp = blistp->b_linep->l_bp;
   blistp->b_linep->l_bp = lp;
   lp->l_fp = blistp->b_linep;
+  bcount (blistp, ntext + 1, 1);
 
   if (blistp->b_dotp == blistp->b_linep)
     /* If "." is at the end move it to new line.  */
@@ -548,6 +554,79 @@ anycb (void)
   return FALSE;
 }
 
+static unsigned int
+bhashof (const char *s)
+{
+  unsigned int h = 0;
+
+  while (*s != '\0')
+    h = h * 31 + (*s++ & 0xFF);
+  return h;
+}
+
+/*
+ * Spread the hashed buffers over n chains.  If there is no memory for
+ * them, the chains there are get longer.
+ */
+static void
+bhgrow (unsigned int n)
+{
+  buffer_p *tab;
+  buffer_p bp;
+  unsigned int i;
+
+  if ((tab = calloc (n, sizeof (*tab))) == NULL)
+    return;
+
+  for (i = 0; i < nbhash; i++)
+    while ((bp = bhash[i]) != NULL)
+      {
+        unsigned int h = bhashof (bp->b_bname) % n;
+
+        bhash[i] = bp->b_hnext;
+        bp->b_hnext = tab[h];
+        tab[h] = bp;
+      }
+
+  if (bhash != bhash0)
+    free (bhash);
+  bhash = tab;
+  nbhash = n;
+}
+
+/*
+ * Hash buffer bp by its name.
+ */
+static void
+bhashin (buffer_p bp)
+{
+  buffer_p *chain;
+
+  if (++nbhashed > 2 * nbhash)
+    bhgrow (4 * nbhash);
+  chain = &bhash[bhashof (bp->b_bname) % nbhash];
+  bp->b_hnext = *chain;
+  *chain = bp;
+}
+
+/*
+ * Take buffer bp off the chain of its name.
+ */
+static void
+bhashout (buffer_p bp)
+{
+  buffer_p *bpp;
+
+  for (bpp = &bhash[bhashof (bp->b_bname) % nbhash]; *bpp != NULL;
+       bpp = &(*bpp)->b_hnext)
+    if (*bpp == bp)
+      {
+        *bpp = bp->b_hnext;
+        nbhashed--;
+        return;
+      }
+}
+
 /*
  * Create the buffer is not found
  * The "bflag" is the settings for the flags in in buffer.
@@ -565,6 +644,13 @@ bcreate (const char *bname, unsigned int bflag)
       free (bp);
       return NULL;
     }
+  bp->b_bname = NULL;
+  if (bsetname (bp, bname) != TRUE)
+    {
+      free (lp);
+      free (bp);
+      return NULL;
+    }
   /* Find the place in the list to insert this buffer.  */
   if (bheadp == NULL || strcmp (bheadp->b_bname, bname) > 0)
     {
@@ -596,7 +682,17 @@ bcreate (const char *bname, unsigned int bflag)
   bp->b_nwnd = 0;
   bp->b_linep = lp;
   bp->b_fname[0] = '\0';
-  strscpy (bp->b_bname, bname, sizeof (bname_t));
+  bp->b_syntax = NULL;
+  bp->b_nlexdirty = 0;
+  bp->b_jrn = NULL;
+  bp->b_pgr = NULL;
+  bp->b_flw = NULL;
+  bp->b_und = NULL;
+  bp->b_pos = NULL;
+  bposadd (bp, &bp->b_bpos[0], &bp->b_dotp, &bp->b_doto);
+  bposadd (bp, &bp->b_bpos[1], &bp->b_markp, &bp->b_marko);
+  bp->b_nbytes = 0;
+  bp->b_nlines = 0;
 
   lp->l_fp = lp;
   lp->l_bp = lp;
@@ -615,13 +711,183 @@ bfind (const char *bname, unsigned int bflag)
 {
   buffer_p bp;
 
-  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+  for (bp = bhash[bhashof (bname) % nbhash]; bp != NULL; bp = bp->b_hnext)
     if (strcmp (bname, bp->b_bname) == 0)
       return bp;
 
   return bp;
 }
 
+/*
+ * The # of bytes buffer bp would take in its file, from the running count.
+ * A paged buffer holds only some of its file: count that instead.
+ */
+long
+bsize (buffer_p bp)
+{
+  if (bp->b_pgr != NULL)
+    return pgsize (bp);
+  if (bp->b_mode & MDDOS)
+    return bp->b_nbytes + bp->b_nlines;
+  return bp->b_nbytes;
+}
+
+/*
+ * The # of lines of buffer bp, as far as indexed if it is paged.
+ */
+long
+blines (buffer_p bp)
+{
+  if (bp->b_pgr != NULL)
+    return pgcount (bp);
+  return bp->b_nlines;
+}
+
+/*
+ * Name buffer bp bname, cut to fit a bname_t.  The name is allocated to
+ * its length; return FALSE if it cannot be.
+ */
+int
+bsetname (buffer_p bp, const char *bname)
+{
+  char *name;
+  size_t len;
+
+  if ((len = strlen (bname)) >= sizeof (bname_t))
+    len = sizeof (bname_t) - 1;
+  if ((name = malloc (len + 1)) == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+  memcpy (name, bname, len);
+  name[len] = '\0';
+
+  if (bp->b_bname != NULL)
+    {
+      bhashout (bp);
+      free (bp->b_bname);
+    }
+  bp->b_bname = name;
+  bhashin (bp);
+  return TRUE;
+}
+
+/*
+ * Return the number of line lp of buffer bp, counting from 0, walking
+ * both ways from line hint, number n, or from the top if hint is NULL.
+ * The end of the buffer is one past its last line.  Return -1 if lp is
+ * not found.
+ */
+int
+lnumber (buffer_p bp, line_p lp, line_p hint, int n)
+{
+  line_p fw, bw;
+  int nf, nb;
+
+  if (hint != NULL)
+    {
+      fw = bw = hint;
+      nf = nb = n;
+    }
+  else
+    {
+      fw = lforw (bp->b_linep);
+      nf = 0;
+      bw = NULL;
+      nb = 0;
+    }
+
+  while (fw != NULL || bw != NULL)
+    {
+      if (fw != NULL)
+        {
+          if (fw == lp)
+            return nf;
+          if (fw == bp->b_linep)
+            fw = NULL;
+          else
+            {
+              fw = lforw (fw);
+              nf++;
+            }
+        }
+      if (bw != NULL)
+        {
+          if (bw == lp)
+            return nb;
+          bw = lback (bw);
+          nb--;
+          if (bw == bp->b_linep)
+            bw = NULL;
+        }
+    }
+
+  return -1;
+}
+
+/*
+ * Return line number k of buffer bp, walking from line hint, number n,
+ * or from the top if hint is NULL.  Return NULL if there is no such line.
+ */
+line_p
+lnumbered (buffer_p bp, int k, line_p hint, int n)
+{
+  line_p lp;
+
+  if (k < 0)
+    return NULL;
+
+  if (hint != NULL)
+    lp = hint;
+  else
+    {
+      lp = lforw (bp->b_linep);
+      n = 0;
+    }
+  while (n < k && lp != bp->b_linep)
+    {
+      lp = lforw (lp);
+      n++;
+    }
+  while (n > k)
+    {
+      lp = lback (lp);
+      n--;
+    }
+
+  return (n == k) ? lp : NULL;
+}
+
+/*
+ * Have the edits of buffer bp keep the place of line *lpp, at offset *offp
+ * unless it is NULL, using pp to link it.
+ */
+void
+bposadd (buffer_p bp, struct bpos *pp, line_p *lpp, int *offp)
+{
+  pp->p_lpp = lpp;
+  pp->p_offp = offp;
+  pp->p_next = bp->b_pos;
+  bp->b_pos = pp;
+}
+
+/*
+ * Forget place pp of buffer bp.
+ */
+void
+bposdel (buffer_p bp, struct bpos *pp)
+{
+  struct bpos **ppp;
+
+  for (ppp = &bp->b_pos; *ppp != NULL; ppp = &(*ppp)->p_next)
+    if (*ppp == pp)
+      {
+        *ppp = pp->p_next;
+        return;
+      }
+}
+
 /*
  * This routine blows away all of the text
  * in a buffer. If the buffer is marked as changed
@@ -643,12 +909,18 @@ bclear (buffer_p bp)
       && (status = mlyesno ("Discard changes?")) != SUCCESS)
     return status;
   bp->b_flag &= ~BFCHG; /* Not changed.  */
+  jrndiscard (bp);
+  pgclose (bp);
+  flwdiscard (bp);
+  unddiscard (bp);
   while ((lp = lforw (bp->b_linep)) != bp->b_linep)
-    lfree (lp);
+    lfree (bp, lp);
   bp->b_dotp = bp->b_linep; /* Fix ".".  */
   bp->b_doto = 0;
   bp->b_markp = NULL; /* Invalidate "mark".  */
   bp->b_marko = 0;
+  bp->b_nbytes = 0;
+  bp->b_nlines = 0;
   return SUCCESS;
 }
 
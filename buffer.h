@@ -8,12 +8,33 @@
 #include "line.h"
 
 typedef char fname_t[256]; /* file name type */
-typedef char bname_t[16];  /* buffer name type */
+typedef char bname_t[256]; /* buffer name type */
+
+#define NLEXDIRTY 16 /* # of edited lines queued for lexing.  */
+
+struct journal;
+struct pager;
+struct follow;
+struct syntax;
+
+/*
+ * A place in a buffer that its edits keep on the same text: a line and an
+ * offset in it.  The places of a buffer, the dot, mark and top line of the
+ * windows on it and its own dot and mark, are linked from it, so that an
+ * edit fixes only those of the buffer it changes.
+ */
+struct bpos
+{
+  struct bpos *p_next; /* Next place in the buffer.  */
+  line_p *p_lpp;       /* Where its line is kept.  */
+  int *p_offp;         /* And its offset, NULL if the line only matters.  */
+};
 
 /*
  * Text is kept in buffers.  A buffer header, described below, exists for every
- * buffer in the system.  The buffers are kept in a big list, so that commands
- * that search for a buffer by name can find the buffer header.  There is a
+ * buffer in the system.  The buffers are kept in a big list, sorted by name
+ * as they are made, and hashed by their names, so that commands that search
+ * for a buffer by name can find the buffer header quickly.  There is a
  * safe store for the dot and mark in the header, but this is only valid if
  * the buffer is not being displayed (that is, if "b_nwnd" is 0).  The text for
  * the buffer is kept in a circularly linked list of lines, with a pointer to
@@ -36,7 +57,19 @@ struct buffer
   unsigned int b_nwnd:7;    /* Count of windows on buffer.  */
   unsigned int b_flag;     /* Flags.  */
   fname_t b_fname;         /* File name.  */
-  bname_t b_bname;         /* Buffer name.  */
+  char *b_bname;           /* Buffer name, at most a bname_t.  */
+  buffer_p b_hnext;        /* Next on the chain of its name hash.  */
+  struct syntax *b_syntax; /* Highlighting rules, NULL if none.  */
+  int b_nlexdirty;         /* # of queued lines, -1 if too many.  */
+  line_p b_lexdirty[NLEXDIRTY]; /* Lines edited since lexed.  */
+  struct journal *b_jrn;   /* Edit journal, NULL if none.  */
+  struct pager *b_pgr;     /* Pages of a big file, NULL if read in.  */
+  struct follow *b_flw;    /* Size and identity of the file, NULL if none.  */
+  struct undo *b_und;      /* Undo log, NULL if none.  */
+  struct bpos *b_pos;      /* Places kept through edits.  */
+  long b_nbytes;           /* # of bytes in the lines, a newline each.  */
+  long b_nlines;           /* # of lines.  */
+  struct bpos b_bpos[2];   /* Those of "." and "mark" above.  */
 };
 
 extern buffer_p curbp;  /* Current buffer.  */
@@ -44,6 +77,10 @@ extern buffer_p bheadp; /* Head of list of buffers.  */
 extern buffer_p blistp; /* Buffer for "C-X C-B".  */
 extern buffer_p bscratchp; /* *scratch* */
 
+/* Count nbytes more bytes in nlines more lines of buffer bp.  */
+#define bcount(bp, nbytes, nlines) \
+  ((bp)->b_nbytes += (nbytes), (bp)->b_nlines += (nlines))
+
 #define BFINVS  0x01 /* Internal invisable buffer.  */
 #define BFCHG   0x02 /* Changed since last write.  */
 #define BFTRUNC 0x04 /* Buffer was truncated when read.  */
@@ -58,8 +95,10 @@ extern buffer_p bscratchp; /* *scratch* */
 #define MDASAVE (1 << 6) /* Auto-save mode.  */
 #define MDUTF8  (1 << 7) /* UTF-8 mode.  */
 #define MDDOS   (1 << 8) /* CRLF EOL mode.  */
+#define MDHILIT (1 << 9) /* Highlight matches of the search pattern.  */
+#define MDFOLLOW (1 << 10) /* Append what is added to the file.  */
 
-#define NUMMODES 9 /* # of defined modes.  */
+#define NUMMODES 11 /* # of defined modes.  */
 
 extern const char *modename[]; /* Text names of modes.  */
 extern int gmode; /* Global editor mode.  */
@@ -77,5 +116,12 @@ extern int unmark (bool f, int n);
 extern buffer_p bcreate (const char *bname, unsigned int bflag);
 /* Lookup a buffer by name.  */
 extern buffer_p bfind (const char *bname, unsigned int bflag);
+extern int bsetname (buffer_p bp, const char *bname);
+extern long bsize (buffer_p bp);
+extern long blines (buffer_p bp);
+extern int lnumber (buffer_p bp, line_p lp, line_p hint, int n);
+extern line_p lnumbered (buffer_p bp, int k, line_p hint, int n);
+extern void bposadd (buffer_p bp, struct bpos *pp, line_p *lpp, int *offp);
+extern void bposdel (buffer_p bp, struct bpos *pp);
 
 #endif
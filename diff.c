@@ -0,0 +1,657 @@
+/* diff.c -- implements diff.h */
+#include "diff.h"
+
+/*  diff.c
+ *
+ *      The routines in this file compare the current buffer with another
+ *      one, line by line, and put the differences in the "*diff*" buffer
+ *      as a unified diff, which may be written out as a patch.  Each line
+ *      is hashed once, and the lines that are the same are given the same
+ *      number through a hash table, so that from there on lines compare
+ *      as numbers.  The lines of a buffer that are nowhere in the other
+ *      one cannot be in common, they are marked changed and left out.
+ *      What remains is compared by the algorithm of Myers, which looks
+ *      for the middle of a shortest edit from both ends at once, and so
+ *      needs space in the number of lines only.  When a part of the
+ *      buffers differs so much that this gets costly, it is cut where
+ *      the search from its start got furthest: the diff is right, if
+ *      not the shortest.
+ *
+ *      A paged buffer cannot be compared.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "estruct.h"
+#include "input.h"
+#include "line.h"
+#include "mlout.h"
+#include "window.h"
+
+#define DIFFCTX  3    /* # of lines of context around the changes.  */
+#define DIFFCOST 4096 /* # of steps from each end before cutting.  */
+
+static const char diffname[] = "*diff*";
+
+/* A class of equal lines.  */
+struct diffent
+{
+  line_p e_line;       /* Its first line, NULL if the entry is free.  */
+  unsigned int e_hash; /* Hash of the text.  */
+  int e_id;            /* Number of the class.  */
+};
+
+/* The lines of the two buffers that may be in common.  */
+struct diffseq
+{
+  int *xv, *yv;   /* Class of each of them.  */
+  int *xi, *yi;   /* Index of each of them in its buffer.  */
+  char *xch;      /* Lines of the first buffer deleted.  */
+  char *ych;      /* Lines of the second one inserted.  */
+  int *fv, *rv;   /* Furthest reach on each diagonal, from either end.  */
+};
+
+/*
+ * Return an array of the lines of buffer bp, and their number in *np,
+ * or NULL if out of memory.
+ */
+static line_p *
+difflines (buffer_p bp, int *np)
+{
+  line_p lp;
+  line_p *lines = NULL;
+  int n = 0;
+  int size = 0;
+
+  for (lp = lforw (bp->b_linep);; lp = lforw (lp))
+    {
+      if (n == size)
+        {
+          line_p *nlines;
+
+          size = size != 0 ? size * 2 : 256;
+          if ((nlines = realloc (lines, size * sizeof (*lines))) == NULL)
+            {
+              free (lines);
+              return NULL;
+            }
+          lines = nlines;
+        }
+      if (lp == bp->b_linep)
+        break;
+      lines[n++] = lp;
+    }
+
+  *np = n;
+  return lines;
+}
+
+/*
+ * Return the hash of the text of line lp.
+ */
+static unsigned int
+diffhash (line_p lp)
+{
+  unsigned int h = 2166136261u;
+  int i;
+
+  for (i = 0; i < llength (lp); i++)
+    {
+      h ^= (unsigned char) lgetc (lp, i);
+      h *= 16777619u;
+    }
+
+  return h;
+}
+
+/*
+ * Number the classes of the n lines of lines in ids, the same line the
+ * same number, going on from the table tab of size mask + 1 and the
+ * *nid classes it holds.
+ */
+static void
+diffintern (struct diffent *tab, size_t mask, int *nid, line_p *lines,
+            int n, int *ids)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      line_p lp = lines[i];
+      unsigned int h = diffhash (lp);
+      size_t k;
+
+      for (k = h & mask; tab[k].e_line != NULL; k = (k + 1) & mask)
+        if (tab[k].e_hash == h && llength (tab[k].e_line) == llength (lp)
+            && memcmp (tab[k].e_line->l_text, lp->l_text, llength (lp)) == 0)
+          break;
+
+      if (tab[k].e_line == NULL)
+        {
+          tab[k].e_line = lp;
+          tab[k].e_hash = h;
+          tab[k].e_id = (*nid)++;
+        }
+      ids[i] = tab[k].e_id;
+    }
+}
+
+/*
+ * Keep in v and vi the classes and indices of those of the n lines
+ * numbered ids that are in the other buffer, as told by in, and mark the
+ * others in ch.  Return how many are kept.
+ */
+static int
+diffkeep (const int *ids, int n, const char *in, int *v, int *vi, char *ch)
+{
+  int i, k = 0;
+
+  for (i = 0; i < n; i++)
+    if (in[ids[i]])
+      {
+        v[k] = ids[i];
+        vi[k++] = i;
+      }
+    else
+      ch[i] = 1;
+
+  return k;
+}
+
+/*
+ * Find where to cut the edit of xv[xoff..xlim) into yv[yoff..ylim) in
+ * two, and put it in *px and *py.  It is where a shortest path from the
+ * start of the part meets one from its end, found by taking steps from
+ * both in turn, after E. Myers, "An O(ND) Difference Algorithm and Its
+ * Variations", section 4b.  Past DIFFCOST steps, the cut is where the
+ * path from the start got furthest.  The part must differ at both ends.
+ *
+ * In the part, point (x, y) is on diagonal x - y.  The path from the end
+ * is followed as one from the start of the part turned around, so that
+ * its point (x, y) is point (n - x, m - y) of the part.  For each
+ * diagonal, fv and rv keep the furthest x of the paths so far.
+ */
+static void
+diffsplit (struct diffseq *ds, int xoff, int xlim, int yoff, int ylim,
+           int *px, int *py)
+{
+  const int *a = ds->xv + xoff, *b = ds->yv + yoff;
+  const int n = xlim - xoff, m = ylim - yoff;
+  const int delta = n - m;  /* Diagonal of the end.  */
+  const int half = (n + m + 1) / 2;
+  const int steps = half < DIFFCOST ? half : DIFFCOST;
+  int *fv = ds->fv + steps + 1, *rv = ds->rv + steps + 1;
+  int flo = 0, fhi = 0;     /* Diagonals dropped below and above, as */
+  int rlo = 0, rhi = 0;     /* their paths left the part.  */
+  int bestx = 0, besty = 0; /* Furthest point from the start.  */
+  int d, k, x, y;
+
+  for (k = -steps - 1; k <= steps + 1; k++)
+    fv[k] = rv[k] = -1;
+  fv[1] = rv[1] = 0; /* As if a step led to (0, 0).  */
+
+  for (d = 0; d <= steps; d++)
+    {
+      for (k = -d + flo; k <= d - fhi; k += 2)
+        {
+          if (k == -d || (k != d && fv[k - 1] < fv[k + 1]))
+            x = fv[k + 1];     /* Down from diagonal k + 1.  */
+          else
+            x = fv[k - 1] + 1; /* Right from diagonal k - 1.  */
+          y = x - k;
+          while (x < n && y < m && a[x] == b[y])
+            {
+              x++;
+              y++;
+            }
+          fv[k] = x;
+
+          if (x > n)
+            fhi += 2; /* Off the right side.  */
+          else if (y > m)
+            flo += 2; /* Off the bottom.  */
+          else
+            {
+              int r = delta - k;
+
+              if (x + y > bestx + besty)
+                {
+                  bestx = x;
+                  besty = y;
+                }
+              if ((delta & 1) != 0 && r >= -steps && r <= steps
+                  && rv[r] >= 0 && x + rv[r] >= n)
+                {
+                  *px = xoff + x;
+                  *py = yoff + y;
+                  return;
+                }
+            }
+        }
+
+      for (k = -d + rlo; k <= d - rhi; k += 2)
+        {
+          if (k == -d || (k != d && rv[k - 1] < rv[k + 1]))
+            x = rv[k + 1];
+          else
+            x = rv[k - 1] + 1;
+          y = x - k;
+          while (x < n && y < m && a[n - 1 - x] == b[m - 1 - y])
+            {
+              x++;
+              y++;
+            }
+          rv[k] = x;
+
+          if (x > n)
+            rhi += 2;
+          else if (y > m)
+            rlo += 2;
+          else
+            {
+              int f = delta - k;
+
+              if ((delta & 1) == 0 && f >= -steps && f <= steps
+                  && fv[f] >= 0 && x + fv[f] >= n)
+                {
+                  *px = xlim - x;
+                  *py = ylim - y;
+                  return;
+                }
+            }
+        }
+    }
+
+  /* Too costly, make do with what there is.  */
+  *px = xoff + bestx;
+  *py = yoff + besty;
+}
+
+/*
+ * Mark the lines deleted from xv[xoff..xlim) and inserted from
+ * yv[yoff..ylim) to make one into the other.
+ */
+static void
+diffcompare (struct diffseq *ds, int xoff, int xlim, int yoff, int ylim)
+{
+  const int *xv = ds->xv, *yv = ds->yv;
+
+  while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+    {
+      xoff++;
+      yoff++;
+    }
+  while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1])
+    {
+      xlim--;
+      ylim--;
+    }
+
+  if (xoff == xlim)
+    while (yoff < ylim)
+      ds->ych[ds->yi[yoff++]] = 1;
+  else if (yoff == ylim)
+    while (xoff < xlim)
+      ds->xch[ds->xi[xoff++]] = 1;
+  else
+    {
+      int xmid, ymid;
+
+      diffsplit (ds, xoff, xlim, yoff, ylim, &xmid, &ymid);
+      diffcompare (ds, xoff, xmid, yoff, ymid);
+      diffcompare (ds, xmid, xlim, ymid, ylim);
+    }
+}
+
+/*
+ * Append to buffer bp a line of head followed by the n bytes of text.
+ * Return FALSE if out of memory.
+ */
+static bool
+diffadd (buffer_p bp, const char *head, const char *text, int n)
+{
+  line_p lp;
+  int nhead;
+
+  nhead = strlen (head);
+  if ((lp = lalloc (nhead + n)) == NULL)
+    return FALSE;
+
+  memcpy (lp->l_text, head, nhead);
+  memcpy (&lp->l_text[nhead], text, n);
+  lp->l_fp = bp->b_linep; /* Insert before end of buffer.  */
+  lp->l_bp = lp->l_fp->l_bp;
+  lp->l_fp->l_bp = lp;
+  lp->l_bp->l_fp = lp;
+  bcount (bp, nhead + n + 1, 1);
+  return TRUE;
+}
+
+/*
+ * Append the header of the hunk of the count lines from start to s, as
+ * diff does: a count of one is left out, and a hunk with no lines starts
+ * at the line before it.
+ */
+static char *
+diffrange (char *s, int start, int count)
+{
+  if (count == 1)
+    return s + sprintf (s, "%d", start + 1);
+  return s + sprintf (s, "%d,%d", count == 0 ? start : start + 1, count);
+}
+
+/*
+ * Write to buffer bp the hunks of the changes marked in ach and bch
+ * between the na lines of la and the nb ones of lb, with ctx lines of
+ * context.  Count the hunks, deleted and inserted lines in *counts.
+ * Return FALSE if out of memory.
+ */
+static bool
+diffhunks (buffer_p bp, line_p *la, const char *ach, int na, line_p *lb,
+           const char *bch, int nb, int ctx, int *counts)
+{
+  int i = 0, j = 0;
+
+  for (;;)
+    {
+      char head[64];
+      char *s;
+      int a0, a1, b0, b1, x, y;
+
+      /* Find the next change.  */
+      while (i < na && j < nb && !ach[i] && !bch[j])
+        {
+          i++;
+          j++;
+        }
+      if (i == na && j == nb)
+        return TRUE;
+
+      a0 = i - ctx > 0 ? i - ctx : 0;
+      b0 = j - (i - a0);
+
+      /* Take in the changes that the context would join.  */
+      for (;;)
+        {
+          int k;
+
+          while (i < na && ach[i])
+            i++;
+          while (j < nb && bch[j])
+            j++;
+          a1 = i;
+          b1 = j;
+          for (k = 0; i < na && j < nb && !ach[i] && !bch[j] && k <= 2 * ctx;
+               k++)
+            {
+              i++;
+              j++;
+            }
+          if (k > 2 * ctx || (i == na && j == nb))
+            break;
+        }
+      a1 = a1 + ctx < na ? a1 + ctx : na; /* And the context after.  */
+      b1 = j - (i - a1);
+
+      s = head;
+      s += sprintf (s, "@@ -");
+      s = diffrange (s, a0, a1 - a0);
+      s += sprintf (s, " +");
+      s = diffrange (s, b0, b1 - b0);
+      sprintf (s, " @@");
+      if (!diffadd (bp, head, "", 0))
+        return FALSE;
+
+      counts[0]++;
+      for (x = a0, y = b0; x < a1 || y < b1;)
+        if (x < a1 && ach[x])
+          {
+            if (!diffadd (bp, "-", la[x]->l_text, llength (la[x])))
+              return FALSE;
+            x++;
+            counts[1]++;
+          }
+        else if (y < b1 && bch[y])
+          {
+            if (!diffadd (bp, "+", lb[y]->l_text, llength (lb[y])))
+              return FALSE;
+            y++;
+            counts[2]++;
+          }
+        else
+          {
+            if (!diffadd (bp, " ", la[x]->l_text, llength (la[x])))
+              return FALSE;
+            x++;
+            y++;
+          }
+    }
+}
+
+/*
+ * Compare the na lines of la with the nb ones of lb, and mark those
+ * deleted from the first in ach, those inserted in the second in bch.
+ * Return FALSE if out of memory.
+ */
+static bool
+diffmark (line_p *la, int na, char *ach, line_p *lb, int nb, char *bch)
+{
+  struct diffseq ds;
+  struct diffent *tab;
+  size_t size;
+  int *ida, *idb, *buf;
+  char *ina, *inb;
+  int nid = 0;
+  int nx, ny, k;
+  bool status = FALSE;
+
+  for (size = 64; size < 2 * ((size_t) na + nb); size <<= 1)
+    ;
+  tab = calloc (size, sizeof (*tab));
+  ida = malloc (((size_t) na + nb + 1) * sizeof (*ida));
+  if (tab == NULL || ida == NULL)
+    {
+      free (tab);
+      free (ida);
+      return FALSE;
+    }
+  idb = ida + na;
+  diffintern (tab, size - 1, &nid, la, na, ida);
+  diffintern (tab, size - 1, &nid, lb, nb, idb);
+  free (tab);
+
+  /* Which classes are in each buffer.  */
+  ina = calloc (2 * (size_t) nid + 1, 1);
+  buf = malloc ((2 * ((size_t) na + nb) + 2 * ((size_t) na + nb + 4))
+                * sizeof (*buf));
+  if (ina == NULL || buf == NULL)
+    goto out;
+  inb = ina + nid;
+  for (k = 0; k < na; k++)
+    ina[ida[k]] = 1;
+  for (k = 0; k < nb; k++)
+    inb[idb[k]] = 1;
+
+  ds.xv = buf;
+  ds.xi = ds.xv + na;
+  ds.yv = ds.xi + na;
+  ds.yi = ds.yv + nb;
+  ds.xch = ach;
+  ds.ych = bch;
+  nx = diffkeep (ida, na, inb, ds.xv, ds.xi, ach);
+  ny = diffkeep (idb, nb, ina, ds.yv, ds.yi, bch);
+
+  /* diffsplit() looks at diagonals -(nx + ny + 1) / 2 - 1 and up.  */
+  ds.fv = ds.yi + nb;
+  ds.rv = ds.fv + nx + ny + 4;
+
+  diffcompare (&ds, 0, nx, 0, ny);
+  status = TRUE;
+
+out:
+  free (buf);
+  free (ina);
+  free (ida);
+  return status;
+}
+
+/*
+ * Show buffer bp from its start in a window, popping one up if none is
+ * on it yet.
+ */
+static bool
+diffshow (buffer_p bp)
+{
+  window_p wp;
+
+  if (bp->b_nwnd == 0)
+    {
+      buffer_p obp;
+
+      if ((wp = wpopup ()) == NULL)
+        return FALSE;
+      obp = wp->w_bufp;
+      wdetach (wp);
+      if (--obp->b_nwnd == 0)
+        {
+          obp->b_dotp = wp->w_dotp;
+          obp->b_doto = wp->w_doto;
+          obp->b_markp = wp->w_markp;
+          obp->b_marko = wp->w_marko;
+        }
+      wp->w_bufp = bp;
+      wattach (wp);
+      bp->b_nwnd++;
+    }
+
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp)
+      {
+        wp->w_linep = lforw (bp->b_linep);
+        wp->w_dotp = lforw (bp->b_linep);
+        wp->w_doto = 0;
+        wp->w_markp = NULL;
+        wp->w_marko = 0;
+        wp->w_flag |= WFMODE | WFHARD;
+      }
+
+  return TRUE;
+}
+
+/*
+ * Compare the current buffer with another one, and show the differences
+ * in the "*diff*" buffer, as "diff -u" of their files would.  A numeric
+ * argument is the number of lines of context around the changes.
+ */
+int
+diffbuffers (bool f, int n)
+{
+  buffer_p abp, bbp, dbp;
+  line_p *la = NULL, *lb = NULL;
+  char *ach = NULL, *bch;
+  int na, nb;
+  int counts[3] = { 0, 0, 0 };
+  int status;
+  char *bufn;
+
+  if (f && n < 0)
+    return FALSE;
+
+  status = newmlarg (&bufn, "Diff with buffer: ", sizeof (bname_t));
+  if (status != SUCCESS)
+    return status;
+
+  bbp = bfind (bufn, 0);
+  if (bbp == NULL)
+    {
+      mloutfmt ("Cannot find buffer: %s", bufn);
+      free (bufn);
+      return FAILURE;
+    }
+  free (bufn);
+
+  abp = curbp;
+  if (!bbp->b_active)
+    {
+      /* Read it in, as switching to it would.  */
+      if ((status = swbuffer (bbp)) != SUCCESS)
+        return status;
+      if ((status = swbuffer (abp)) != SUCCESS)
+        return status;
+    }
+
+  if (abp->b_pgr != NULL || bbp->b_pgr != NULL)
+    {
+      mloutstr ("%Cannot compare a paged buffer");
+      return FALSE;
+    }
+
+  dbp = bfind (diffname, 0);
+  if (dbp != NULL && (dbp == abp || dbp == bbp))
+    {
+      mloutfmt ("%%Cannot compare %s", diffname);
+      return FALSE;
+    }
+
+  status = FALSE;
+  if ((la = difflines (abp, &na)) == NULL
+      || (lb = difflines (bbp, &nb)) == NULL
+      || (ach = calloc ((size_t) na + nb + 1, 1)) == NULL)
+    goto nomem;
+  bch = ach + na;
+  if (!diffmark (la, na, ach, lb, nb, bch))
+    goto nomem;
+
+  if (memchr (ach, 1, na) == NULL && memchr (bch, 1, nb) == NULL)
+    {
+      mloutstr ("(No differences)");
+      status = TRUE;
+      goto out;
+    }
+
+  if (dbp == NULL && (dbp = bcreate (diffname, 0)) == NULL)
+    goto nomem;
+  dbp->b_flag &= ~BFCHG; /* Don't complain.  */
+  if ((status = bclear (dbp)) != TRUE)
+    goto out;
+
+  status = FALSE;
+  if (!diffadd (dbp, "--- ", *abp->b_fname ? abp->b_fname : abp->b_bname,
+                strlen (*abp->b_fname ? abp->b_fname : abp->b_bname))
+      || !diffadd (dbp, "+++ ", *bbp->b_fname ? bbp->b_fname : bbp->b_bname,
+                   strlen (*bbp->b_fname ? bbp->b_fname : bbp->b_bname)))
+    goto nomem;
+  if (!f)
+    n = DIFFCTX;
+  else if (n > na + nb)
+    n = na + nb; /* All there is.  */
+  if (!diffhunks (dbp, la, ach, na, lb, bch, nb, n, counts))
+    goto nomem;
+
+  dbp->b_dotp = lforw (dbp->b_linep);
+  dbp->b_doto = 0;
+  dbp->b_mode |= MDVIEW;
+  dbp->b_flag &= ~BFCHG;
+  if (!diffshow (dbp))
+    goto out;
+
+  mloutfmt ("(%d hunk%s, %d line%s deleted, %d inserted)", counts[0],
+            counts[0] == 1 ? "" : "s", counts[1], counts[1] == 1 ? "" : "s",
+            counts[2]);
+  status = TRUE;
+  goto out;
+
+nomem:
+  mloutstr ("%Memory exhausted while comparing");
+out:
+  free (ach);
+  free (lb);
+  free (la);
+  return status;
+}
+
+/* end of diff.c */
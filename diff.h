@@ -0,0 +1,8 @@
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+#include "defines.h"
+
+int diffbuffers (bool f, int n);
+
+#endif
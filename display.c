@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,6 +27,9 @@
 #include "estruct.h"
 #include "input.h"
 #include "line.h"
+#include "page.h"
+#include "search.h"
+#include "syntax.h"
 #include "terminal.h"
 #include "termio.h"
 #include "utf8.h"
@@ -33,6 +37,19 @@
 #include "window.h"
 #include "wrapper.h"
 
+/*
+ * The character attributes of a row are kept as the spans of cells that
+ * share them, in column order.  Cells outside of the spans have none,
+ * so that plain rows have no spans at all.  Adjacent spans never have
+ * the same attributes, which makes equal rows have equal lists.
+ */
+struct vspan
+{
+  int s_col;  /* First cell.  */
+  int s_len;  /* Number of cells.  */
+  int s_attr; /* Their attributes, never 0.  */
+};
+
 typedef struct video *video_p;
 struct video
 {
@@ -43,7 +60,11 @@ struct video
   int v_rfcolor; /* Requested forground color.  */
   int v_rbcolor; /* Requested background color.  */
 #endif
-  unicode_t v_text[1]; /* Screen data.  */
+  int v_nspan;          /* Number of attribute spans.  */
+  int v_maxspan;        /* Allocated size of v_span.  */
+  struct vspan *v_span; /* Attribute spans.  */
+  unicode_t *v_marks;   /* Combining mark of each cell, 0 if none.  */
+  unicode_t v_text[1];  /* Screen data.  */
 };
 
 #define VFCHG (1 << 0) /* Changed flag                 */
@@ -52,6 +73,13 @@ struct video
 #define VFREQ (1 << 3) /* reverse video request        */
 #define VFCOL (1 << 4) /* color change requested       */
 
+/*
+ * A cell of v_text holds a character.  A wide character takes two cells,
+ * the second being VTCONT, and a combining mark is kept in v_marks for
+ * the cell of the character it follows.  Writing a cell drops its mark.
+ */
+#define VTCONT 0x1FFFFF /* Right half of a wide character.  */
+
 static video_p *vscreen; /* Virtual screen.  */
 #if MEMMAP == 0 || SCROLLCODE
 static video_p *pscreen; /* Physical screen.  */
@@ -73,6 +101,12 @@ static int vtrow = 0;  /* Row location of SW cursor */
 static int vtcol = 0;  /* Column location of SW cursor */
 static int lbound = 0; /* leftmost column of current line being displayed */
 static int taboff = 0; /* tab offset for display       */
+static int vtattr = 0; /* Attributes of the cells written.  */
+
+/* Attributes of each cell of the rows compared by updateline().  */
+static int *vcells1;
+static int *vcells2;
+static int *noattrs; /* Those of plain rows.  */
 
 size_t scrollcount = 1; /* Number of lines to scroll.  */
 bool mpresf = FALSE;    /* TRUE if message in last line.  */
@@ -87,6 +121,13 @@ static void scrscroll (int from, int to, int count);
 static bool texttest (int vrow, int prow);
 static int endofline (unicode_t *s, int n);
 static void updext (void);
+static video_p vtalloc (void);
+static void vtsetattr (video_p vp, int col, int attr);
+static int vtaddspan (video_p vp, int i, int col, int len, int attr);
+static void vtdelspan (video_p vp, int i);
+static void vtclip (video_p vp, int col);
+static void vtspancopy (video_p dst, video_p src);
+static void vtcells (video_p vp, int *attrs);
 static int updateline (int row, video_p vp1, video_p vp2);
 static void modeline (window_p wp);
 static void mlputi (int i, int r);
@@ -120,19 +161,188 @@ vtinit (void)
 #endif
   for (i = 0; i < term.t_maxrow; i++)
     {
-      vp = xmalloc (sizeof (*vp) + term.t_maxcol * sizeof (unicode_t));
-      vp->v_flag = 0;
+      vp = vtalloc ();
 #if COLOR
       vp->v_rfcolor = 7;
       vp->v_rbcolor = 0;
 #endif
       vscreen[i] = vp;
 #if MEMMAP == 0 || SCROLLCODE
-      vp = xmalloc (sizeof (*vp) + term.t_maxcol * sizeof (unicode_t));
-      vp->v_flag = 0;
-      pscreen[i] = vp;
+      pscreen[i] = vtalloc ();
 #endif
     }
+
+  vcells1 = xmalloc (term.t_maxcol * sizeof (int));
+  vcells2 = xmalloc (term.t_maxcol * sizeof (int));
+  noattrs = xmalloc (term.t_maxcol * sizeof (int));
+  memset (noattrs, 0, term.t_maxcol * sizeof (int));
+}
+
+/* Allocate a row of the screen, without attributes.  */
+static video_p
+vtalloc (void)
+{
+  video_p vp;
+
+  vp = xmalloc (sizeof (*vp) + 2 * term.t_maxcol * sizeof (unicode_t));
+  vp->v_marks = &vp->v_text[term.t_maxcol];
+  memset (vp->v_marks, 0, term.t_maxcol * sizeof (unicode_t));
+  vp->v_flag = 0;
+  vp->v_nspan = 0;
+  vp->v_maxspan = 0;
+  vp->v_span = NULL;
+  return vp;
+}
+
+/*
+ * Give the cell at column col of row vp the attributes attr.  Writing a
+ * row from left to right only ever extends its last span or adds one.
+ */
+static void
+vtsetattr (video_p vp, int col, int attr)
+{
+  struct vspan *sp;
+  int i;
+
+  sp = vp->v_nspan != 0 ? &vp->v_span[vp->v_nspan - 1] : NULL;
+  if (sp == NULL || col >= sp->s_col + sp->s_len)
+    {
+      if (attr == 0)
+        return;
+      if (sp != NULL && sp->s_attr == attr
+          && sp->s_col + sp->s_len == col)
+        sp->s_len++;
+      else
+        vtaddspan (vp, vp->v_nspan, col, 1, attr);
+      return;
+    }
+
+  /* Find the span holding the cell, or the first one after it.  */
+  for (i = 0; vp->v_span[i].s_col + vp->v_span[i].s_len <= col; i++)
+    ;
+  sp = &vp->v_span[i];
+  if (sp->s_col <= col)
+    {
+      int end = sp->s_col + sp->s_len;
+
+      if (sp->s_attr == attr)
+        return;
+
+      /* Take the cell out of its span.  */
+      if (col + 1 < end && !vtaddspan (vp, i + 1, col + 1, end - col - 1,
+                                       vp->v_span[i].s_attr))
+        return;
+      vp->v_span[i].s_len = col - vp->v_span[i].s_col;
+      if (vp->v_span[i].s_len == 0)
+        vtdelspan (vp, i);
+      else
+        i++;
+    }
+
+  if (attr == 0 || !vtaddspan (vp, i, col, 1, attr))
+    return;
+
+  /* Join the spans around the cell if it gave them the same attributes.  */
+  if (i + 1 < vp->v_nspan && vp->v_span[i + 1].s_col == col + 1
+      && vp->v_span[i + 1].s_attr == attr)
+    {
+      vp->v_span[i].s_len += vp->v_span[i + 1].s_len;
+      vtdelspan (vp, i + 1);
+    }
+  if (i > 0 && vp->v_span[i - 1].s_col + vp->v_span[i - 1].s_len == col
+      && vp->v_span[i - 1].s_attr == attr)
+    {
+      vp->v_span[i - 1].s_len += vp->v_span[i].s_len;
+      vtdelspan (vp, i);
+    }
+}
+
+/*
+ * Insert a span before the i-th one of row vp.  The attributes are
+ * dropped if there is no memory for it, and FALSE returned.
+ */
+static int
+vtaddspan (video_p vp, int i, int col, int len, int attr)
+{
+  if (vp->v_nspan == vp->v_maxspan)
+    {
+      int nmax = vp->v_maxspan ? 2 * vp->v_maxspan : 8;
+      struct vspan *nspan = realloc (vp->v_span, nmax * sizeof (*nspan));
+
+      if (nspan == NULL)
+        return FALSE;
+      vp->v_span = nspan;
+      vp->v_maxspan = nmax;
+    }
+
+  memmove (&vp->v_span[i + 1], &vp->v_span[i],
+           (vp->v_nspan - i) * sizeof (*vp->v_span));
+  vp->v_span[i].s_col = col;
+  vp->v_span[i].s_len = len;
+  vp->v_span[i].s_attr = attr;
+  vp->v_nspan++;
+  return TRUE;
+}
+
+/* Remove the i-th span of row vp.  */
+static void
+vtdelspan (video_p vp, int i)
+{
+  vp->v_nspan--;
+  memmove (&vp->v_span[i], &vp->v_span[i + 1],
+           (vp->v_nspan - i) * sizeof (*vp->v_span));
+}
+
+/* Drop the attributes of the cells of row vp from column col on.  */
+static void
+vtclip (video_p vp, int col)
+{
+  struct vspan *sp;
+
+  while (vp->v_nspan != 0 && vp->v_span[vp->v_nspan - 1].s_col >= col)
+    vp->v_nspan--;
+
+  if (vp->v_nspan != 0)
+    {
+      sp = &vp->v_span[vp->v_nspan - 1];
+      if (sp->s_col + sp->s_len > col)
+        sp->s_len = col - sp->s_col;
+    }
+}
+
+/* Give row dst the attributes of row src.  */
+static void
+vtspancopy (video_p dst, video_p src)
+{
+  dst->v_nspan = 0;
+  if (src->v_nspan > dst->v_maxspan)
+    {
+      struct vspan *nspan = realloc (dst->v_span,
+                                     src->v_maxspan * sizeof (*nspan));
+
+      if (nspan == NULL)
+        return;
+      dst->v_span = nspan;
+      dst->v_maxspan = src->v_maxspan;
+    }
+
+  if (src->v_nspan != 0)
+    memcpy (dst->v_span, src->v_span, src->v_nspan * sizeof (*src->v_span));
+  dst->v_nspan = src->v_nspan;
+}
+
+/* Spread the attribute spans of row vp over the cells of attrs.  */
+static void
+vtcells (video_p vp, int *attrs)
+{
+  int i, j;
+
+  memset (attrs, 0, term.t_ncol * sizeof (int));
+  for (i = 0; i < vp->v_nspan; i++)
+    for (j = vp->v_span[i].s_col;
+         j < vp->v_span[i].s_col + vp->v_span[i].s_len && j < term.t_ncol;
+         j++)
+      attrs[j] = vp->v_span[i].s_attr;
 }
 
 #if CLEAN
@@ -143,11 +353,16 @@ vtfree (void)
   short i;
   for (i = 0; i < term.t_maxrow; i++)
     {
+      free (vscreen[i]->v_span);
       free (vscreen[i]);
 #if MEMMAP == 0 || SCROLLCODE
+      free (pscreen[i]->v_span);
       free (pscreen[i]);
 #endif
     }
+  free (vcells1);
+  free (vcells2);
+  free (noattrs);
   free (vscreen);
 #if MEMMAP == 0 || SCROLLCODE
   free (pscreen);
@@ -182,13 +397,19 @@ vttidy (void)
 /*
  * Set the virtual cursor to the specified row and column on the virtual
  * screen. There is no checking for nonsense values; this might be a good
- * idea during the early stages.
+ * idea during the early stages. Moving to the left edge of a row starts
+ * a new image of it, without attributes.
  */
 void
 vtmove (int row, int col)
 {
   vtrow = row;
   vtcol = col;
+  if (col <= 0)
+    {
+      vscreen[row]->v_nspan = 0;
+      memset (vscreen[row]->v_marks, 0, term.t_ncol * sizeof (unicode_t));
+    }
 }
 
 /*
@@ -205,14 +426,80 @@ sane_vtputc (unicode_t c)
   /* intended to be called by vtputc once sanity check has been done
   ** only normal printable char should be passed as parameter */
   unicode_t *vcp = vscreen[vtrow]->v_text; /* ptr to line being updated */
+  unicode_t *vmp = vscreen[vtrow]->v_marks;
   if (vtcol >= term.t_ncol)
-    vcp[term.t_ncol - 1] = '$';
+    {
+      if (vcp[term.t_ncol - 1] == VTCONT) /* Do not leave half of it.  */
+        {
+          vcp[term.t_ncol - 2] = ' ';
+          vmp[term.t_ncol - 2] = 0;
+        }
+      vcp[term.t_ncol - 1] = '$';
+      vmp[term.t_ncol - 1] = 0;
+      vtsetattr (vscreen[vtrow], term.t_ncol - 1, 0);
+    }
   else if (vtcol >= 0)
-    vcp[vtcol] = c;
+    {
+      vcp[vtcol] = c;
+      vmp[vtcol] = 0;
+      vtsetattr (vscreen[vtrow], vtcol, vtattr);
+    }
 
   vtcol++;
 }
 
+/*
+ * Put a wide character in two cells, or blanks when only one of them is
+ * on screen.
+ */
+static void
+vtputwide (unicode_t c)
+{
+  if (vtcol < 0 || vtcol >= term.t_ncol - 1)
+    {
+      sane_vtputc (' ');
+      sane_vtputc (' ');
+    }
+  else
+    {
+      sane_vtputc (c);
+      sane_vtputc (VTCONT);
+    }
+}
+
+/*
+ * Add a combining mark to the cell left of the cursor.  It is dropped
+ * when that cell is off screen or has a mark already.
+ */
+static void
+vtputmark (unicode_t c)
+{
+  unicode_t *vcp = vscreen[vtrow]->v_text;
+  int col = vtcol - 1;
+
+  if (col < 0 || col >= term.t_ncol)
+    return;
+  if (vcp[col] == VTCONT && col > 0)
+    col--;
+  if (vscreen[vtrow]->v_marks[col] == 0)
+    vscreen[vtrow]->v_marks[col] = c;
+}
+
+/*
+ * Send character c of a cell to the terminal, then its mark if any.  The
+ * right half of a wide character was drawn with the left one.
+ */
+static void
+ttputcell (unicode_t c, unicode_t mark)
+{
+  if (c == VTCONT)
+    return;
+
+  TTputc (c);
+  if (mark != 0)
+    TTputc (mark);
+}
+
 static void
 vtputc (unicode_t c)
 {
@@ -236,14 +523,30 @@ vtputc (unicode_t c)
       sane_vtputc (hex[c >> 4]);
       sane_vtputc (hex[c & 15]);
     }
-  else
+  else if (c < 0x300)
     sane_vtputc (c);
+  else
+    switch (unicode_width (c))
+      {
+      case 0:
+        vtputmark (c);
+        break;
+      case 2:
+        vtputwide (c);
+        break;
+      default:
+        sane_vtputc (c);
+      }
 }
 
+/*
+ * Put a string on the virtual screen and return the number of columns
+ * it took.
+ */
 static int
 vtputs (const char *s)
 {
-  int n = 0;
+  int col = vtcol;
 
   while (*s != '\0')
     {
@@ -251,10 +554,9 @@ vtputs (const char *s)
 
       s += utf8_to_unicode (s, 0, 4, &c);
       vtputc (c);
-      n++; /* Assume non wide char unicode.  */
     }
 
-  return n;
+  return vtcol - col;
 }
 /*
 static int
@@ -315,8 +617,12 @@ vteeol (void)
 {
   unicode_t *vcp = vscreen[vtrow]->v_text;
 
+  vtclip (vscreen[vtrow], vtcol);
   while (vtcol < term.t_ncol)
-    vcp[vtcol++] = ' ';
+    {
+      vscreen[vtrow]->v_marks[vtcol] = 0;
+      vcp[vtcol++] = ' ';
+    }
 }
 
 /*
@@ -386,6 +692,18 @@ update (int force)
     }
 #endif
 
+  /* Bring the lexer state of edited buffers up to date, lines below an
+     edit may have changed their look.  */
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (lexsync (wp->w_bufp))
+      {
+        window_p owp;
+
+        for (owp = wheadp; owp != NULL; owp = owp->w_wndp)
+          if (owp->w_bufp == wp->w_bufp)
+            owp->w_flag |= WFHARD;
+      }
+
   /* Update any windows that need refreshing.  */
   wp = wheadp;
   while (wp != NULL)
@@ -550,17 +868,79 @@ reframe (window_p wp)
   return SUCCESS;
 }
 
+/*
+ * Put line lp of window wp on the virtual screen, in the colours of the
+ * syntax of the buffer, and highlighting the matches of the search pattern
+ * if the buffer is in Hilite mode.  Only the characters that show are
+ * looked at: a row started left of the screen, as by updext(), skips to
+ * the first of them, and the row stops at the right edge.
+ */
 static void
-show_line (line_p lp)
+show_line (window_p wp, line_p lp)
 {
   int i = 0, len = llength (lp);
+  int *attrs = NULL; /* Syntax attributes of the bytes.  */
+  int abase = 0;     /* Offset of the first of them.  */
+  int *offs;   /* Start and end of the matches.  */
+  int n = 0;   /* Number of offsets.  */
+  int m = 0;   /* Next one to reach.  */
+  int lexed;   /* End of the bytes they are known for.  */
+
+  if (vtcol < 0)
+    {
+      /* Skip to the character at the left edge.  */
+      int skip = -vtcol;
+      int col;
+
+      i = lcolstart (lp, INT_MAX, skip, &col);
+      while (i < len)
+        {
+          unicode_t c;
+          int width = utf8_to_unicode (lp->l_text, i, len, &c);
+          int ncol = lcolnext (c, col);
 
-  while (i < len)
+          if (ncol > skip)
+            break;
+          i += width;
+          col = ncol;
+        }
+      vtcol = col - skip;
+    }
+  lexed = i;
+
+  /* A row is mostly no more than four bytes a column, but combining
+   * marks take none, so both are looked up again past the bytes done.
+   */
+  while (i < len && vtcol <= term.t_ncol)
     {
       unicode_t c;
-      i += utf8_to_unicode (lp->l_text, i, len, &c);
-      vtputc (c);
+
+      if (i >= lexed)
+        {
+          lexed = i + 4 * (term.t_ncol + 1);
+          attrs = lexline (wp->w_bufp, lp, i, lexed, &abase);
+          if ((wp->w_bufp->b_mode & MDHILIT) != 0)
+            {
+              n = hlmatches (wp->w_bufp, lp, i, lexed, &offs);
+              m = 0;
+            }
+        }
+      while (m < n && i >= offs[m])
+        m++;
+      vtattr = ((attrs != NULL) ? attrs[i - abase] : 0) | ((m & 1) ? ATREV : 0);
+      c = lp->l_text[i] & 0xFF;
+      if (c >= 0x20 && c < 0x7F) /* Printable ASCII needs no decoding.  */
+        {
+          i++;
+          sane_vtputc (c);
+        }
+      else
+        {
+          i += utf8_to_unicode (lp->l_text, i, len, &c);
+          vtputc (c);
+        }
     }
+  vtattr = 0;
 }
 
 /*
@@ -588,7 +968,7 @@ updone (window_p wp)
   vscreen[sline]->v_flag |= VFCHG;
   vscreen[sline]->v_flag &= ~VFREQ;
   vtmove (sline, 0);
-  show_line (lp);
+  show_line (wp, lp);
 #if COLOR
   vscreen[sline]->v_rfcolor = wp->w_fcolor;
   vscreen[sline]->v_rbcolor = wp->w_bcolor;
@@ -621,7 +1001,7 @@ updall (window_p wp)
       if (lp != wp->w_bufp->b_linep)
         {
           /* if we are not at the end */
-          show_line (lp);
+          show_line (wp, lp);
           lp = lforw (lp);
         }
 
@@ -644,7 +1024,7 @@ void
 updpos (void)
 {
   line_p lp;
-  short i;
+  int i;
 
   /* find the current row */
   lp = curwp->w_linep;
@@ -656,23 +1036,13 @@ updpos (void)
     }
 
   /* find the current column */
-  curcol = 0;
-  i = 0;
+  i = lcolstart (lp, curwp->w_doto, INT_MAX, &curcol);
   while (i < curwp->w_doto)
     {
       unicode_t c;
 
       i += utf8_to_unicode (lp->l_text, i, curwp->w_doto, &c);
-      if (c == '\t')
-        curcol += tabwidth - curcol % tabwidth;
-      else if (c < 0x20 || c == 0x7F)
-        curcol += 2; /* displayed as ^c */
-      else if (c >= 0x80 && c <= 0xA0)
-        curcol += 3; /* displayed as \xx */
-      else if (c >= 0x3000 && c <= 0x3FFF)
-        curcol += 2; /* double width unicode character */
-      else
-        curcol++;
+      curcol = lcolnext (c, curcol);
     }
 
   /* if extended, flag so and update the virtual line image */
@@ -711,7 +1081,7 @@ upddex (void)
                   || (curcol < term.t_ncol - 1))
                 {
                   vtmove (i, 0);
-                  show_line (lp);
+                  show_line (wp, lp);
                   vteeol ();
 
                   /* this line no longer is extended */
@@ -752,6 +1122,8 @@ updgar (void)
       txt = pscreen[i]->v_text;
       for (j = 0; j < term.t_ncol; j++)
         txt[j] = ' ';
+      memset (pscreen[i]->v_marks, 0, term.t_ncol * sizeof (unicode_t));
+      pscreen[i]->v_nspan = 0;
 #endif
     }
 
@@ -850,7 +1222,8 @@ scrolls (int inserts)
       end = endofline (vpv->v_text, cols);
       if (end == 0)
         target = first; /* newlines */
-      else if (memcmp (vpp->v_text, vpv->v_text, 4 * end) == 0)
+      else if (memcmp (vpp->v_text, vpv->v_text, 4 * end) == 0
+               && memcmp (vpp->v_marks, vpv->v_marks, 4 * end) == 0)
         target = first + 1; /* broken line newlines */
       else
         target = first;
@@ -919,6 +1292,8 @@ scrolls (int inserts)
           vpp = pscreen[to + i];
           vpv = vscreen[to + i];
           memcpy (vpp->v_text, vpv->v_text, 4 * cols);
+          memcpy (vpp->v_marks, vpv->v_marks, 4 * cols);
+          vtspancopy (vpp, vpv);
           vpp->v_flag = vpv->v_flag; /* XXX */
           if (vpp->v_flag & VFREV)
             {
@@ -946,6 +1321,8 @@ scrolls (int inserts)
           txt = pscreen[i]->v_text;
           for (j = 0; j < term.t_ncol; j++)
             txt[j] = ' ';
+          memset (pscreen[i]->v_marks, 0, term.t_ncol * sizeof (unicode_t));
+          pscreen[i]->v_nspan = 0;
           vscreen[i]->v_flag |= VFCHG;
         }
 #endif
@@ -973,7 +1350,12 @@ texttest (int vrow, int prow)
   struct video *vpv = vscreen[vrow]; /* virtual screen image */
   struct video *vpp = pscreen[prow]; /* physical screen image */
 
-  return memcmp (vpv->v_text, vpp->v_text, 4 * term.t_ncol) == 0;
+  return memcmp (vpv->v_text, vpp->v_text, 4 * term.t_ncol) == 0
+         && memcmp (vpv->v_marks, vpp->v_marks, 4 * term.t_ncol) == 0
+         && vpv->v_nspan == vpp->v_nspan
+         && (vpv->v_nspan == 0
+             || memcmp (vpv->v_span, vpp->v_span,
+                        vpv->v_nspan * sizeof (*vpv->v_span)) == 0);
 }
 
 /*
@@ -1011,7 +1393,7 @@ updext (void)
   /* once we reach the left edge                                  */
   vtmove (currow, -lbound); /* start scanning offscreen */
   lp = curwp->w_dotp;       /* line to output */
-  show_line (lp);
+  show_line (curwp, lp);
 
   /* truncate the virtual line, restore tab offset */
   vteeol ();
@@ -1019,6 +1401,10 @@ updext (void)
 
   /* and put a '$' in column 1 */
   vscreen[currow]->v_text[0] = '$';
+  vscreen[currow]->v_marks[0] = 0;
+  if (vscreen[currow]->v_text[1] == VTCONT)
+    vscreen[currow]->v_text[1] = ' ';
+  vtsetattr (vscreen[currow], 0, 0);
 }
 
 /*
@@ -1047,6 +1433,7 @@ updateline (int row, struct video *vp1, struct video *vp2)
       cp1++;
     }
   while (--nch != 0);
+  memcpy (vp2->v_marks, vp1->v_marks, 4 * term.t_ncol);
 #endif
 #if COLOR
   scwrite (row, vp1->v_text, vp1->v_rfcolor, vp1->v_rbcolor);
@@ -1079,6 +1466,10 @@ updateline (int row, struct video *vp1, struct video *vp2)
   unicode_t *cp3;
   unicode_t *cp4;
   unicode_t *cp5;
+  unicode_t *mp1;   /* virtual marks, indexed like v_text */
+  unicode_t *mp2;   /* physical marks */
+  int *ap1;         /* virtual attributes, indexed like v_text */
+  int *ap2;         /* physical attributes */
   bool nbflag;      /* non-blanks to the right flag? */
 #if REVSTA
   bool rev;         /* reverse video flag */
@@ -1088,6 +1479,15 @@ updateline (int row, struct video *vp1, struct video *vp2)
   /* set up pointers to virtual and physical lines */
   cp1 = &vp1->v_text[0];
   cp2 = &vp2->v_text[0];
+  mp1 = vp1->v_marks;
+  mp2 = vp2->v_marks;
+  if (vp1->v_nspan == 0 && vp2->v_nspan == 0)
+    ap1 = ap2 = noattrs; /* Plain rows, only the text may differ.  */
+  else
+    {
+      vtcells (vp1, ap1 = vcells1);
+      vtcells (vp2, ap2 = vcells2);
+    }
 
 #if COLOR
   TTforg (vp1->v_rfcolor);
@@ -1106,19 +1506,21 @@ updateline (int row, struct video *vp1, struct video *vp2)
       )
     {
       movecursor (row, 0); /* Go to start of line. */
-      TTrev (req);         /* set needed rev video state */
 
       /* scan through the line and dump it to the screen and
-         the virtual screen array                             */
+         the virtual screen array, in the needed rev video state */
       cp3 = &vp1->v_text[term.t_ncol];
       while (cp1 < cp3)
         {
-          TTputc (*cp1);
+          TTattr (ap1[cp1 - vp1->v_text] ^ (req ? ATREV : 0));
+          ttputcell (*cp1, mp1[cp1 - vp1->v_text]);
           ttcol++;
           *cp2++ = *cp1++;
         }
 
-      TTrev (FALSE); /* turn rev video off */
+      TTattr (0); /* turn attributes off */
+      memcpy (mp2, mp1, 4 * term.t_ncol);
+      vtspancopy (vp2, vp1);
 
       /* update the needed flags */
       vp1->v_flag &= ~VFCHG;
@@ -1135,7 +1537,9 @@ updateline (int row, struct video *vp1, struct video *vp2)
 #endif
 
   /* advance past any common chars at the left */
-  while (cp1 != &vp1->v_text[term.t_ncol] && cp1[0] == cp2[0])
+  while (cp1 != &vp1->v_text[term.t_ncol] && cp1[0] == cp2[0]
+         && mp1[cp1 - vp1->v_text] == mp2[cp1 - vp1->v_text]
+         && ap1[cp1 - vp1->v_text] == ap2[cp1 - vp1->v_text])
     {
       cp1++;
       cp2++;
@@ -1154,17 +1558,34 @@ updateline (int row, struct video *vp1, struct video *vp2)
       return TRUE;
     }
 
+  /* A wide character is redrawn from its left half.  */
+  if (cp1[0] == VTCONT)
+    {
+      cp1--;
+      cp2--;
+    }
+
   /* find out if there is a match on the right */
   nbflag = FALSE;
   cp3 = &vp1->v_text[term.t_ncol];
   cp4 = &vp2->v_text[term.t_ncol];
 
-  while (cp3[-1] == cp4[-1])
+  while (cp3[-1] == cp4[-1]
+         && mp1[cp3 - 1 - vp1->v_text] == mp2[cp3 - 1 - vp1->v_text]
+         && ap1[cp3 - 1 - vp1->v_text] == ap2[cp3 - 1 - vp1->v_text])
     {
       cp3--;
       cp4--;
-      if (cp3[0] != ' ') /* Note if any nonblank */
-        nbflag = TRUE;   /* in right match. */
+      if (cp3[0] != ' ' || mp1[cp3 - vp1->v_text] != 0
+          || ap1[cp3 - vp1->v_text] != 0) /* Note if any */
+        nbflag = TRUE;   /* nonblank in right match. */
+    }
+
+  /* ... and up to its right half.  */
+  if (cp3 != &vp1->v_text[term.t_ncol] && cp3[0] == VTCONT)
+    {
+      cp3++;
+      cp4++;
     }
 
   cp5 = cp3;
@@ -1172,7 +1593,8 @@ updateline (int row, struct video *vp1, struct video *vp2)
   /* Erase to EOL ? */
   if (!nbflag && eolexist && !req)
     {
-      while (cp5 != cp1 && cp5[-1] == ' ')
+      while (cp5 != cp1 && cp5[-1] == ' ' && mp1[cp5 - 1 - vp1->v_text] == 0
+             && ap1[cp5 - 1 - vp1->v_text] == 0)
         cp5--;
 
       if (cp3 - cp5 <= 3) /* Use only if erase is */
@@ -1180,18 +1602,17 @@ updateline (int row, struct video *vp1, struct video *vp2)
     }
 
   movecursor (row, cp1 - &vp1->v_text[0]); /* Go to start of line. */
-#if REVSTA
-  TTrev (rev);
-#endif
 
   while (cp1 != cp5)
     {
-      /* Ordinary.  */
-      TTputc (*cp1);
+      /* Ordinary.  The terminal only hears of attribute changes.  */
+      TTattr (ap1[cp1 - vp1->v_text]);
+      ttputcell (*cp1, mp1[cp1 - vp1->v_text]);
       ttcol++;
       *cp2++ = *cp1++;
     }
 
+  TTattr (0);
   if (cp5 != cp3)
     {
       /* Erase.  */
@@ -1199,9 +1620,8 @@ updateline (int row, struct video *vp1, struct video *vp2)
       while (cp1 != cp3)
         *cp2++ = *cp1++;
     }
-#if REVSTA
-  TTrev (FALSE);
-#endif
+  memcpy (mp2, mp1, 4 * term.t_ncol);
+  vtspancopy (vp2, vp1);
   vp1->v_flag &= ~VFCHG; /* flag this line as updated */
   return TRUE;
 }
@@ -1320,11 +1740,12 @@ modeline (window_p wp)
       {
         if ((lp = lforw (lp)) == wp->w_bufp->b_linep)
           {
-            msg = " Bot ";
+            if (pgends (bp, FORWARD))
+              msg = " Bot ";
             break;
           }
       }
-    if (lback (wp->w_linep) == wp->w_bufp->b_linep)
+    if (lback (wp->w_linep) == wp->w_bufp->b_linep && pgends (bp, REVERSE))
       {
         if (msg != NULL)
           {
@@ -1351,13 +1772,15 @@ modeline (window_p wp)
             numlines++;
             lp = lforw (lp);
           }
-        if (wp->w_dotp == bp->b_linep)
+        if (wp->w_dotp == bp->b_linep && pgends (bp, FORWARD))
           msg = " Bot ";
         else
           {
             int ratio = 0;
 
-            if (numlines != 0)
+            if (bp->b_pgr != NULL)
+              ratio = pgratio (bp, wp->w_linep);
+            else if (numlines != 0)
               ratio = (100L * predlines) / numlines;
             if (ratio > 99)
               ratio = 99;
@@ -1593,7 +2016,7 @@ mlputs (unsigned char *s)
         }
 
       TTputc (c);
-      ttcol++;
+      ttcol += unicode_width (c);
     }
 }
 
@@ -24,6 +24,7 @@
 #include "region.h"
 #include "search.h"
 #include "spawn.h"
+#include "undo.h"
 #include "window.h"
 #include "word.h"
 
@@ -63,6 +64,7 @@ struct key_tab keytab[NBINDS] =
   { CONTROL | 'Y', yank },
   { CONTROL | 'Z', backpage },
   { CONTROL | ']', metafn },
+  { CONTROL | '_', undo },
   { CTRLX | CONTROL | 'B', listbuffers },
   { CTRLX | CONTROL | 'C', quit }, /* Hard quit.  */
 #if PKCODE & AEDIT
@@ -127,6 +129,7 @@ struct key_tab keytab[NBINDS] =
   { CTRLX | 'R', risearch },
   { CTRLX | 'S', fisearch },
 #endif
+  { CTRLX | 'U', undo },
   { CTRLX | 'W', resize },
   { CTRLX | 'X', nextbuffer },
   { CTRLX | 'Z', enlargewind },
@@ -197,6 +200,7 @@ struct key_tab keytab[NBINDS] =
   { META | 'W', copyregion },
   { META | 'X', namedcmd },
   { META | 'Z', quickexit },
+  { META | '_', redo },
 
 #if VT220
   { SPEC | '1', gotobob /* Fisearch.  */ }, /* VT220 keys.  */
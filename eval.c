@@ -23,7 +23,9 @@
 #include "display.h"
 #include "estruct.h"
 #include "exec.h"
+#include "fence.h"
 #include "execute.h"
+#include "fileio.h"
 #include "flook.h"
 #include "input.h"
 #include "line.h"
@@ -137,6 +139,10 @@ static const char *envars[] =
   "hardtab",  /* TRUE for hard coded tab, FALSE for soft ones */
   "overlap",
   "jump",
+  "fsync",    /* sync written files to the disk */
+  "fencelim", /* # of lines a typed fence is matched in */
+  "bsize",    /* # of bytes in current buffer (read only) */
+  "blines",   /* # of lines in current buffer (read only) */
 #if SCROLLCODE
   "scroll", /* scroll enabled */
 #endif
@@ -186,6 +192,10 @@ enum
   EVHARDTAB,
   EVOVERLAP,
   EVSCROLLCOUNT,
+  EVFSYNC,
+  EVFENCELIM,
+  EVBSIZE,
+  EVBLINES,
   EVSCROLL
 };
 
@@ -304,7 +314,7 @@ struct variable_description
 
 static void findvar (char *var, struct variable_description *vd, int size);
 static int svar (struct variable_description *var, char *value);
-static char *i2a (int i);
+static char *i2a (long i);
 
 /*
  * putctext:
@@ -858,6 +868,14 @@ gtenv (char *vname)
       return i2a (overlap);
     case EVSCROLLCOUNT:
       return i2a (scrollcount);
+    case EVFSYNC:
+      return ltos (fsyncflag);
+    case EVFENCELIM:
+      return i2a (fencelim);
+    case EVBSIZE:
+      return i2a (bsize (curbp));
+    case EVBLINES:
+      return i2a (blines (curbp));
 #if SCROLLCODE
     case EVSCROLL:
       return ltos (term.t_scroll != NULL);
@@ -1088,7 +1106,7 @@ svar (struct variable_description *var, char *value)
           status = newwidth (TRUE, atoi (value));
           break;
         case EVCBUFNAME:
-          strcpy (curbp->b_bname, value);
+          status = bsetname (curbp, value);
           curwp->w_flag |= WFMODE;
           break;
         case EVCFNAME:
@@ -1146,14 +1164,10 @@ svar (struct variable_description *var, char *value)
           thisflag = saveflag;
           break;
         case EVSEARCH:
-          strcpy (pat, value);
-          rvstrcpy (tap, pat);
-#if MAGIC
-          mcclear ();
-#endif
+          status = setpattern (value);
           break;
         case EVREPLACE:
-          strcpy (rpat, value);
+          status = setrpattern (value);
           break;
         case EVMATCH:
           break;
@@ -1200,6 +1214,15 @@ svar (struct variable_description *var, char *value)
         case EVSCROLLCOUNT:
           scrollcount = atoi (value);
           break;
+        case EVFSYNC:
+          fsyncflag = stol (value);
+          break;
+        case EVFENCELIM:
+          fencelim = atoi (value);
+          break;
+        case EVBSIZE:
+        case EVBLINES:
+          break;
         case EVSCROLL:
 #if SCROLLCODE
           if (!stol (value))
@@ -1220,9 +1243,9 @@ svar (struct variable_description *var, char *value)
  * int i;   integer to translate to a string
  */
 static char *
-i2a (int i)
+i2a (long i)
 {
-  unsigned u;
+  unsigned long u;
   int sign; /* sign of resulting number */
   /* returns result string: sign digits null */
   static char result[1 + (sizeof i * 5 + 1) / 2 + 1];
@@ -1533,7 +1556,7 @@ sindex (const char *source, const char *pattern)
       csp = sp;
       while (*cp != '\0')
         {
-          if (!eq (*cp, *csp))
+          if (!eq ((unsigned char) *cp, (unsigned char) *csp))
             break;
           cp++;
           csp++;
@@ -820,6 +820,7 @@ dobuf (buffer_p bp)
           mp->l_bp = bstore->b_linep->l_bp;
           bstore->b_linep->l_bp = mp;
           mp->l_fp = bstore->b_linep;
+          bcount (bstore, linlen + 1, 1);
           goto onward;
         }
 
@@ -9,12 +9,17 @@
 #include "bind.h"
 #include "display.h"
 #include "estruct.h"
+#include "fence.h"
 #include "file.h"
+#include "follow.h"
 #include "input.h"
+#include "journal.h"
 #include "mlout.h"
+#include "page.h"
 #include "random.h"
 #include "search.h"
 #include "terminal.h"
+#include "undo.h"
 #include "window.h"
 
 int gasave = 256;  /* global ASAVE size            */
@@ -59,17 +64,15 @@ static int
 insbrace (int n, int c)
 {
   int ch; /* last character before input */
-  int oc; /* caractere oppose a c */
   int i;
-  int count;
   int target; /* column brace should go after */
   line_p oldlp;
   int oldoff;
+  line_p lp;
+  int offs;
 
   /* if not called with {, acts as insertion */
-  if (c == '}')
-    oc = '{';
-  else
+  if (c != '}')
     return linsert (n, c);
 
   /* scan to see if all preceding spaces are white spaces, if not, insert */
@@ -80,34 +83,16 @@ insbrace (int n, int c)
         return linsert (n, c);
     }
 
+  /* find the open brace, giving up as fmatch() does */
+  lp = curwp->w_dotp;
+  offs = curwp->w_doto;
+  if (fencefind (c, &lp, &offs, NULL, fencelim) != TRUE)
+    return linsert (n, c);
+
   oldlp = curwp->w_dotp;
   oldoff = curwp->w_doto;
 
-  count = 1;
-  do
-    {
-      if (boundry (curwp->w_dotp, curwp->w_doto, REVERSE))
-        {
-          /* at beginning of buffer, no match to be found */
-          curwp->w_dotp = oldlp;
-          curwp->w_doto = oldoff;
-          return linsert (n, c);
-        }
-
-      backchar (FALSE, 1);
-
-      /* if not eol */
-      if (curwp->w_doto != llength (curwp->w_dotp))
-        {
-          ch = lgetc (curwp->w_dotp, curwp->w_doto);
-          if (ch == c)
-            count++;
-          else if (ch == oc)
-            count--;
-        }
-    }
-  while (count > 0);
-
+  curwp->w_dotp = lp;
   curwp->w_doto = 0; /* debut de ligne */
   /* aller au debut de la ligne apres la tabulation */
   while ((ch = lgetc (curwp->w_dotp, curwp->w_doto)) == ' ' || ch == '\t')
@@ -139,7 +124,8 @@ insbrace (int n, int c)
 #if CFENCE
 /*
  * Close fences are matched against their partners, and if
- * on screen the cursor briefly lights there
+ * on screen the cursor briefly lights there.  The search
+ * stops at the top of the window, or after $fencelim lines.
  *
  * char ch;     fence type to match against
  */
@@ -148,9 +134,8 @@ fmatch (int ch)
 {
   line_p oldlp; /* original line pointer */
   int oldoff;         /* and offset */
-  line_p toplp; /* top line in current window */
-  int count;          /* current fence level count */
-  int opench;         /* open fence */
+  line_p lp;          /* where the match is */
+  int offs;
 
   /* $tpause <= 0 disable fmatch */
   if (term.t_pause <= 0)
@@ -163,48 +148,18 @@ fmatch (int ch)
   oldlp = curwp->w_dotp;
   oldoff = curwp->w_doto;
 
-  /* setup proper open fence for passed close fence */
-  if (ch == ')')
-    opench = '(';
-  else if (ch == '}')
-    opench = '{';
-  else
-    opench = '[';
-
-  /* find the top line and set up for scan */
-  toplp = curwp->w_linep->l_bp;
-  backchar (FALSE, 1); /* . was after the }, move back */
-
-  /* scan back until we find it, or reach past the top of the window */
-  count = 1;
-  do
-    {
-      /* At beginning of window or buffer, no match to be found */
-      if (curwp->w_dotp == toplp
-          || boundry (curwp->w_dotp, curwp->w_doto, REVERSE))
-        break;
-
-      backchar (FALSE, 1);
-
-      /* if not eol */
-      if (curwp->w_doto != llength (curwp->w_dotp))
-        {
-          int c; /* current character in scan */
-
-          c = lgetc (curwp->w_dotp, curwp->w_doto);
-          if (c == ch)
-            ++count;
-          else if (c == opench)
-            --count;
-        }
-    }
-  while (count > 0);
-
-  /* if count is zero, we have a match, display the sucker */
-  if (count == 0)
+  /* . was after the fence, look back from there to the top line */
+  lp = oldlp;
+  offs = oldoff - 1;
+  if (offs >= 0 && lgetc (lp, offs) == ch
+      && fencefind (ch, &lp, &offs, curwp->w_linep->l_bp, fencelim) == TRUE)
     {
       int i;
 
+      /* we have a match, display the sucker */
+      curwp->w_dotp = lp;
+      curwp->w_doto = offs;
+
       /* there is a real machine dependant timing problem here we have
          yet to solve......... */
       for (i = 0; i < term.t_pause; i++)
@@ -276,7 +231,7 @@ execute (int c, bool f, int n)
         }
     }
 
-  thisflag = 0; /* For the future.      */
+  thisflag = CFTYPE; /* Typing is undone as one.  */
 
   /* Following handling of overwrite is only valid when n == 1 */
   /* If we are in overwrite mode, not at eol,
@@ -318,9 +273,8 @@ execute (int c, bool f, int n)
       && (curbp->b_mode & MDASAVE) /* auto save is on */
       && --gacount == 0)
     { /* insertion count reached */
-      /* and save the file if needed */
-      upscreen (FALSE, 0);
-      filesave (FALSE, 0);
+      /* and save the buffer to its recovery file if needed */
+      autosave ();
       gacount = gasave;
     }
 
@@ -343,11 +297,17 @@ kbd_loop (void)
       int f;        /* default flag */
       int n;        /* numeric repeat count */
 
+      /* What follows is a new group of edits to undo.  */
+      undmark ();
+
       /* Execute the "command" macro...normally null. */
       saveflag = lastflag; /* Preserve lastflag through this. */
       execute (META | SPEC | 'C', FALSE, 1);
       lastflag = saveflag;
 
+      /* Hold the pages of paged buffers around their windows.  */
+      pgsync ();
+
 #if TYPEAH && PKCODE
       if (typahead ())
         {
@@ -370,13 +330,25 @@ kbd_loop (void)
         }
       else
         {
+          jrnflush ();
           update (FALSE);
+          pgidle ();
+          flwidle ();
           c = getcmd ();
         }
 #else
+      /* Idle, get the edit journals to the disk.  */
+      jrnflush ();
+
       /* Fix up the screen    */
       update (FALSE);
 
+      /* Index the files of paged buffers until a key comes.  */
+      pgidle ();
+
+      /* Keep up with the files of buffers in Follow mode.  */
+      flwidle ();
+
       /* get the next command from the keyboard */
       c = getcmd ();
 #endif
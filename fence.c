@@ -0,0 +1,159 @@
+/* fence.c -- implements fence.h */
+#include "fence.h"
+
+/*  fence.c
+ *
+ *      The routines in this file find the fence, a parenthesis, brace or
+ *      bracket, that matches another.  So that the lines in between need
+ *      not be gone through a character at a time, the number of each
+ *      fence in a line is kept in the line, counted the first time a scan
+ *      comes by and forgotten when the line is edited.  A line holding
+ *      fewer of the fences sought than are still open cannot hold the
+ *      match, and its counts alone are enough to pass it.  Typing a fence
+ *      far from its partner therefore costs a step along each line in
+ *      between, once they were counted.
+ */
+
+#include <string.h>
+
+#include "buffer.h"
+#include "estruct.h"
+#include "page.h"
+#include "search.h"
+
+int fencelim = 20000; /* # of lines a typed fence is matched in.  */
+
+static const char fences[] = "(){}[]";
+
+/* Return the fence counts of line lp, counting them if not known.  */
+static unsigned int
+fencecount (line_p lp)
+{
+  if ((lp->l_fence & FNKNOWN) == 0)
+    {
+      int n[6] = { 0, 0, 0, 0, 0, 0 };
+      unsigned int counts = FNKNOWN;
+      int i;
+
+      for (i = 0; i < llength (lp); i++)
+        switch (lp->l_text[i])
+          {
+          case '(':
+            n[0]++;
+            break;
+          case ')':
+            n[1]++;
+            break;
+          case '{':
+            n[2]++;
+            break;
+          case '}':
+            n[3]++;
+            break;
+          case '[':
+            n[4]++;
+            break;
+          case ']':
+            n[5]++;
+            break;
+          }
+
+      for (i = 0; i < 6; i++)
+        counts |= (unsigned int) (n[i] < FNMANY ? n[i] : FNMANY) << (4 * i);
+      lp->l_fence = counts;
+    }
+
+  return lp->l_fence;
+}
+
+/*
+ * Find in the current buffer the fence matching fence ch, taken to be at
+ * offset *poffs of line *plp: forward for an opener, back for a closer.
+ * Line stop, if not NULL, and the lines past it are not looked at, nor
+ * more than lim lines if lim is not 0.  Set *plp and *poffs to the match
+ * and return TRUE, or return FALSE if there is none, ABORT if the search
+ * gave up first.
+ */
+int
+fencefind (int ch, line_p *plp, int *poffs, line_p stop, long lim)
+{
+  const char *f;
+  line_p lp = *plp;
+  int offs = *poffs;
+  int dir;
+  int k, match;
+  int count = 1; /* # of fences left open.  */
+  long nlines = 0; /* # of lines passed.  */
+  int status;
+
+  if (ch == '\0' || (f = strchr (fences, ch)) == NULL)
+    return FALSE;
+
+  k = f - fences;
+  match = fences[k ^ 1];
+  dir = (k % 2 == 0) ? FORWARD : REVERSE;
+
+  pgpinned++; /* Keep the lines of a paged buffer held for *plp.  */
+  for (;;)
+    {
+      unsigned int counts;
+      int nch, nmatch;
+
+      /* Go through the rest of the line.  */
+      if (dir == FORWARD)
+        {
+          for (offs++; offs < llength (lp); offs++)
+            if (lp->l_text[offs] == ch)
+              count++;
+            else if (lp->l_text[offs] == match && --count == 0)
+              break;
+        }
+      else
+        {
+          for (offs--; offs >= 0; offs--)
+            if (lp->l_text[offs] == ch)
+              count++;
+            else if (lp->l_text[offs] == match && --count == 0)
+              break;
+        }
+      if (count == 0)
+        {
+          *plp = lp;
+          *poffs = offs;
+          status = TRUE;
+          break;
+        }
+
+      /* Pass the lines that cannot hold the match.  */
+      for (;;)
+        {
+          if (lim != 0 && nlines++ == lim)
+            {
+              status = ABORT;
+              goto out;
+            }
+          if (curbp->b_pgr != NULL)
+            pgedge (curbp, lp, dir); /* Read on from the file.  */
+          lp = (dir == FORWARD) ? lforw (lp) : lback (lp);
+          if (lp == curbp->b_linep || lp == stop)
+            {
+              status = FALSE;
+              goto out;
+            }
+
+          counts = fencecount (lp);
+          nch = (counts >> (4 * k)) & FNMANY;
+          nmatch = (counts >> (4 * (k ^ 1))) & FNMANY;
+          if (nch == FNMANY || nmatch == FNMANY || nmatch >= count)
+            break;
+          count += nch - nmatch;
+        }
+      offs = (dir == FORWARD) ? -1 : llength (lp);
+    }
+
+out:
+  pgpinned--;
+  return status;
+}
+
+/* end of fence.c */
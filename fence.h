@@ -0,0 +1,20 @@
+#ifndef _FENCE_H_
+#define _FENCE_H_
+
+#include "line.h"
+
+/*
+ * The fences of a line are counted in its l_fence once FNKNOWN is set: a
+ * nibble for each of the characters of "(){}[]" in turn, FNMANY meaning
+ * that many or more.  An edit of the line forgets them.
+ */
+#define FNKNOWN 0x80000000U
+#define FNMANY  15
+
+#define fencedirty(lp) ((lp)->l_fence = 0)
+
+extern int fencelim; /* # of lines a typed fence is matched in.  */
+
+int fencefind (int ch, line_p *plp, int *poffs, line_p stop, long lim);
+
+#endif
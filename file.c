@@ -15,8 +15,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "buffer.h"
 #include "defines.h"
@@ -24,10 +28,15 @@
 #include "estruct.h"
 #include "execute.h"
 #include "fileio.h"
+#include "follow.h"
 #include "input.h"
+#include "journal.h"
 #include "line.h"
 #include "lock.h"
 #include "mlout.h"
+#include "page.h"
+#include "syntax.h"
+#include "undo.h"
 #include "utf8.h"
 #include "util.h"
 #include "window.h"
@@ -145,6 +154,8 @@ filefind (bool f, int n)
   return status;
 }
 
+static bool viewing = FALSE; /* Read the file found in VIEW mode.  */
+
 static void
 upd_mode (void)
 {
@@ -168,7 +179,9 @@ viewfile (bool f, int n)
   status = newmlarg (&fname, "View file: ", sizeof (fname_t));
   if (status == TRUE)
     {
+      viewing = TRUE;
       status = getfile (fname, FALSE);
+      viewing = FALSE;
       free (fname);
 
       if (status == TRUE)
@@ -255,6 +268,7 @@ getfile (const char *fname, bool lockfl)
       mloutstr ("Cannot create buffer");
       return FALSE;
     }
+  wdetach (curwp);
   if (--curbp->b_nwnd == 0)
     {
       /* Undisplay.  */
@@ -265,12 +279,33 @@ getfile (const char *fname, bool lockfl)
     }
   curbp = bp; /* Switch to it.  */
   curwp->w_bufp = bp;
+  wattach (curwp);
   curbp->b_nwnd++;
+  if (viewing)
+    curbp->b_mode |= MDVIEW; /* Before reading, so that it may page.  */
   s = readin (fname, lockfl); /* Read it in.  */
   cknewwindow ();
   return s;
 }
 
+/*
+ * Return TRUE if file fname has a recovery file no older than itself,
+ * left by an auto-save, and the user wants it read instead.  Its name is
+ * put in rname.
+ */
+static bool
+recoverask (const char *fname, char *rname)
+{
+  struct stat rst, fst;
+
+  recoveryname (rname, fname);
+  if (stat (rname, &rst) != 0
+      || (stat (fname, &fst) == 0 && fst.st_mtime > rst.st_mtime))
+    return FALSE;
+
+  return mlyesno ("Restore the auto-saved copy of this file?") == TRUE;
+}
+
 /*
  * Read file "fname" into the current buffer, blowing away any text
  * found there.  Called by both the read and find commands.  Return
@@ -288,6 +323,7 @@ readin (const char *fname, bool lockfl)
   window_p wp;
   int status;
   fio_code s;
+  bool restored = FALSE; /* Read from the recovery file.  */
 
 #if (FILOCK && BSD) || SVR4
   if (lockfl && lockchk (fname) == ABORT)
@@ -309,14 +345,28 @@ readin (const char *fname, bool lockfl)
       curbp->b_flag &= ~(BFINVS | BFCHG);
       if (fname != curbp->b_fname) /* Copy if source differs from destination.  */
         strscpy (curbp->b_fname, fname, sizeof (fname_t));
+      sxattach (curbp, curbp->b_fname);
 
       /* Let a user macro get hold of things if he wants.  */
       execute (SPEC | META | 'R', FALSE, 1);
 
-      s = ffropen (curbp->b_fname); /* Always use the name associated to buffer.  */
+      /* A file too big to be read in whole is paged when viewed.  */
+      if ((curbp->b_mode & MDVIEW) != 0 && pgopen (curbp))
+        s = FIOEOF;
+      else
+        {
+          char rname[sizeof (fname_t) + 2];
+
+          /* Always use the name associated to buffer.  */
+          restored = recoverask (curbp->b_fname, rname);
+          s = ffropen (restored ? rname : curbp->b_fname);
+        }
       if (s == FIOFNF)
-        /* File not found.  */
-        mloutstr ("(New file)");
+        {
+          /* File not found.  */
+          mloutstr ("(New file)");
+          flwload (curbp, 0L); /* Follow it, should it come.  */
+        }
       else if (s == FIOSUC)
         {
           char *errmsg;
@@ -342,6 +392,7 @@ readin (const char *fname, bool lockfl)
               lp->l_bp = lp->l_fp->l_bp;
               lp->l_fp->l_bp = lp;
               lp->l_bp->l_fp = lp;
+              bcount (curbp, fpayload + 1, 1);
               nline++;
             }
 
@@ -386,10 +437,14 @@ readin (const char *fname, bool lockfl)
           else
             errmsg = "";
 
-          mloutfmt ("(%sRead %d line%s, code: %s, EOL: %s)", errmsg, nline,
-                    &"s"[nline == 1], codename[fcode & (FCODE_MASK - 1)],
-                    eolname[found_eol]);
+          if (restored)
+            curbp->b_flag |= BFCHG; /* The file is still the old one.  */
+          mloutfmt ("(%s%s %d line%s, code: %s, EOL: %s)", errmsg,
+                    restored ? "Restored" : "Read", nline, &"s"[nline == 1],
+                    codename[fcode & (FCODE_MASK - 1)], eolname[found_eol]);
           ffclose (); /* Ignore errors.  */
+          if (s == FIOEOF && !restored)
+            flwload (curbp, frbytes);
         }
     }
 
@@ -406,6 +461,11 @@ readin (const char *fname, bool lockfl)
         }
     }
 
+  if (restored)
+    jrnrestored (curbp);
+  else if (s != FIOERR) /* Its edits were to the file.  */
+    jrnreplay (curbp);
+
   return (s != FIOERR && s != FIOFNF) ? SUCCESS : FAILURE;
 }
 
@@ -499,8 +559,11 @@ filewrite (bool f, int n)
       else
         {
           status = writeout (fname);
-          if (status == TRUE)
-            strcpy (curbp->b_fname, fname);
+          if (status == TRUE && strcmp (curbp->b_fname, fname) != 0)
+            {
+              strcpy (curbp->b_fname, fname);
+              sxattach (curbp, curbp->b_fname); /* By its new suffix.  */
+            }
         }
 
       free (fname);
@@ -546,6 +609,141 @@ filesave (bool f, int n)
   return writeout (curbp->b_fname);
 }
 
+/*
+ * Put in rname the name of the recovery file of fname, which is the
+ * name with a '#' either side, in the same directory.
+ */
+void
+recoveryname (char *rname, const char *fname)
+{
+  const char *base = strrchr (fname, '/');
+  size_t dirlen = (base == NULL) ? 0 : base + 1 - fname;
+
+  memcpy (rname, fname, dirlen);
+  rname[dirlen] = '#';
+  strcpy (&rname[dirlen + 1], &fname[dirlen]);
+  strcat (rname, "#");
+}
+
+#if USG | BSD
+static pid_t asavepid = 0; /* Auto-save child at work, if any.  */
+static char asavetmp[sizeof (fname_t) + 16]; /* Its temporary file.  */
+
+static void
+unlinkrecovery (const char *fname)
+{
+  char rname[sizeof (fname_t) + 2];
+
+  recoveryname (rname, fname);
+  unlink (rname);
+}
+
+/*
+ * Forget the auto-save child once it is done.  With stop, kill it first
+ * and remove what it left behind.
+ */
+static void
+asavereap (bool stop)
+{
+  if (asavepid == 0)
+    return;
+
+  if (stop)
+    kill (asavepid, SIGKILL);
+  if (waitpid (asavepid, NULL, stop ? 0 : WNOHANG) != 0)
+    {
+      if (stop)
+        unlink (asavetmp);
+      asavepid = 0;
+    }
+}
+
+/*
+ * Write the lines of buffer bp to the file open on fd, and make sure
+ * they are on disk.
+ */
+static bool
+writerecovery (int fd, buffer_p bp)
+{
+  FILE *fp;
+  line_p lp;
+
+  fp = fdopen (fd, "w");
+  if (fp == NULL)
+    return FALSE;
+
+  for (lp = lforw (bp->b_linep); lp != bp->b_linep; lp = lforw (lp))
+    {
+      fwrite (lp->l_text, sizeof (char), llength (lp), fp);
+      if (bp->b_mode & MDDOS)
+        fputc ('\r', fp);
+      fputc ('\n', fp);
+    }
+
+  return fflush (fp) == 0 && !ferror (fp) && fsync (fd) == 0
+         && fclose (fp) == 0;
+}
+
+/*
+ * Auto-save the current buffer to its recovery file, leaving the file
+ * and the changed flag of the buffer alone.  A child process does the
+ * writing from the copy-on-write image of the buffer that fork() gives
+ * it, so that typing goes on while it waits on the disk.  It writes a
+ * temporary file and renames it over the recovery file, which is always
+ * either the previous save or the new one.  A save is skipped while the
+ * previous one is still at work.
+ */
+int
+autosave (void)
+{
+  char rname[sizeof (fname_t) + 2];
+  int fd;
+
+  asavereap (FALSE);
+  if (asavepid != 0 || (curbp->b_flag & BFCHG) == 0
+      || curbp->b_fname[0] == '\0')
+    return TRUE;
+
+  recoveryname (rname, curbp->b_fname);
+  sprintf (asavetmp, "%sXXXXXX", rname);
+  fd = mkstemp (asavetmp);
+  if (fd < 0)
+    {
+      mloutstr ("%Cannot create recovery file");
+      return FALSE;
+    }
+
+  asavepid = fork ();
+  if (asavepid == 0)
+    {
+      if (!writerecovery (fd, curbp) || rename (asavetmp, rname) != 0)
+        {
+          unlink (asavetmp);
+          _exit (1);
+        }
+      _exit (0);
+    }
+
+  close (fd);
+  if (asavepid < 0)
+    {
+      asavepid = 0;
+      unlink (asavetmp);
+      mloutstr ("%Cannot auto-save");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+#else
+int
+autosave (void)
+{
+  upscreen (FALSE, 0);
+  return filesave (FALSE, 0);
+}
+#endif
+
 /*
  * This function performs the details of file
  * writing. Uses the file management routines in the
@@ -558,7 +756,20 @@ int
 writeout (const char *fn)
 {
   fio_code s;
+  struct timeval start;
+
+  if (curbp->b_pgr != NULL)
+    {
+      /* Only some of the lines are here.  */
+      mloutstr ("%Cannot write a paged buffer");
+      return FALSE;
+    }
+
+#if USG | BSD
+  asavereap (TRUE); /* Its file would be older than this one.  */
+#endif
 
+  gettimeofday (&start, NULL);
   s = ffwopen (fn); /* Open writes message.  */
   if (s != FIOSUC)
     mloutstr ("Cannot open file for writing");
@@ -585,8 +796,28 @@ writeout (const char *fn)
       else
         {
           /* Successfull write and close.  */
-          mloutfmt ("(Wrote %d line%s)", nline, &"s"[nline == 1]);
+          struct timeval end;
+          long usec;
+
+          gettimeofday (&end, NULL);
+          usec = (end.tv_sec - start.tv_sec) * 1000000L
+                 + (end.tv_usec - start.tv_usec);
+          if (usec > 0)
+            mloutfmt ("(Wrote %d line%s, %D bytes at %D KB/s)", nline,
+                      &"s"[nline == 1], fwbytes,
+                      (long) (fwbytes / 1024.0 * 1000000.0 / usec));
+          else
+            mloutfmt ("(Wrote %d line%s, %D bytes)", nline, &"s"[nline == 1],
+                      fwbytes);
           curbp->b_flag &= ~BFCHG;
+#if USG | BSD
+          /* The file itself is current, stop recovering it.  */
+          if (curbp->b_fname[0] != '\0')
+            unlinkrecovery (curbp->b_fname);
+          unlinkrecovery (fn);
+#endif
+          jrndiscard (curbp); /* The file has it all now.  */
+          flwload (curbp, fwbytes);
           upd_mode ();
           return TRUE;
         }
@@ -631,6 +862,7 @@ filename (bool f, int n)
       if (curbp == bscratchp)
         {
           buffer_p bp;
+          bname_t bname;
 
           if ((bp = malloc (sizeof (*bp))) == NULL)
            {
@@ -638,6 +870,14 @@ filename (bool f, int n)
              return FALSE;
            }
 
+          makename (bname, fname);
+          bp->b_bname = NULL;
+          if (bsetname (bp, bname) != TRUE)
+            {
+              free (bp);
+              return FALSE;
+            }
+
           bp->b_bufp = bheadp->b_bufp;
           bheadp->b_bufp = bp;
 
@@ -650,17 +890,29 @@ filename (bool f, int n)
           bp->b_active = curbp->b_active;
           bp->b_nwnd   = curbp->b_nwnd;
           bp->b_flag   = curbp->b_flag;
+          bp->b_nbytes = curbp->b_nbytes;
+          bp->b_nlines = curbp->b_nlines;
+          bp->b_syntax = curbp->b_syntax;
+          bp->b_nlexdirty = -1;
+          bp->b_jrn    = NULL;
+          bp->b_pgr    = NULL;
+          bp->b_flw    = NULL;
+          bp->b_und    = NULL;
+          bp->b_pos    = NULL;
+          bposadd (bp, &bp->b_bpos[0], &bp->b_dotp, &bp->b_doto);
+          bposadd (bp, &bp->b_bpos[1], &bp->b_markp, &bp->b_marko);
 
           strscpy (bp->b_fname, fname, sizeof (fname_t));
-          makename (bp->b_bname, bp->b_fname);
 
           swbuffer (bp);
         }
       else
         strscpy (curbp->b_fname, fname, sizeof (fname_t));
+      sxattach (curbp, curbp->b_fname); /* By its new suffix.  */
       free (fname);
     }
 
+  flwdiscard (curbp); /* Not the file that was read.  */
   curbp->b_mode &= ~MDVIEW; /* No longer read only mode.  */
   upd_mode ();
   return TRUE;
@@ -712,13 +964,20 @@ ifile (const char *fname)
             }
 
           memcpy (lp->l_text, fline, fpayload);
-          lp->l_bp = lpp = curwp->w_dotp; /* Insert after dot line.  */
-          lp->l_fp = lpn = lpp->l_fp; /* Line after insert.  */
+          lpp = curwp->w_dotp; /* Insert after dot line.  */
+          lpn = lpp->l_fp; /* Line after insert.  */
+          jrnaddline (lpn, lp);
+          undaddline (lpn, lp);
+          lp->l_bp = lpp;
+          lp->l_fp = lpn;
 
           /* Relink new line between lpp and lpn.  */
           lpn->l_bp = lp;
           lpp->l_fp = lp;
 
+          lexdirty (lp);
+          bcount (curbp, fpayload + 1, 1);
+
           /* Advance and write out the current line.  */
           curwp->w_dotp = lp;
           nline++;
@@ -18,6 +18,8 @@ extern void unqname (char *name);
 extern int filewrite (bool f, int n);
 extern int filesave (bool f, int n);
 extern int writeout (const char *fn);
+extern int autosave (void);
+extern void recoveryname (char *rname, const char *fname);
 extern int filename (bool f, int n);
 
 #endif
@@ -10,9 +10,14 @@
  *  modified by Petri Kutvonen
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "defines.h"
 #include "retcode.h"
@@ -27,6 +32,26 @@ int fpayload; /* actual length of fline content */
 static FILE *ffp;   /* File pointer, all functions. */
 static int eofflag; /* end-of-file flag */
 
+/*
+ * A file is written through a large buffer of our own, into a temporary
+ * file next to it that is renamed over it once complete, so that a crash
+ * while saving leaves the old file whole.  Files that cannot be replaced
+ * that way, as behind a symbolic link, with other hard links or owned by
+ * someone else, are rewritten in place.
+ */
+#define FWBUFSIZ 65536 /* Size of the output buffer.  */
+
+bool fsyncflag = FALSE; /* Sync written files to the disk?  */
+long fwbytes;           /* # of bytes written to the file.  */
+long frbytes;           /* # of bytes read from the file.  */
+
+static int fwfd = -1;   /* File being written, -1 if none.  */
+static char *fwbuf;     /* Output buffer.  */
+static int fwused;      /* # of bytes in it.  */
+static bool fwerr;      /* A write failed.  */
+static char fwname[256];     /* Name of the file.  */
+static char fwtemp[256 + 8]; /* Temporary name, empty if in place.  */
+
 /*
  * Open a file for reading.
  */
@@ -43,14 +68,137 @@ ffropen (const char *fn)
   return FIOSUC;
 }
 
+/*
+ * Give the temporary file the owner and mode of the old file, whose
+ * status is st, or NULL for a new file.  Return FALSE if they cannot be
+ * kept, as when the old file is someone else's.
+ */
+static bool
+fwkeep (struct stat *st)
+{
+  mode_t mask;
+
+  if (st != NULL)
+    return fchown (fwfd, st->st_uid, st->st_gid) == 0
+           && fchmod (fwfd, st->st_mode & 07777) == 0;
+
+  mask = umask (0);
+  umask (mask);
+  return fchmod (fwfd, 0666 & ~mask) == 0;
+}
+
 /*
  * Open a file for writing. Return TRUE if all is well, and FALSE on error
- * (cannot create).
+ * (cannot create, or not writable).  The new contents go to a temporary
+ * file with the mode and owner of the old one, if it can be made and
+ * given them, or else to the file itself.
  */
 fio_code
 ffwopen (const char *fn)
 {
-  return (ffp = fopen (fn, "w")) == NULL ? FIOERR : FIOSUC;
+  struct stat st;
+  bool exists;
+
+  if (strlen (fn) >= sizeof (fwname)
+      || (fwbuf == NULL && (fwbuf = malloc (FWBUFSIZ)) == NULL))
+    return FIOERR;
+
+  exists = lstat (fn, &st) == 0;
+  if (exists && access (fn, W_OK) != 0)
+    return FIOERR; /* A rename would get round its mode.  */
+
+  fwtemp[0] = '\0';
+  if (!exists || (S_ISREG (st.st_mode) && st.st_nlink == 1))
+    {
+      sprintf (fwtemp, "%s.XXXXXX", fn);
+      fwfd = mkstemp (fwtemp);
+      if (fwfd < 0)
+        fwtemp[0] = '\0';
+      else if (!fwkeep (exists ? &st : NULL))
+        {
+          /* Rewrite it in place, which keeps them.  */
+          close (fwfd);
+          unlink (fwtemp);
+          fwfd = -1;
+          fwtemp[0] = '\0';
+        }
+    }
+
+  if (fwfd < 0 && (fwfd = open (fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    return FIOERR;
+
+  strcpy (fwname, fn);
+  fwused = 0;
+  fwerr = FALSE;
+  fwbytes = 0;
+  return FIOSUC;
+}
+
+/* Write n bytes of buf to the file being written.  */
+static void
+fwwrite (const char *buf, int n)
+{
+  while (n > 0 && !fwerr)
+    {
+      ssize_t done = write (fwfd, buf, n);
+
+      if (done < 0)
+        {
+          if (errno != EINTR)
+            fwerr = TRUE;
+        }
+      else
+        {
+          buf += done;
+          n -= done;
+          fwbytes += done;
+        }
+    }
+}
+
+/*
+ * Finish writing: empty the buffer, sync if asked to, and put the
+ * temporary file in place of the old one.
+ */
+static fio_code
+fwclose (void)
+{
+  fwwrite (fwbuf, fwused);
+  fwused = 0;
+  if (fsyncflag && fsync (fwfd) != 0)
+    fwerr = TRUE;
+  if (close (fwfd) != 0)
+    fwerr = TRUE;
+  fwfd = -1;
+
+  if (fwtemp[0] != '\0')
+    {
+      if (!fwerr && rename (fwtemp, fwname) != 0)
+        fwerr = TRUE;
+      if (fwerr)
+        unlink (fwtemp);
+      else if (fsyncflag)
+        {
+          /* The rename is only safe once the directory is.  */
+          char *slash = strrchr (fwname, '/');
+          int dfd;
+
+          if (slash == NULL)
+            dfd = open (".", O_RDONLY);
+          else
+            {
+              *slash = '\0';
+              dfd = open (slash == fwname ? "/" : fwname, O_RDONLY);
+            }
+          if (dfd >= 0)
+            {
+              fsync (dfd);
+              close (dfd);
+            }
+        }
+    }
+
+  return fwerr ? FIOERR : FIOSUC;
 }
 
 /*
@@ -59,6 +207,9 @@ ffwopen (const char *fn)
 fio_code
 ffclose (void)
 {
+  if (fwfd >= 0)
+    return fwclose ();
+
   /* free this since we do not need it anymore */
   if (fline != NULL)
     {
@@ -70,28 +221,38 @@ ffclose (void)
   ftype = FTYPE_NONE;
   fcode = FCODE_ASCII;
 
+  frbytes = ftell (ffp);
   return fclose (ffp) != FALSE ? FIOERR : FIOSUC;
 }
 
 /*
  * Write a line to the already opened file. The "buf" points to the buffer,
- * and the "nbuf" is its length, less the free newline. Return the status.
- * Check only at the newline.
+ * and the "nbuf" is its length, less the free newline. Return the status,
+ * which is an error from the first write that failed on.
  */
 fio_code
 ffputline (char *buf, int nbuf, bool dosflag)
 {
-  fwrite (buf, sizeof (char), nbuf, ffp);
+  if (fwused + nbuf + 2 > FWBUFSIZ)
+    {
+      fwwrite (fwbuf, fwused);
+      fwused = 0;
+      if (nbuf + 2 > FWBUFSIZ)
+        {
+          /* Too long to be worth copying.  */
+          fwwrite (buf, nbuf);
+          nbuf = 0;
+        }
+    }
 
+  memcpy (&fwbuf[fwused], buf, nbuf);
+  fwused += nbuf;
   if (dosflag)
-    fputc ('\r', ffp);
-
-  fputc ('\n', ffp);
+    fwbuf[fwused++] = '\r';
 
-  if (ferror (ffp))
-    return FIOERR;
+  fwbuf[fwused++] = '\n';
 
-  return FIOSUC;
+  return fwerr ? FIOERR : FIOSUC;
 }
 
 /*
@@ -126,31 +287,30 @@ ffgetline (void)
   i = 0;
   while ((c = fgetc (ffp)) != EOF && c != '\r' && c != '\n')
     {
-      /* If line is full, get more room.  */
+      /* If line is full, get more room, doubling it so that a long line
+         is not copied over and over.  */
       if (i >= flen)
         {
           char *tmpline; /* temp storage for expanding line */
 
-          tmpline = malloc (flen + NSTRING);
+          tmpline = malloc (2 * flen);
           if (tmpline == NULL)
             return FIOMEM;
 
           memcpy (tmpline, fline, flen);
-          flen += NSTRING;
+          flen *= 2;
           free (fline);
           fline = tmpline;
         }
 
       fline[i++] = c;
-      lcode |= c;
     }
 
   fpayload = i;
-  lcode &= FCODE_MASK;
-  if (lcode && (fcode != FCODE_MIXED))
-    { /* line contains extended chars */
-      /* Check if consistent UTF-8 encoding */
-      int pos = 0;
+  if (fcode != FCODE_MIXED)
+    {
+      /* Check if consistent UTF-8 encoding, skipping runs of ASCII.  */
+      int pos = utf8_ascii_span (fline, i);
 
       while (pos < i && lcode != FCODE_MIXED)
         {
@@ -161,8 +321,9 @@ ffgetline (void)
           pos += bytes;
           if (bytes > 1) /* Multi byte UTF-8 sequence */
             lcode |= FCODE_UTF_8;
-          else if (uc > 127) /* Extended ASCII */
+          else /* Extended ASCII */
             lcode |= FCODE_EXTND;
+          pos += utf8_ascii_span (&fline[pos], i - pos);
         }
 
       fcode |= lcode;
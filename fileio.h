@@ -28,6 +28,9 @@ extern char *fline; /* Dynamic return line.  */
 extern int ftype;
 extern int fcode;    /* Encoding type.  */
 extern int fpayload; /* Actual length of fline content.  */
+extern bool fsyncflag; /* Sync written files to the disk?  */
+extern long fwbytes;   /* # of bytes written to the file.  */
+extern long frbytes;   /* # of bytes read from the file.  */
 
 extern fio_code ffclose (void);
 extern fio_code ffgetline (void);
@@ -0,0 +1,303 @@
+/* follow.c -- implements follow.h */
+#include "follow.h"
+
+/*  follow.c
+ *
+ *      The routines in this file keep a buffer in Follow mode up with its
+ *      file while something appends to it, as to a log.  When a file is
+ *      read in or written out, its size and identity are noted.  While
+ *      the keyboard is idle, the files of the buffers in Follow mode are
+ *      looked at every FLWPOLL milliseconds.  The bytes added at the end
+ *      are read and appended as lines, the first of them completing the
+ *      last line if the file did not end with a newline; the windows with
+ *      dot at the end of the buffer stay there, and so scroll along.  A
+ *      file that shrank, or that another one replaced under its name, as
+ *      when logs are rotated, is read again.
+ *
+ *      A changed buffer is not followed until it is saved, nor is a paged
+ *      one.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "display.h"
+#include "estruct.h"
+#include "fence.h"
+#include "input.h"
+#include "line.h"
+#include "mlout.h"
+#include "search.h"
+#include "syntax.h"
+#include "termio.h"
+#include "undo.h"
+#include "window.h"
+
+#define FLWPOLL   1000  /* Milliseconds between looks at the files.  */
+#define FLWBUFSIZ 65536 /* # of bytes read at a time.  */
+
+struct follow
+{
+  dev_t f_dev;    /* Device of the file, 0 with f_ino if none.  */
+  ino_t f_ino;    /* Its inode.  */
+  off_t f_off;    /* # of its bytes in the buffer.  */
+  bool f_partial; /* The last of them is not a newline.  */
+};
+
+/*
+ * Note that buffer bp holds the first size bytes of its file, just read
+ * in or written out.
+ */
+void
+flwload (buffer_p bp, long size)
+{
+  struct follow *f;
+  struct stat st;
+  int fd;
+  char c;
+
+  if ((f = bp->b_flw) == NULL)
+    {
+      if ((f = malloc (sizeof (*f))) == NULL)
+        return;
+      bp->b_flw = f;
+    }
+
+  f->f_off = size;
+  f->f_partial = FALSE;
+  if (stat (bp->b_fname, &st) != 0)
+    {
+      f->f_dev = 0;
+      f->f_ino = 0;
+      return;
+    }
+
+  f->f_dev = st.st_dev;
+  f->f_ino = st.st_ino;
+  if (size > 0 && (fd = open (bp->b_fname, O_RDONLY)) >= 0)
+    {
+      if (lseek (fd, size - 1, SEEK_SET) != (off_t) -1
+          && read (fd, &c, 1) == 1 && c != '\n')
+        f->f_partial = TRUE;
+      close (fd);
+    }
+}
+
+/*
+ * Forget the file of buffer bp.
+ */
+void
+flwdiscard (buffer_p bp)
+{
+  free (bp->b_flw);
+  bp->b_flw = NULL;
+}
+
+/*
+ * Line olp of buffer bp was reallocated as lp, move the pointers to it.
+ */
+static void
+flwmove (buffer_p bp, line_p olp, line_p lp)
+{
+  struct bpos *pp;
+
+  olp->l_bp->l_fp = lp;
+  lp->l_fp = olp->l_fp;
+  olp->l_fp->l_bp = lp;
+  lp->l_bp = olp->l_bp;
+
+  for (pp = bp->b_pos; pp != NULL; pp = pp->p_next)
+    if (*pp->p_lpp == olp)
+      *pp->p_lpp = lp;
+  if (matchline == olp)
+    matchline = lp;
+
+  lexcopy (lp, olp);
+  lexforget (olp);
+  hlforget (olp);
+  lcolforget (olp, -1);
+  undforget (olp);
+  free (olp);
+}
+
+/*
+ * Append the n bytes of text to buffer bp, as a line of their own or to
+ * complete its last one.  With eol, the line ends there.  Return FALSE
+ * if out of memory.
+ */
+static bool
+flwadd (buffer_p bp, struct follow *f, const char *text, int n, bool eol)
+{
+  line_p olp, lp;
+
+  olp = f->f_partial ? lback (bp->b_linep) : bp->b_linep;
+  if (olp == bp->b_linep)
+    {
+      if ((lp = lalloc (n)) == NULL)
+        return FALSE;
+
+      memcpy (lp->l_text, text, n);
+      lp->l_fp = bp->b_linep; /* Insert before end of buffer.  */
+      lp->l_bp = lp->l_fp->l_bp;
+      lp->l_fp->l_bp = lp;
+      lp->l_bp->l_fp = lp;
+      bcount (bp, n + 1, 1);
+    }
+  else if (llength (olp) + n <= olp->l_size)
+    {
+      lp = olp;
+      memcpy (&lp->l_text[llength (lp)], text, n);
+      lp->l_used += n;
+      fencedirty (lp);
+      hlforget (lp);
+      bcount (bp, n, 0);
+    }
+  else
+    {
+      if ((lp = lalloc (llength (olp) + n)) == NULL)
+        return FALSE;
+
+      memcpy (lp->l_text, olp->l_text, llength (olp));
+      memcpy (&lp->l_text[llength (olp)], text, n);
+      flwmove (bp, olp, lp);
+      bcount (bp, n, 0);
+    }
+
+  if (eol && (bp->b_mode & MDDOS) != 0 && llength (lp) > 0
+      && lgetc (lp, llength (lp) - 1) == '\r')
+    {
+      lp->l_used--;
+      bcount (bp, -1, 0);
+    }
+
+  f->f_partial = !eol;
+  return TRUE;
+}
+
+/*
+ * Append to buffer bp the bytes of its file past those it holds, until
+ * a key is waiting.
+ */
+static void
+flwread (buffer_p bp, struct follow *f)
+{
+  char *buf;
+  int fd;
+  int got;
+
+  if ((fd = open (bp->b_fname, O_RDONLY)) < 0)
+    return;
+
+  if ((buf = malloc (FLWBUFSIZ)) != NULL
+      && lseek (fd, f->f_off, SEEK_SET) != (off_t) -1)
+    while (!typahead () && (got = read (fd, buf, FLWBUFSIZ)) > 0)
+      {
+        const char *p, *nl;
+        int n;
+
+        for (p = buf; p < buf + got; p += n + (nl != NULL))
+          {
+            nl = memchr (p, '\n', buf + got - p);
+            n = (nl != NULL ? nl : buf + got) - p;
+            if (!flwadd (bp, f, p, n, nl != NULL))
+              goto out;
+
+            f->f_off += n + (nl != NULL);
+          }
+      }
+
+out:
+  free (buf);
+  close (fd);
+}
+
+/*
+ * The file of buffer bp is not the one it holds the start of any more,
+ * read it again from the start.  All the windows on bp go to its end.
+ */
+static void
+flwreread (buffer_p bp, struct follow *f, struct stat *st, const char *why)
+{
+  window_p wp;
+
+  bp->b_flw = NULL; /* Keep it through bclear().  */
+  bclear (bp);
+  bp->b_flw = f;
+
+  f->f_dev = st->st_dev;
+  f->f_ino = st->st_ino;
+  f->f_off = 0;
+  f->f_partial = FALSE;
+  mloutfmt ("(File %s, read again)", why);
+  flwread (bp, f);
+
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp)
+      wp->w_linep = lforw (bp->b_linep); /* Then frame the end.  */
+}
+
+/*
+ * Bring buffer bp up with its file.  Return TRUE if it changed.
+ */
+static bool
+flwpoll (buffer_p bp, struct follow *f)
+{
+  struct stat st;
+  window_p wp;
+
+  if (stat (bp->b_fname, &st) != 0)
+    return FALSE; /* Gone for now, as while logs are rotated.  */
+
+  if (st.st_dev != f->f_dev || st.st_ino != f->f_ino)
+    flwreread (bp, f, &st, "replaced");
+  else if (st.st_size < f->f_off)
+    flwreread (bp, f, &st, "truncated");
+  else if (st.st_size > f->f_off)
+    flwread (bp, f);
+  else
+    return FALSE;
+
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp)
+      wp->w_flag |= WFHARD | WFMODE;
+
+  return TRUE;
+}
+
+/*
+ * Follow the files of the buffers in Follow mode while no key is waiting.
+ */
+void
+flwidle (void)
+{
+  while (kbdmode != PLAY && !typahead ())
+    {
+      buffer_p bp;
+      bool any = FALSE;
+      bool moved = FALSE;
+
+      for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+        if ((bp->b_mode & MDFOLLOW) != 0 && bp->b_flw != NULL
+            && bp->b_pgr == NULL && (bp->b_flag & BFCHG) == 0)
+          {
+            any = TRUE;
+            if (flwpoll (bp, bp->b_flw))
+              moved = TRUE;
+          }
+
+      if (!any)
+        return;
+
+      if (moved)
+        update (FALSE);
+
+      if (ttwait (FLWPOLL))
+        return;
+    }
+}
+
+/* end of follow.c */
@@ -0,0 +1,10 @@
+#ifndef _FOLLOW_H_
+#define _FOLLOW_H_
+
+#include "buffer.h"
+
+void flwload (buffer_p bp, long size);
+void flwdiscard (buffer_p bp);
+void flwidle (void);
+
+#endif
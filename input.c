@@ -398,6 +398,13 @@ get1key (void)
 static unsigned int
 get1unicode (unicode_t *k)
 {
+#if POSIX
+  /* ttgetc() has already decoded the UTF-8 sequence, just report its
+     length.  */
+  char utf[4];
+
+  return unicode_to_utf8 (*k, utf);
+#else
   /* Accept UTF-8 sequence */
   unicode_t c = *k;
   if (c > 0xC1 && c <= 0xF4)
@@ -420,6 +427,7 @@ get1unicode (unicode_t *k)
     }
   else
     return 1;
+#endif
 }
 
 int
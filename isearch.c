@@ -25,6 +25,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "basic.h"
@@ -34,15 +35,15 @@
 #include "exec.h"
 #include "input.h"
 #include "line.h"
+#include "page.h"
 #include "search.h"
 #include "terminal.h"
+#include "utf8.h"
 #include "util.h"
 #include "window.h"
 
 /* Incremental search defines.  */
 #if ISRCH
-# define CMDBUFLEN 256 /* Length of our command buffer */
-
 # define IS_ABORT    0x07 /* Abort the isearch */
 # define IS_BACKSP   0x08 /* Delete previous char */
 # define IS_TAB      0x09 /* Tab character (allowed search char) */
@@ -58,11 +59,15 @@
 #endif
 
 static int isearch (bool f, int n);
-static int checknext (char chr, char *patrn, int dir);
+static int checknext (unicode_t chr, char *patrn, int dir);
 static int scanmore (char *patrn, int dir);
+static int extendmore (char *patrn, int dir);
 static int match_pat (char *patrn);
 static int promptpattern (char *prompt);
+static int echo_pat (int col);
+static int push_state (int dir, unsigned int cpos, int status);
 static int get_char (void);
+static int patroom (char **pbuf, unsigned int *psize, unsigned int need);
 static int uneat (void);
 static void reeat (int c);
 
@@ -73,11 +78,33 @@ static int echo_char (int c, int col);
 static int (*saved_get_char) (void); /* Get character routine */
 static int eaten_char = -1;          /* Re-eaten char */
 
-/* A couple more "own" variables for the command string */
-
-static int cmd_buff[CMDBUFLEN]; /* Save the command args here */
-static int cmd_offset;          /* Current offset into command buff */
-static int cmd_reexecute = -1;  /* > 0 if re-executing command */
+/*
+ * The state of the search after each key that changed it, so that a
+ * rubout only has to pop the last one.  The bottom entry is the state
+ * on entry.
+ */
+struct isearch_state
+{
+  line_p dotp;        /* Where "." was left */
+  int doto;
+  line_p mlinep;      /* Where the match starts */
+  int mlineo;
+  int dir;            /* Search direction */
+  unsigned int cpos;  /* Bytes of ipat in the pattern */
+  int status;         /* Did the pattern match? */
+};
+
+static struct isearch_state *is_stack; /* Grown as needed by push_state */
+static int is_size;                    /* Allocated entries */
+static int is_depth;                   /* Entries in use */
+
+/* The pattern being typed and the one we started with, both grown
+   as needed by patroom() and kept from one search to the next.  */
+
+static char *ipat;             /* Pattern being typed */
+static unsigned int ipat_size; /* Allocated size of ipat */
+static char *opat;             /* Saved copy of the old pattern str */
+static unsigned int opat_size; /* Allocated size of opat */
 
 /*
  * Subroutine to do incremental reverse search.  It actually uses the
@@ -88,6 +115,7 @@ risearch (bool f, int n)
 {
   line_p curline; /* Current line on entry.  */
   int curoff; /* Current offset on entry.  */
+  int status;
 
   /* Remember the initial . on entry: */
   curline = curwp->w_dotp; /* Save the current line pointer.  */
@@ -96,8 +124,11 @@ risearch (bool f, int n)
   /* Make sure the search does not match where we already are: */
   backchar (TRUE, 1); /* Back up a character.  */
 
-   /* Call ISearch backwards.  */
-  if (isearch (f, -n) == FAILURE)
+   /* Call ISearch backwards, keeping the lines of a paged buffer.  */
+  pgpinned++;
+  status = isearch (f, -n);
+  pgpinned--;
+  if (status == FAILURE)
     {
       /* If error in search: */
       curwp->w_dotp = curline; /* Reset the line pointer             */
@@ -125,15 +156,19 @@ fisearch (bool f, int n)
 {
   line_p curline; /* Current line on entry              */
   int curoff;           /* Current offset on entry            */
+  int status;
 
   /* remember the initial . on entry: */
 
   curline = curwp->w_dotp; /* Save the current line pointer      */
   curoff = curwp->w_doto;  /* Save the current offset            */
 
-  /* do the search */
+  /* do the search, keeping the lines of a paged buffer */
 
-  if (isearch (f, n) == FALSE)
+  pgpinned++;
+  status = isearch (f, n);
+  pgpinned--;
+  if (status == FALSE)
     { /* Call ISearch forwards        */ /* If error in search: */
       curwp->w_dotp = curline;     /* Reset the line pointer             */
       curwp->w_doto = curoff;      /*  and the offset to original value  */
@@ -184,50 +219,28 @@ isearch (bool f, int n)
   int col;            /* Prompt column.  */
   unsigned int cpos;  /* Character number in search string.  */
   int c;              /* Current input character.  */
+  unicode_t uc;       /* Current pattern character.  */
   int expc;           /* Function expanded input char.  */
-  spat_t pat_save;    /* Saved copy of the old pattern str.  */
-  line_p curline;     /* Current line on entry.  */
-  int curoff;         /* Current offset on entry.  */
-  int init_direction; /* The initial search direction.  */
+  struct isearch_state *isp; /* Restored state on rubout.  */
 
   /* Initialize starting conditions.  */
-  cmd_reexecute = -1; /* We are not re-executing (yet?).  */
-  cmd_offset = 0; /* Start at the beginning of the buff.  */
-  cmd_buff[0] = '\0'; /* Init the command buffer.  */
-  strscpy (pat_save, pat, sizeof pat_save); /* Save the old pattern string.  */
-  curline = curwp->w_dotp; /* Save the current line pointer.  */
-  curoff = curwp->w_doto; /* Save the current offset.  */
-  init_direction = n; /* Save the initial search direction.  */
-
-  /* This is a good place to start a re-execution: */
-
-start_over:
-  /* ask the user for the text of a pattern */
-  col = promptpattern ("I-search"); /* Prompt, remember the col   */
-
+  if (!patroom (&opat, &opat_size, strlen (pat) + 1)
+      || !patroom (&ipat, &ipat_size, 1))
+    return FALSE;
+  strcpy (opat, pat); /* Save the old pattern string.  */
+  ipat[0] = '\0';
   cpos = 0;      /* Start afresh               */
   status = TRUE; /* Assume everything's cool   */
+  is_depth = 0;  /* Remember the initial . on entry */
+  matchline = curwp->w_dotp;
+  matchoff = curwp->w_doto;
+  if (!push_state (n, cpos, status))
+    return FALSE;
 
-  /*
-     Get the first character in the pattern.  If we get an initial Control-S
-     or Control-R, re-use the old search string and find the first occurrence
-   */
+  /* ask the user for the text of a pattern */
+  col = promptpattern ("I-search"); /* Prompt, remember the col   */
 
   c = ectoc (expc = get_char ()); /* Get the first character    */
-  if ((c == IS_FORWARD) || (c == IS_REVERSE) || (c == IS_VMSFORW))
-    {                                        /* Reuse old search string?   */
-      for (cpos = 0; pat[cpos] != 0; cpos++) /* Yup, find the length */
-        col = echo_char (pat[cpos], col);    /*  and re-echo the string    */
-      if (c == IS_REVERSE)
-        {                     /* forward search?            */
-          n = -1;             /* No, search in reverse      */
-          backchar (TRUE, 1); /* Be defensive about EOB     */
-        }
-      else
-        n = 1;                        /* Yes, search forward        */
-      status = scanmore (pat, n);     /* Do the search              */
-      c = ectoc (expc = get_char ()); /* Get another character      */
-    }
 
   /* Top of the per character loop */
 
@@ -247,11 +260,25 @@ start_over:
         case IS_REVERSE:                  /* If backward search         */
         case IS_FORWARD:                  /* If forward search          */
         case IS_VMSFORW:                  /*  of either flavor          */
+          if (cpos == 0)
+            { /* Reuse old search string?   */
+              cpos = strlen (opat); /* Yup, find the length       */
+              if (!patroom (&ipat, &ipat_size, cpos + 1))
+                return TRUE;
+              strcpy (ipat, opat);
+              col = echo_pat (col); /*  and re-echo the string    */
+              if (cpos == 0 || !setpattern (ipat))
+                return TRUE;
+              if (c == IS_REVERSE)
+                backchar (TRUE, 1); /* Be defensive about EOB     */
+            }
           if (c == IS_REVERSE)            /* If reverse search              */
             n = -1;                       /* Set the reverse direction  */
           else                            /* Otherwise,                     */
             n = 1;                        /*  go forward                */
           status = scanmore (pat, n);     /* Start the search again     */
+          if (!push_state (n, cpos, status))
+            return TRUE;
           c = ectoc (expc = get_char ()); /* Get the next char          */
           continue;                       /* Go continue with the search */
 
@@ -269,16 +296,26 @@ start_over:
 
         case IS_BACKSP:                  /* If a backspace:            */
         case IS_RUBOUT:                  /*  or if a Rubout:           */
-          if (cmd_offset <= 1)           /* Anything to delete?            */
+          if (is_depth <= 1)             /* Anything to delete?        */
             return TRUE;                 /* No, just exit              */
-          --cmd_offset;                  /* Back up over the Rubout    */
-          cmd_buff[--cmd_offset] = '\0'; /* Yes, delete last char   */
-          curwp->w_dotp = curline;       /* Reset the line pointer     */
-          curwp->w_doto = curoff;        /*  and the offset            */
-          n = init_direction;            /* Reset the search direction */
-          strscpy (pat, pat_save, sizeof pat); /* Restore the old search str */
-          cmd_reexecute = 0;                   /* Start the whole mess over  */
-          goto start_over;                     /* Let it take care of itself */
+          isp = &is_stack[--is_depth - 1]; /* Yes, forget the last key */
+          curwp->w_dotp = isp->dotp;     /* Reset the line pointer     */
+          curwp->w_doto = isp->doto;     /*  and the offset            */
+          curwp->w_flag |= WFMOVE;       /* Say we've moved            */
+          matchline = isp->mlinep;       /* Reset the match            */
+          matchoff = isp->mlineo;
+          n = isp->dir;                  /* Reset the search direction */
+          status = isp->status;          /* and how well it went       */
+          if (isp->cpos != cpos)
+            { /* Did the pattern change?      */
+              cpos = isp->cpos;          /* Yup, cut it back           */
+              ipat[cpos] = '\0';
+              setpattern (cpos ? ipat : opat);
+              col = promptpattern ("I-search"); /* and show it again   */
+              col = echo_pat (col);
+            }
+          c = ectoc (expc = get_char ()); /* Get the next char          */
+          continue;
 
           /* Presumably a quasi-normal character comes here */
 
@@ -292,27 +329,69 @@ start_over:
 
       /* I guess we got something to search for, so search for it           */
 
-      pat[cpos++] = c; /* put the char in the buffer */
-      if (cpos >= sizeof pat)
-        { /* too many chars in string?  */
+      uc = c;                       /* the character as typed     */
+      if (!patroom (&ipat, &ipat_size, cpos + 5))
+        { /* no room for the string?    */
           /* Yup.  Complain about it    */
           mlwrite ("? Search string too long");
           return TRUE; /* Return an error            */
         }
-      pat[cpos] = 0;            /* null terminate the buffer  */
-      col = echo_char (c, col); /* Echo the character         */
+      cpos += unicode_to_utf8 (uc, &ipat[cpos]); /* put it in the buffer */
+      ipat[cpos] = 0;           /* null terminate the buffer  */
+      if (!setpattern (ipat))   /* and make it the pattern    */
+        return TRUE;
+      col = echo_char (uc, col); /* Echo the character         */
       if (!status)
         {             /* If we lost last time       */
           TTbeep ();  /* Feep again                 */
           TTflush (); /* see that the feep feeps    */
         }
       /* Otherwise, we must have won */
-      else if ((status = checknext (c, pat, n)) == FALSE) /* See if match */
-        status = scanmore (pat, n);   /*  or find the next match    */
+      else if ((status = checknext (uc, pat, n)) == FALSE) /* See if match */
+        status = extendmore (pat, n); /*  or find the next match    */
+      if (!push_state (n, cpos, status))
+        return TRUE;
       c = ectoc (expc = get_char ()); /* Get the next char          */
     }                                 /* for {;;} */
 }
 
+/*
+ * Remember the state after a key, for rubout to come back to.
+ *
+ * int dir;       Search direction
+ * unsigned cpos; Length of the pattern
+ * int status;    Did it match?
+ */
+static int
+push_state (int dir, unsigned int cpos, int status)
+{
+  struct isearch_state *isp;
+
+  if (is_depth >= is_size)
+    {
+      int size = is_size ? 2 * is_size : 64;
+
+      isp = realloc (is_stack, size * sizeof (*is_stack));
+      if (isp == NULL)
+        {
+          mlwrite ("? Search string too long");
+          return FALSE;
+        }
+      is_stack = isp;
+      is_size = size;
+    }
+
+  isp = &is_stack[is_depth++];
+  isp->dotp = curwp->w_dotp;
+  isp->doto = curwp->w_doto;
+  isp->mlinep = matchline;
+  isp->mlineo = matchoff;
+  isp->dir = dir;
+  isp->cpos = cpos;
+  isp->status = status;
+  return TRUE;
+}
+
 /*
  * Trivial routine to insure that the next character in the search string is
  * still true to whatever we're pointing to in the buffer.  This routine will
@@ -323,16 +402,16 @@ start_over:
  * If the compare fails, we return FALSE and assume the caller will call
  * scanmore or something.
  *
- * char chr;    Next char to look for
+ * unicode_t chr;   Next char to look for
  * char *patrn;   The entire search string (incl chr)
  * int dir;   Search direction
  */
 static int
-checknext (char chr, char *patrn, int dir) /* Check next character in search string */
+checknext (unicode_t chr, char *patrn, int dir) /* Check next character in search string */
 {
   line_p curline; /* current line during scan           */
   int curoff;           /* position within current line       */
-  int buffchar;         /* character at current position      */
+  unicode_t buffchar;   /* character at current position      */
   int status;           /* how well things go                 */
 
   /* setup the local scan pointer to current "." */
@@ -342,16 +421,9 @@ checknext (char chr, char *patrn, int dir) /* Check next character in search str
 
   if (dir > 0)
     { /* If searching forward                 */
-      if (curoff == llength (curline))
-        {                            /* If at end of line                    */
-          curline = lforw (curline); /* Skip to the next line              */
-          if (curline == curbp->b_linep)
-            return FALSE;  /* Abort if at end of buffer          */
-          curoff = 0;      /* Start at the beginning of the line */
-          buffchar = '\n'; /* And say the next char is NL        */
-        }
-      else
-        buffchar = lgetc (curline, curoff++); /* Get the next char         */
+      if (curoff == llength (curline) && lforw (curline) == curbp->b_linep)
+        return FALSE; /* Abort if at end of buffer          */
+      buffchar = nextcp (&curline, &curoff, FORWARD); /* Get the next char */
       if ((status = eq (buffchar, chr)) != 0)
         {                          /* Is it what we're looking for?      */
           curwp->w_dotp = curline; /* Yes, set the buffer's point        */
@@ -381,11 +453,8 @@ scanmore (char *patrn, int dir) /* search forward or back for a pattern */
 {
   int sts; /* search status                      */
 
-  if (dir < 0)
-    {                        /* reverse search?              */
-      rvstrcpy (tap, patrn); /* Put reversed string in tap */
-      sts = scanner (tap, REVERSE, PTBEG);
-    }
+  if (dir < 0) /* reverse search?              */
+    sts = scanner (tap, REVERSE, PTBEG); /* setpattern() reversed it */
   else
     sts = scanner (patrn, FORWARD, PTEND); /* Nope. Go forward   */
 
@@ -398,6 +467,58 @@ scanmore (char *patrn, int dir) /* search forward or back for a pattern */
   return sts; /* else, don't even try       */
 }
 
+/*
+ * The pattern just grew and no longer matches where we are.  Look for it
+ * again from the start of the last match, so that matches that overlap
+ * the old one are not skipped: one character on for forward searches,
+ * and back from where the grown pattern would end for reverse ones.
+ * "point" is left alone if there is no such match.
+ *
+ * char *patrn;     string to scan for
+ * int dir;     direction to search
+ */
+static int
+extendmore (char *patrn, int dir)
+{
+  line_p curline; /* "." on entry                     */
+  int curoff;
+  unsigned int i;
+  unsigned int len;
+  unicode_t pc;
+
+  curline = curwp->w_dotp;
+  curoff = curwp->w_doto;
+
+  /* Skip from the start of the last match, in the direction that
+   * finds the matches nearest to it first.  A forward match starts at
+   * matchline and ends at ".", a reverse one starts at "." itself.
+   */
+  if (dir > 0)
+    {
+      curwp->w_dotp = matchline;
+      curwp->w_doto = matchoff;
+    }
+  len = strlen (patrn);
+  for (i = 0; i < len;)
+    {
+      i += utf8_to_unicode (patrn, i, len, &pc);
+      if (dir < 0 && i >= len)
+        break; /* All but one char for reverse */
+      if (boundry (curwp->w_dotp, curwp->w_doto, FORWARD))
+        break;
+      nextcp (&curwp->w_dotp, &curwp->w_doto, FORWARD);
+      if (dir > 0)
+        break; /* Only one char for forward   */
+    }
+
+  if (scanmore (patrn, dir))
+    return TRUE;
+
+  curwp->w_dotp = curline; /* No luck, stay where we were */
+  curwp->w_doto = curoff;
+  return FALSE;
+}
+
 /*
  * The following is a worker subroutine used by the reverse search.  It
  * compares the pattern string with the characters at "." for equality. If
@@ -413,7 +534,9 @@ static int
 match_pat (char *patrn) /* See if the pattern string matches string at "."   */
 {
   unsigned i;           /* Generic loop index/offset          */
-  int buffchar;         /* character at current position      */
+  unsigned len;         /* Length of the pattern              */
+  unicode_t buffchar;   /* character at current position      */
+  unicode_t patchar;    /* character of the pattern           */
   line_p curline; /* current line during scan           */
   int curoff;           /* position within current line       */
 
@@ -424,24 +547,43 @@ match_pat (char *patrn) /* See if the pattern string matches string at "."   */
 
   /* top of per character compare loop: */
 
-  for (i = 0; i < strlen (patrn); i++)
+  len = strlen (patrn);
+  for (i = 0; i < len;)
     { /* Loop for all characters in patrn   */
-      if (curoff == llength (curline))
-        {                            /* If at end of line                    */
-          curline = lforw (curline); /* Skip to the next line              */
-          curoff = 0;                /* Start at the beginning of the line */
-          if (curline == curbp->b_linep)
-            return FALSE;  /* Abort if at end of buffer          */
-          buffchar = '\n'; /* And say the next char is NL        */
-        }
-      else
-        buffchar = lgetc (curline, curoff++); /* Get the next char         */
-      if (!eq (buffchar, patrn[i])) /* Is it what we're looking for?      */
-        return FALSE;               /* Nope, just punt it then            */
+      if (curoff == llength (curline) && lforw (curline) == curbp->b_linep)
+        return FALSE; /* Abort if at end of buffer          */
+      buffchar = nextcp (&curline, &curoff, FORWARD); /* Get the next char */
+      i += utf8_to_unicode (patrn, i, len, &patchar);
+      if (!eq (buffchar, patchar)) /* Is it what we're looking for?       */
+        return FALSE;              /* Nope, just punt it then             */
     }
   return TRUE; /* Everything matched? Let's celebrate */
 }
 
+/*
+ * Make sure the string buffer *pbuf, of *psize bytes, has room for at
+ * least need bytes, doubling it as it grows.
+ */
+static int
+patroom (char **pbuf, unsigned int *psize, unsigned int need)
+{
+  unsigned int size;
+  char *buf;
+
+  if (need <= *psize)
+    return TRUE;
+
+  for (size = *psize ? *psize : NPAT; size < need; size *= 2)
+    ;
+
+  if ((buf = realloc (*pbuf, size)) == NULL)
+    return FALSE;
+
+  *pbuf = buf;
+  *psize = size;
+  return TRUE;
+}
+
 /*
  * Routine to prompt for I-Search string.
  */
@@ -450,7 +592,7 @@ promptpattern (char *prompt)
 {
   char tpat[NPAT + 20];
 
-  setprompt (tpat, NPAT / 2, prompt, pat);
+  setprompt (tpat, NPAT / 2, prompt, opat);
 
   /* check to see if we are executing a command line */
   if (!clexec)
@@ -460,6 +602,23 @@ promptpattern (char *prompt)
   return strlen (tpat);
 }
 
+/*
+ * Echo the pattern typed so far, starting at column col.
+ */
+static int
+echo_pat (int col)
+{
+  unsigned int i;
+  unicode_t uc;
+
+  for (i = 0; ipat[i] != '\0';)
+    {
+      i += utf8_to_unicode (ipat, i, ipat_size, &uc);
+      col = echo_char (uc, col);
+    }
+  return col;
+}
+
 /*
  * routine to echo i-search characters
  *
@@ -510,35 +669,14 @@ echo_char (int c, int col)
 }
 
 /*
- * Routine to get the next character from the input stream.  If we're reading
- * from the real terminal, force a screen update before we get the char.
- * Otherwise, we must be re-executing the command string, so just return the
- * next character.
+ * Routine to get the next character from the input stream, forcing a
+ * screen update before we get the char.
  */
 static int
 get_char (void)
 {
-  int c; /* A place to get a character         */
-
-  /* See if we're re-executing: */
-
-  if (cmd_reexecute >= 0) /* Is there an offset?                    */
-    if ((c = cmd_buff[cmd_reexecute++]) != 0)
-      return c; /* Yes, return any character          */
-
-  /* We're not re-executing (or aren't any more).  Try for a real char      */
-
-  cmd_reexecute = -1; /* Say we're in real mode again       */
-  update (FALSE);     /* Pretty up the screen               */
-  if (cmd_offset >= CMDBUFLEN - 1)
-    { /* If we're getting too big ...         */
-      mlwrite ("? command too long"); /* Complain loudly and bitterly       */
-      return metac;                   /* And force a quit                   */
-    }
-  c = get1key ();              /* Get the next character             */
-  cmd_buff[cmd_offset++] = c;  /* Save the char for next time        */
-  cmd_buff[cmd_offset] = '\0'; /* And terminate the buffer           */
-  return c;                    /* Return the character               */
+  update (FALSE); /* Pretty up the screen               */
+  return get1key (); /* Get the next character          */
 }
 
 /*
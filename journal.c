@@ -0,0 +1,563 @@
+/* journal.c -- implements journal.h */
+#include "journal.h"
+
+/*  journal.c
+ *
+ *      The routines in this file keep a journal of the edits made to a
+ *      buffer, so that they can be replayed onto its file after a crash.
+ *      The journal of a file is "#name#.jnl" next to it, started by the
+ *      first edit after the file is read or written and removed when it
+ *      is written again.  One made for another version of the file, or
+ *      found when the buffer is restored from its auto-saved copy, is
+ *      moved to "#name#.jnl.old".  A journal holds a header with the size
+ *      and time of the file, then a record for each primitive edit:
+ *
+ *        s line offs len\n<bytes>      insert the bytes
+ *        i line offs n c\n             insert n copies of byte c
+ *        n line offs\n                 split the line
+ *        d line offs n\n               delete n bytes, a newline is one
+ *        r line len\n<bytes>           replace the text of the line
+ *        o line len\n<bytes>           insert a line before the line
+ *
+ *      Lines count from 0, and the end of the buffer is one past the last
+ *      of them.  Typing gathers in a single "s" record, and the records
+ *      go through stdio to reach the disk when the keyboard is idle.
+ *
+ *      Numbering a line must not cost a walk from the top of the buffer,
+ *      so a journal remembers the line before the last one edited and its
+ *      number.  No edit changes the lines before the one it is at, so
+ *      that line stays good, and the next edit, most often close by, is
+ *      found by walking from there.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "estruct.h"
+#include "file.h"
+#include "input.h"
+#include "mlout.h"
+#include "syntax.h"
+#include "window.h"
+
+#define JHEADER "uEMACS journal %ld %ld\n"
+#define NJPEND  256 /* # of bytes of typing in one record.  */
+
+struct journal
+{
+  FILE *j_fp;     /* The journal, NULL if it could not be made.  */
+  line_p j_line;  /* Line before the last edit, NULL if unknown.  */
+  int j_lnum;     /* Its number.  */
+  char j_name[1]; /* Name of the journal.  */
+};
+
+/* Typing not written yet, into the journal of pendbp.  */
+static buffer_p pendbp = NULL;
+static int pendline;
+static int pendoffs;
+static int pendlen;
+static char pendtext[NJPEND];
+
+static bool replaying = FALSE; /* Edits come from a journal.  */
+
+static struct journal *
+jrnalloc (buffer_p bp)
+{
+  struct journal *jp;
+
+  jp = malloc (sizeof (*jp) + sizeof (fname_t) + 8);
+  if (jp == NULL)
+    return NULL;
+
+  recoveryname (jp->j_name, bp->b_fname);
+  strcat (jp->j_name, ".jnl");
+  jp->j_fp = NULL;
+  jp->j_line = NULL;
+  jp->j_lnum = 0;
+  return jp;
+}
+
+/* Get the size and time of file fname, a size of -1 if there is none.  */
+static void
+filestamp (const char *fname, long *size, long *mtime)
+{
+  struct stat st;
+
+  if (stat (fname, &st) == 0)
+    {
+      *size = st.st_size;
+      *mtime = st.st_mtime;
+    }
+  else
+    {
+      *size = -1;
+      *mtime = 0;
+    }
+}
+
+/*
+ * Return the journal of buffer bp, starting it if this is its first
+ * edit, or NULL if the buffer is not journalled.
+ */
+static struct journal *
+jrnget (buffer_p bp)
+{
+  struct journal *jp = bp->b_jrn;
+
+  if (replaying || bp->b_fname[0] == '\0'
+      || (bp->b_flag & (BFINVS | BFTRUNC)) != 0)
+    return NULL;
+
+  if (jp == NULL)
+    {
+      int fd;
+
+      bp->b_jrn = jp = jrnalloc (bp);
+      if (jp == NULL)
+        return NULL;
+
+      fd = open (jp->j_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+      if (fd >= 0 && (jp->j_fp = fdopen (fd, "w")) == NULL)
+        close (fd);
+      if (jp->j_fp != NULL)
+        {
+          long size, mtime;
+
+          filestamp (bp->b_fname, &size, &mtime);
+          fprintf (jp->j_fp, JHEADER, size, mtime);
+        }
+    }
+
+  return (jp->j_fp != NULL) ? jp : NULL;
+}
+
+/* Remember the line before line lp, number n, which the edit leaves.  */
+static void
+jrnmark (struct journal *jp, buffer_p bp, line_p lp, int n)
+{
+  if (n > 0 && lback (lp) != bp->b_linep)
+    {
+      jp->j_line = lback (lp);
+      jp->j_lnum = n - 1;
+    }
+  else
+    jp->j_line = NULL;
+}
+
+/* Write out the gathered typing.  */
+static void
+jrnpending (void)
+{
+  if (pendbp != NULL && pendbp->b_jrn != NULL && pendbp->b_jrn->j_fp != NULL)
+    {
+      FILE *fp = pendbp->b_jrn->j_fp;
+
+      fprintf (fp, "s %d %d %d\n", pendline, pendoffs, pendlen);
+      fwrite (pendtext, sizeof (char), pendlen, fp);
+    }
+  pendbp = NULL;
+}
+
+/*
+ * Start a record about line lp of the current buffer, and return its
+ * number, or -1 if the buffer is not journalled.
+ */
+static int
+jrnstart (line_p lp, struct journal **jpp)
+{
+  struct journal *jp = jrnget (curbp);
+  int n;
+
+  if (jp == NULL)
+    return -1;
+
+  n = lnumber (curbp, lp, jp->j_line, jp->j_lnum);
+  if (n < 0)
+    {
+      /* Lost track of the lines, the journal is no good any more.  */
+      jrndiscard (curbp);
+      return -1;
+    }
+
+  jrnmark (jp, curbp, lp, n);
+  *jpp = jp;
+  return n;
+}
+
+/* Journal inserting n copies of byte c at dot.  */
+void
+jrninsert (int n, int c)
+{
+  struct journal *jp;
+  int k = jrnstart (curwp->w_dotp, &jp);
+
+  if (k < 0)
+    return;
+
+  if (n == 1 && pendbp == curbp && pendline == k
+      && pendoffs + pendlen == curwp->w_doto && pendlen < NJPEND)
+    {
+      pendtext[pendlen++] = c;
+      return;
+    }
+
+  jrnpending ();
+  if (n == 1)
+    {
+      pendbp = curbp;
+      pendline = k;
+      pendoffs = curwp->w_doto;
+      pendtext[0] = c;
+      pendlen = 1;
+    }
+  else
+    fprintf (jp->j_fp, "i %d %d %d %d\n", k, curwp->w_doto, n, c & 0xFF);
+}
+
+/* Journal splitting the line at dot.  */
+void
+jrnnewline (void)
+{
+  struct journal *jp;
+  int k = jrnstart (curwp->w_dotp, &jp);
+
+  if (k >= 0)
+    {
+      jrnpending ();
+      fprintf (jp->j_fp, "n %d %d\n", k, curwp->w_doto);
+    }
+}
+
+/* Journal deleting n bytes at dot.  */
+void
+jrndelete (int n)
+{
+  struct journal *jp;
+  int k;
+
+  if (n != 0 && (k = jrnstart (curwp->w_dotp, &jp)) >= 0)
+    {
+      jrnpending ();
+      fprintf (jp->j_fp, "d %d %d %d\n", k, curwp->w_doto, n);
+    }
+}
+
+/* Journal the new text of line lp, changed in place.  */
+void
+jrnreplace (line_p lp)
+{
+  struct journal *jp;
+  int k;
+
+  if (lp != curbp->b_linep && (k = jrnstart (lp, &jp)) >= 0)
+    {
+      jrnpending ();
+      fprintf (jp->j_fp, "r %d %d\n", k, llength (lp));
+      fwrite (lp->l_text, sizeof (char), llength (lp), jp->j_fp);
+    }
+}
+
+/* Journal linking the new line lp in before line before.  */
+void
+jrnaddline (line_p before, line_p lp)
+{
+  struct journal *jp;
+  int k = jrnstart (before, &jp);
+
+  if (k >= 0)
+    {
+      jrnpending ();
+      fprintf (jp->j_fp, "o %d %d\n", k, llength (lp));
+      fwrite (lp->l_text, sizeof (char), llength (lp), jp->j_fp);
+    }
+}
+
+/*
+ * Journal the n lines at lines, which are about to take the place of the
+ * n lines from line lp on, moved about.
+ */
+void
+jrnlines (line_p lp, line_p *lines, int n)
+{
+  struct journal *jp;
+  int i, k;
+
+  if (n > 0 && (k = jrnstart (lp, &jp)) >= 0)
+    {
+      jrnpending ();
+      for (i = 0; i < n; i++)
+        {
+          fprintf (jp->j_fp, "r %d %d\n", k + i, llength (lines[i]));
+          fwrite (lines[i]->l_text, sizeof (char), llength (lines[i]),
+                  jp->j_fp);
+        }
+    }
+}
+
+/* Journal dropping line lp, newline and all.  */
+void
+jrndelline (line_p lp)
+{
+  struct journal *jp;
+  int k;
+
+  if (lp != curbp->b_linep && (k = jrnstart (lp, &jp)) >= 0)
+    {
+      jrnpending ();
+      fprintf (jp->j_fp, "d %d 0 %d\n", k, llength (lp) + 1);
+    }
+}
+
+/*
+ * Get the records to the disk.  Called when the keyboard is idle, so
+ * that a burst of typing is written once.
+ */
+void
+jrnflush (void)
+{
+  buffer_p bp;
+
+  jrnpending ();
+  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+    if (bp->b_jrn != NULL && bp->b_jrn->j_fp != NULL)
+      fflush (bp->b_jrn->j_fp);
+}
+
+/*
+ * Drop the journal of buffer bp, whose text is now in its file or is
+ * being thrown away.
+ */
+void
+jrndiscard (buffer_p bp)
+{
+  struct journal *jp = bp->b_jrn;
+
+  if (pendbp == bp)
+    pendbp = NULL;
+  if (jp == NULL)
+    return;
+
+  if (jp->j_fp != NULL)
+    {
+      fclose (jp->j_fp);
+      unlink (jp->j_name);
+    }
+  free (jp);
+  bp->b_jrn = NULL;
+}
+
+void
+jrndiscardall (void)
+{
+  buffer_p bp;
+
+  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+    jrndiscard (bp);
+}
+
+/*
+ * Find line number n of buffer bp and put dot on it at offset offs.
+ * Return the line, or NULL if there is no such place.
+ */
+static line_p
+jrngoto (struct journal *jp, buffer_p bp, int n, int offs)
+{
+  line_p lp;
+
+  if (offs < 0 || (lp = lnumbered (bp, n, jp->j_line, jp->j_lnum)) == NULL
+      || offs > llength (lp) || (lp == bp->b_linep && offs != 0))
+    return NULL;
+
+  jrnmark (jp, bp, lp, n);
+  curwp->w_dotp = lp;
+  curwp->w_doto = offs;
+  return lp;
+}
+
+/* Insert len bytes read from fp at dot.  */
+static bool
+jrntext (FILE *fp, int len)
+{
+  int c;
+
+  while (len-- > 0)
+    if ((c = getc (fp)) == EOF || linsert_byte (1, c) != TRUE)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Apply the next record of fp to buffer bp.  */
+static bool
+jrnrecord (FILE *fp, struct journal *jp, buffer_p bp, int op)
+{
+  int k, offs, n, c;
+  line_p lp;
+
+  switch (op)
+    {
+    case 's':
+      return fscanf (fp, "%d %d %d", &k, &offs, &n) == 3
+             && getc (fp) == '\n' && jrngoto (jp, bp, k, offs) != NULL
+             && jrntext (fp, n);
+    case 'i':
+      return fscanf (fp, "%d %d %d %d", &k, &offs, &n, &c) == 4
+             && getc (fp) == '\n' && jrngoto (jp, bp, k, offs) != NULL
+             && linsert_byte (n, c) == TRUE;
+    case 'n':
+      return fscanf (fp, "%d %d", &k, &offs) == 2 && getc (fp) == '\n'
+             && jrngoto (jp, bp, k, offs) != NULL && lnewline () == TRUE;
+    case 'd':
+      if (fscanf (fp, "%d %d %d", &k, &offs, &n) != 3 || getc (fp) != '\n'
+          || jrngoto (jp, bp, k, offs) == NULL)
+        return FALSE;
+      ldelete (n, FALSE); /* Fails at the end as it did.  */
+      return TRUE;
+    case 'r':
+      if (fscanf (fp, "%d %d", &k, &n) != 2 || getc (fp) != '\n'
+          || (lp = jrngoto (jp, bp, k, 0)) == NULL || lp == bp->b_linep)
+        return FALSE;
+      return ldelete (llength (lp), FALSE) == TRUE && jrntext (fp, n);
+    case 'o':
+      {
+        line_p before;
+
+        if (fscanf (fp, "%d %d", &k, &n) != 2 || getc (fp) != '\n' || n < 0
+            || (before = jrngoto (jp, bp, k, 0)) == NULL
+            || (lp = lalloc (n)) == NULL)
+          return FALSE;
+        if (fread (lp->l_text, sizeof (char), n, fp) != (size_t) n)
+          {
+            free (lp);
+            return FALSE;
+          }
+        lp->l_fp = before;
+        lp->l_bp = lback (before);
+        lback (before)->l_fp = lp;
+        before->l_bp = lp;
+        lexdirty (lp);
+        bcount (bp, n + 1, 1);
+        lchange (WFHARD);
+        return TRUE;
+      }
+    }
+
+  return FALSE;
+}
+
+/*
+ * Move the journal of jp out of the way of the next one, for the user
+ * to see, saying why.  One that cannot be moved is removed, so that it
+ * is never replayed.
+ */
+static void
+jrnkeep (struct journal *jp, const char *why)
+{
+  char oname[sizeof (fname_t) + 16];
+
+  sprintf (oname, "%s.old", jp->j_name);
+  if (rename (jp->j_name, oname) == 0)
+    mloutfmt ("%%Edit journal %s, kept as %s", why, oname);
+  else if (unlink (jp->j_name) == 0)
+    mloutfmt ("%%Edit journal %s, cannot keep it", why);
+}
+
+/*
+ * Called when buffer bp has just been read from its recovery file.  A
+ * journal left for the file is not about this text, and must not be
+ * replayed onto the file, so it is moved away.  The edits of the buffer
+ * are not journalled until it is written, as there is no file to stamp
+ * them against, but the auto-save goes on.
+ */
+void
+jrnrestored (buffer_p bp)
+{
+  struct journal *jp;
+
+  if (bp->b_fname[0] == '\0' || (jp = jrnalloc (bp)) == NULL)
+    return;
+
+  if (access (jp->j_name, F_OK) == 0)
+    jrnkeep (jp, "is for the file, not the restored copy");
+  bp->b_jrn = jp; /* With no stream, until jrndiscard().  */
+}
+
+/*
+ * Called when the file of buffer bp has just been read.  If it has a
+ * journal left by a session that did not end, offer to replay it, then
+ * go on adding to it.
+ */
+void
+jrnreplay (buffer_p bp)
+{
+  struct journal *jp;
+  FILE *fp;
+  long size, mtime, jsize, jmtime;
+  long good;
+  int nrec = 0;
+  int op;
+
+  if (bp->b_fname[0] == '\0' || (bp->b_flag & BFTRUNC) != 0
+      || (bp->b_mode & MDVIEW) != 0 || (jp = jrnalloc (bp)) == NULL)
+    return;
+
+  if ((fp = fopen (jp->j_name, "r")) == NULL)
+    {
+      free (jp);
+      return;
+    }
+
+  filestamp (bp->b_fname, &size, &mtime);
+  if (fscanf (fp, JHEADER, &jsize, &jmtime) != 2
+      || jsize != size || jmtime != mtime)
+    {
+      fclose (fp);
+      jrnkeep (jp, "does not match the file");
+      free (jp);
+      return;
+    }
+
+  if (mlyesno ("Replay the edit journal of this file?") != TRUE)
+    {
+      fclose (fp);
+      unlink (jp->j_name);
+      free (jp);
+      mloutstr ("");
+      return;
+    }
+
+  replaying = TRUE;
+  good = ftell (fp);
+  while ((op = getc (fp)) != EOF && jrnrecord (fp, jp, bp, op))
+    {
+      good = ftell (fp);
+      nrec++;
+    }
+  replaying = FALSE;
+  fclose (fp);
+
+  if (op != EOF)
+    {
+      /* Keep what was replayed, so new records follow it.  */
+      if (truncate (jp->j_name, good) != 0)
+        {
+          /* They would be lost past the damage, stop journalling.  */
+          mloutfmt ("%%Edit journal damaged, replayed %d edits, "
+                    "cannot go on with it", nrec);
+          bp->b_jrn = jp;
+          return;
+        }
+      mloutfmt ("%%Edit journal damaged, replayed %d edits", nrec);
+    }
+  else
+    mloutfmt ("(Replayed %d edits)", nrec);
+
+  jp->j_fp = fopen (jp->j_name, "a");
+  bp->b_jrn = jp;
+}
+
+/* end of journal.c */
@@ -0,0 +1,20 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include "buffer.h"
+#include "line.h"
+
+void jrninsert (int n, int c);
+void jrnnewline (void);
+void jrndelete (int n);
+void jrnreplace (line_p lp);
+void jrnaddline (line_p before, line_p lp);
+void jrnlines (line_p lp, line_p *lines, int n);
+void jrndelline (line_p lp);
+void jrnflush (void);
+void jrndiscard (buffer_p bp);
+void jrndiscardall (void);
+void jrnreplay (buffer_p bp);
+void jrnrestored (buffer_p bp);
+
+#endif
@@ -23,7 +23,12 @@
 
 #include "buffer.h"
 #include "estruct.h"
+#include "fence.h"
+#include "journal.h"
 #include "mlout.h"
+#include "search.h"
+#include "syntax.h"
+#include "undo.h"
 #include "utf8.h"
 #include "window.h"
 
@@ -31,6 +36,34 @@ int tabwidth = 8; /* column span of a tab */
 
 static int ldelnewline (void);
 
+/*
+ * The display columns of a few long lines are kept as checkpoints, pairs
+ * of a byte offset and the column the character there starts in, every
+ * COLSTEP bytes or so.  Column queries then only decode the bytes from the
+ * nearest checkpoint on.  Checkpoints are worked out as far as the queries
+ * go, and an edit drops the ones after it.
+ */
+#define NCOLCACHE 4   /* # of lines with checkpoints.  */
+#define COLSTEP   256 /* # of bytes between checkpoints.  */
+
+struct colpoint
+{
+  int p_offs; /* Byte offset.  */
+  int p_col;  /* Its display column.  */
+};
+
+static struct colcache
+{
+  line_p c_line;          /* The line, NULL if unused.  */
+  int c_tab;              /* Tab width they were worked out with.  */
+  int c_n;                /* # of checkpoints, the first is (0, 0).  */
+  int c_max;              /* # allocated.  */
+  struct colpoint *c_pt;  /* The checkpoints.  */
+  unsigned int c_use;     /* When last used.  */
+} colcache[NCOLCACHE];
+
+static unsigned int coluse;
+
 /* The editor holds deleted text chunks in the struct kill buffer. The
  * kill buffer is logically a stream of ascii characters, however
  * due to its unpredicatable size, it gets implemented as a linked
@@ -193,60 +226,222 @@ lalloc (int used)
     {
       lp->l_size = size;
       lp->l_used = used;
+      lp->l_lexst = LXUNKNOWN;
+      fencedirty (lp);
+      hlforget (lp); /* The address may have been a line before.  */
+      lcolforget (lp, -1);
     }
 
   return lp;
 }
 
 /*
- * Delete line "lp". Fix all of the links that might point at it (they are
- * moved to offset 0 of the next line. Unlink the line from whatever buffer it
- * might be in. Release the memory. The buffers are updated too; the magic
- * conditions described in the above comments don't hold here.
+ * Return the display column after character c, shown from column col.
+ */
+int
+lcolnext (unicode_t c, int col)
+{
+  if (c == '\t')
+    return col + tabwidth - col % tabwidth;
+  else if (c < 0x20 || c == 0x7F) /* Displayed as ^C.  */
+    return col + 2;
+  else if (c >= 0x80 && c <= 0xA0) /* Displayed as \xx.  */
+    return col + 3;
+  else if (c < 0x300)
+    return col + 1;
+  else /* Combining marks take none, wide characters two.  */
+    return col + unicode_width (c);
+}
+
+/*
+ * Drop the checkpoints of line lp past byte offs, the line is about to
+ * change there.  NULL for lp drops those of all lines.
  */
 void
-lfree (line_p lp)
+lcolforget (line_p lp, int offs)
 {
-  buffer_p bp;
-  window_p wp;
+  struct colcache *cp;
 
-  wp = wheadp;
-  while (wp != NULL)
+  for (cp = colcache; cp < &colcache[NCOLCACHE]; cp++)
+    if (lp == NULL || cp->c_line == lp)
+      while (cp->c_n > 1 && cp->c_pt[cp->c_n - 1].p_offs > offs)
+        cp->c_n--;
+}
+
+/*
+ * Line "from" was reallocated as "to", keep its checkpoints.
+ */
+static void
+lcolmove (line_p from, line_p to)
+{
+  struct colcache *cp;
+
+  for (cp = colcache; cp < &colcache[NCOLCACHE]; cp++)
+    if (cp->c_line == to)
+      cp->c_line = NULL;
+  for (cp = colcache; cp < &colcache[NCOLCACHE]; cp++)
+    if (cp->c_line == from)
+      cp->c_line = to;
+}
+
+/*
+ * Return the byte offset of the last checkpoint of line lp which is neither
+ * past byte offs nor past column col, and its column in *pcol.  Column
+ * scans can go on from there instead of from the start of the line.
+ */
+int
+lcolstart (line_p lp, int offs, int col, int *pcol)
+{
+  struct colcache *cp, *lru = colcache;
+  struct colpoint *pt;
+  int len = llength (lp);
+  int lo, hi;
+
+  for (cp = colcache; cp < &colcache[NCOLCACHE]; cp++)
     {
-      if (wp->w_linep == lp)
-        wp->w_linep = lp->l_fp;
-      if (wp->w_dotp == lp)
-        {
-          wp->w_dotp = lp->l_fp;
-          wp->w_doto = 0;
-        }
-      if (wp->w_markp == lp)
+      if (cp->c_line == lp)
+        break;
+      if (cp->c_use < lru->c_use)
+        lru = cp;
+    }
+
+  if (cp == &colcache[NCOLCACHE])
+    {
+      /* Short lines are not worth a slot.  */
+      *pcol = 0;
+      if (len < COLSTEP)
+        return 0;
+
+      cp = lru;
+      cp->c_line = lp;
+      cp->c_n = 0;
+    }
+
+  if (cp->c_max == 0)
+    {
+      cp->c_pt = malloc (16 * sizeof *cp->c_pt);
+      if (cp->c_pt == NULL)
         {
-          wp->w_markp = lp->l_fp;
-          wp->w_marko = 0;
+          cp->c_line = NULL;
+          *pcol = 0;
+          return 0;
         }
-      wp = wp->w_wndp;
+      cp->c_max = 16;
+    }
+
+  if (cp->c_n == 0 || cp->c_tab != tabwidth)
+    {
+      cp->c_n = 1;
+      cp->c_pt[0].p_offs = 0;
+      cp->c_pt[0].p_col = 0;
+      cp->c_tab = tabwidth;
     }
-  bp = bheadp;
-  while (bp != NULL)
+  cp->c_use = ++coluse;
+
+  /* Drop checkpoints a shortening left behind.  */
+  while (cp->c_n > 1 && cp->c_pt[cp->c_n - 1].p_offs > len)
+    cp->c_n--;
+
+  pt = &cp->c_pt[cp->c_n - 1];
+  if (pt->p_offs + COLSTEP <= offs && pt->p_col < col)
     {
-      if (bp->b_nwnd == 0)
+      /* Work out the checkpoints up to the target.  */
+      int o = pt->p_offs;
+      int c = pt->p_col;
+
+      while (o < len)
         {
-          if (bp->b_dotp == lp)
+          /* Printable ASCII, a column a byte, is taken at once up to the
+             bounds and the next checkpoint, and looked at no further.  */
+          int run = cp->c_pt[cp->c_n - 1].p_offs + COLSTEP - o;
+
+          if (run > len - o)
+            run = len - o;
+          if (run > offs - o)
+            run = offs - o;
+          if (run > col - c)
+            run = col - c;
+          if (run > 0)
+            run = utf8_print_span (&lp->l_text[o], run);
+
+          if (run > 0)
             {
-              bp->b_dotp = lp->l_fp;
-              bp->b_doto = 0;
+              o += run;
+              c += run;
             }
-          if (bp->b_markp == lp)
+          else
             {
-              bp->b_markp = lp->l_fp;
-              bp->b_marko = 0;
+              unicode_t uc;
+              int o2 = o + utf8_to_unicode (lp->l_text, o, len, &uc);
+              int c2 = lcolnext (uc, c);
+
+              if (o2 > offs || c2 > col)
+                break;
+              o = o2;
+              c = c2;
+            }
+          if (o >= cp->c_pt[cp->c_n - 1].p_offs + COLSTEP)
+            {
+              if (cp->c_n == cp->c_max)
+                {
+                  struct colpoint *newpt;
+
+                  newpt = realloc (cp->c_pt, 2 * cp->c_max * sizeof *newpt);
+                  if (newpt == NULL)
+                    break;
+                  cp->c_pt = newpt;
+                  cp->c_max *= 2;
+                }
+              cp->c_pt[cp->c_n].p_offs = o;
+              cp->c_pt[cp->c_n].p_col = c;
+              cp->c_n++;
             }
         }
-      bp = bp->b_bufp;
     }
+
+  /* Find the last checkpoint within both bounds.  */
+  lo = 0;
+  hi = cp->c_n - 1;
+  while (lo < hi)
+    {
+      int mid = (lo + hi + 1) / 2;
+
+      if (cp->c_pt[mid].p_offs <= offs && cp->c_pt[mid].p_col <= col)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+
+  *pcol = cp->c_pt[lo].p_col;
+  return cp->c_pt[lo].p_offs;
+}
+
+/*
+ * Delete line "lp". Fix all of the links that might point at it (they are
+ * moved to offset 0 of the next line. Unlink the line from buffer "bp", whose
+ * places are the only ones that can be on it. Release the memory. The dot and
+ * mark of the buffer are updated too; the magic conditions described in the
+ * above comments don't hold here.
+ */
+void
+lfree (buffer_p bp, line_p lp)
+{
+  struct bpos *pp;
+
+  for (pp = bp->b_pos; pp != NULL; pp = pp->p_next)
+    if (*pp->p_lpp == lp)
+      {
+        *pp->p_lpp = lp->l_fp;
+        if (pp->p_offp != NULL)
+          *pp->p_offp = 0;
+      }
+  if (matchline == lp)
+    matchline = lp->l_fp;
+  bcount (bp, -(llength (lp) + 1), -1);
   lp->l_bp->l_fp = lp->l_fp;
   lp->l_fp->l_bp = lp->l_bp;
+  lexforget (lp);
+  undforget (lp);
   free (lp);
 }
 
@@ -265,6 +460,9 @@ lchange (int flag)
   if (curbp->b_nwnd != 1)
     /* Ensure hard.  */
     flag = WFHARD;
+  hlforget ((flag & WFHARD) ? NULL : curwp->w_dotp);
+  lcolforget ((flag & WFHARD) ? NULL : curwp->w_dotp, curwp->w_doto);
+  lexcut ((flag & WFHARD) ? NULL : curwp->w_dotp, curwp->w_doto);
   if ((curbp->b_flag & BFCHG) == 0)
     {
       /* First change, so update mode lines.  */
@@ -340,7 +538,7 @@ linsert_byte (int n, int c)
   line_p lp3;
   int doto;
   int i;
-  window_p wp;
+  struct bpos *pp;
 
   if (curbp->b_mode & MDVIEW)
     /* Do not allow this command if we are in read only mode.  */
@@ -358,6 +556,8 @@ linsert_byte (int n, int c)
         }
       if ((lp2 = lalloc (n)) == NULL) /* Allocate new line.  */
         return FALSE;
+      undinsert (n, c); /* Once nothing can fail, before dot moves.  */
+      jrninsert (n, c);
       lp3 = lp1->l_bp; /* Previous line.  */
       lp3->l_fp = lp2; /* Link in.  */
       lp2->l_fp = lp1;
@@ -365,6 +565,8 @@ linsert_byte (int n, int c)
       lp2->l_bp = lp3;
       for (i = 0; i < n; i++)
         lputc (lp2, i, c);
+      lexdirty (lp2);
+      bcount (curbp, n + 1, 1);
       curwp->w_dotp = lp2;
       curwp->w_doto = n;
       return TRUE;
@@ -375,6 +577,8 @@ linsert_byte (int n, int c)
       /* Hard: reallocate.  */
       if ((lp2 = lalloc (llength (lp1) + n)) == NULL)
         return FALSE;
+      undinsert (n, c);
+      jrninsert (n, c);
       cp1 = lp1->l_text;
       cp2 = lp2->l_text;
       while (cp1 != lp1->l_text + doto)
@@ -386,11 +590,16 @@ linsert_byte (int n, int c)
       lp2->l_fp = lp1->l_fp;
       lp1->l_fp->l_bp = lp2;
       lp2->l_bp = lp1->l_bp;
+      lexcopy (lp2, lp1);
+      lexforget (lp1);
+      lcolmove (lp1, lp2);
       free (lp1);
     }
   else
     {
       /* Easy: in place.  */
+      undinsert (n, c);
+      jrninsert (n, c);
       lp2 = lp1; /* Pretend new line.  */
       lp2->l_used += n;
       cp2 = lp1->l_text + llength (lp1);
@@ -400,25 +609,16 @@ linsert_byte (int n, int c)
     }
   for (i = 0; i < n; ++i) /* Add the characters.  */
     lputc (lp2, doto + i, c);
-  wp = wheadp; /* Update windows.  */
-  while (wp != NULL)
-    {
-      if (wp->w_linep == lp1)
-        wp->w_linep = lp2;
-      if (wp->w_dotp == lp1)
-        {
-          wp->w_dotp = lp2;
-          if (wp == curwp || wp->w_doto > doto)
-            wp->w_doto += n;
-        }
-      if (wp->w_markp == lp1)
-        {
-          wp->w_markp = lp2;
-          if (wp->w_marko > doto)
-            wp->w_marko += n;
-        }
-      wp = wp->w_wndp;
-    }
+  lexdirty (lp2);
+  bcount (curbp, n, 0);
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next) /* Update places.  */
+    if (*pp->p_lpp == lp1)
+      {
+        *pp->p_lpp = lp2;
+        if (pp->p_offp != NULL
+            && (pp->p_offp == &curwp->w_doto || *pp->p_offp > doto))
+          *pp->p_offp += n;
+      }
   return TRUE;
 }
 
@@ -510,7 +710,7 @@ lnewline (void)
   line_p lp1;
   line_p lp2;
   int doto;
-  window_p wp;
+  struct bpos *pp;
 
   if (curbp->b_mode & MDVIEW)
     /* Do not allow this command if we are in read only mode.  */
@@ -527,6 +727,8 @@ lnewline (void)
 
   if ((lp2 = lalloc (doto)) == NULL) /* New first half line.  */
     return FALSE;
+  undnewline (); /* Once it cannot fail.  */
+  jrnnewline ();
   cp1 = &lp1->l_text[0]; /* Shuffle text around.  */
   cp2 = &lp2->l_text[0];
   while (cp1 != &lp1->l_text[doto])
@@ -539,28 +741,68 @@ lnewline (void)
   lp1->l_bp = lp2;
   lp2->l_bp->l_fp = lp2;
   lp2->l_fp = lp1;
-  wp = wheadp; /* Windows.  */
-  while (wp != NULL)
+  lexcopy (lp2, lp1);
+  lexdirty (lp2);
+  lexdirty (lp1);
+  bcount (curbp, 1, 1);
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next) /* Places.  */
+    if (*pp->p_lpp == lp1)
+      {
+        if (pp->p_offp == NULL || *pp->p_offp < doto)
+          *pp->p_lpp = lp2;
+        else
+          *pp->p_offp -= doto;
+      }
+  return SUCCESS;
+}
+
+/*
+ * Replace the text of line lp of the current buffer with the len bytes at
+ * text, as one edit.  Places on the line keep their offsets, or go to its
+ * new end.  Return FALSE if out of memory.
+ */
+int
+lreplace (line_p lp, const char *text, int len)
+{
+  struct bpos *pp;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+
+  undline (lp);
+  lchange (WFHARD);
+  if (len > lp->l_size)
     {
-      if (wp->w_linep == lp1)
-        wp->w_linep = lp2;
-      if (wp->w_dotp == lp1)
-        {
-          if (wp->w_doto < doto)
-            wp->w_dotp = lp2;
-          else
-            wp->w_doto -= doto;
-        }
-      if (wp->w_markp == lp1)
-        {
-          if (wp->w_marko < doto)
-            wp->w_markp = lp2;
-          else
-            wp->w_marko -= doto;
-        }
-      wp = wp->w_wndp;
+      /* Hard: reallocate.  */
+      line_p lp2;
+
+      if ((lp2 = lalloc (len)) == NULL)
+        return FALSE;
+      lp->l_bp->l_fp = lp2;
+      lp2->l_fp = lp->l_fp;
+      lp->l_fp->l_bp = lp2;
+      lp2->l_bp = lp->l_bp;
+      for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+        if (*pp->p_lpp == lp)
+          *pp->p_lpp = lp2;
+      if (matchline == lp)
+        matchline = lp2;
+      lexcopy (lp2, lp);
+      lexforget (lp);
+      undforget (lp);
+      free (lp);
+      lp = lp2;
     }
-  return SUCCESS;
+  bcount (curbp, len - llength (lp), 0);
+  memcpy (lp->l_text, text, len);
+  lp->l_used = len;
+  lexdirty (lp);
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+    if (*pp->p_lpp == lp && pp->p_offp != NULL && *pp->p_offp > len)
+      *pp->p_offp = len;
+  jrnreplace (lp);
+  return TRUE;
 }
 
 int
@@ -613,12 +855,14 @@ ldelete (int n, bool kflag)
   line_p dotp;
   int doto;
   int chunk;
-  window_p wp;
+  struct bpos *pp;
 
   if (curbp->b_mode & MDVIEW)
     /* Do not allow this command if we are in read only mode.  */
     return rdonly ();
 
+  jrndelete (n);
+  unddelete (n);
   while (n != 0)
     {
       dotp = curwp->w_dotp;
@@ -659,23 +903,15 @@ ldelete (int n, bool kflag)
       while (cp2 != &dotp->l_text[dotp->l_used])
         *cp1++ = *cp2++;
       dotp->l_used -= chunk;
-      wp = wheadp; /* Fix windows.  */
-      while (wp != NULL)
-        {
-          if (wp->w_dotp == dotp && wp->w_doto >= doto)
-            {
-              wp->w_doto -= chunk;
-              if (wp->w_doto < doto)
-                wp->w_doto = doto;
-            }
-          if (wp->w_markp == dotp && wp->w_marko >= doto)
-            {
-              wp->w_marko -= chunk;
-              if (wp->w_marko < doto)
-                wp->w_marko = doto;
-            }
-          wp = wp->w_wndp;
-        }
+      lexdirty (dotp);
+      bcount (curbp, -chunk, 0);
+      for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next) /* Fix places.  */
+        if (*pp->p_lpp == dotp && pp->p_offp != NULL && *pp->p_offp >= doto)
+          {
+            *pp->p_offp -= chunk;
+            if (*pp->p_offp < doto)
+              *pp->p_offp = doto;
+          }
       n -= chunk;
     }
   return SUCCESS;
@@ -733,7 +969,7 @@ ldelnewline (void)
   line_p lp1;
   line_p lp2;
   line_p lp3;
-  window_p wp;
+  struct bpos *pp;
 
   if (curbp->b_mode & MDVIEW)
     /* Do not allow this command if we are in read only mode.  */
@@ -744,7 +980,7 @@ ldelnewline (void)
   if (lp2 == curbp->b_linep)
     {                       /* At the buffer end.   */
       if (lp1->l_used == 0) /* Blank line.              */
-        lfree (lp1);
+        lfree (curbp, lp1);
       return SUCCESS;
     }
 
@@ -754,27 +990,20 @@ ldelnewline (void)
       cp2 = &lp2->l_text[0];
       while (cp2 != &lp2->l_text[lp2->l_used])
         *cp1++ = *cp2++;
-      wp = wheadp;
-      while (wp != NULL)
-        {
-          if (wp->w_linep == lp2)
-            wp->w_linep = lp1;
-          if (wp->w_dotp == lp2)
-            {
-              wp->w_dotp = lp1;
-              wp->w_doto += lp1->l_used;
-            }
-          if (wp->w_markp == lp2)
-            {
-              wp->w_markp = lp1;
-              wp->w_marko += lp1->l_used;
-            }
-          wp = wp->w_wndp;
-        }
+      for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+        if (*pp->p_lpp == lp2)
+          {
+            *pp->p_lpp = lp1;
+            if (pp->p_offp != NULL)
+              *pp->p_offp += lp1->l_used;
+          }
       lp1->l_used += lp2->l_used;
       lp1->l_fp = lp2->l_fp;
       lp2->l_fp->l_bp = lp1;
+      lexdirty (lp1);
+      lexforget (lp2);
       free (lp2);
+      bcount (curbp, -1, -1);
       return SUCCESS;
     }
   if ((lp3 = lalloc (lp1->l_used + lp2->l_used)) == NULL)
@@ -790,29 +1019,22 @@ ldelnewline (void)
   lp3->l_fp = lp2->l_fp;
   lp2->l_fp->l_bp = lp3;
   lp3->l_bp = lp1->l_bp;
-  wp = wheadp;
-  while (wp != NULL)
-    {
-      if (wp->w_linep == lp1 || wp->w_linep == lp2)
-        wp->w_linep = lp3;
-      if (wp->w_dotp == lp1)
-        wp->w_dotp = lp3;
-      else if (wp->w_dotp == lp2)
-        {
-          wp->w_dotp = lp3;
-          wp->w_doto += lp1->l_used;
-        }
-      if (wp->w_markp == lp1)
-        wp->w_markp = lp3;
-      else if (wp->w_markp == lp2)
-        {
-          wp->w_markp = lp3;
-          wp->w_marko += lp1->l_used;
-        }
-      wp = wp->w_wndp;
-    }
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+    if (*pp->p_lpp == lp1)
+      *pp->p_lpp = lp3;
+    else if (*pp->p_lpp == lp2)
+      {
+        *pp->p_lpp = lp3;
+        if (pp->p_offp != NULL)
+          *pp->p_offp += lp1->l_used;
+      }
+  lexcopy (lp3, lp1);
+  lexforget (lp1);
+  lexforget (lp2);
+  lexdirty (lp3);
   free (lp1);
   free (lp2);
+  bcount (curbp, -1, -1);
   return SUCCESS;
 }
 
@@ -17,6 +17,8 @@
  * implied. Future additions will include update hints, and a list of marks
  * into the line.
  */
+struct buffer;
+
 typedef struct line *line_p;
 struct line
 {
@@ -24,6 +26,8 @@ struct line
   line_p l_bp;      /* Backward link to the previous line.  */
   int l_size;       /* Allocated size.  */
   int l_used;       /* Used size.  */
+  unsigned int l_fence;   /* Fences in the text, see fence.h.  */
+  unsigned short l_lexst; /* Lexer state at the start, see syntax.h.  */
   char l_text[1];   /* A bunch of characters.  */
 };
 
@@ -40,7 +44,7 @@ extern char *getkill (void);
 extern int backchar (bool f, int n);
 extern int forwchar (bool f, int n);
 
-extern void lfree (line_p lp);
+extern void lfree (struct buffer *bp, line_p lp);
 extern void lchange (int flag);
 extern int insspace (bool f, int n);
 extern int linstr (char *instr);
@@ -48,6 +52,7 @@ extern int linsert (int n, unicode_t c);
 extern int linsert_byte (int n, int c);
 extern int lover (char *ostr);
 extern int lnewline (void);
+extern int lreplace (line_p lp, const char *text, int len);
 extern int ldelete (int n, bool kflag);
 extern int ldelchar (int n, bool kflag);
 extern int lgetchar (unicode_t *);
@@ -56,6 +61,9 @@ extern void kdelete (void);
 extern int kinsert (int c);
 extern int yank (bool f, int n);
 extern line_p lalloc (int used); /* Allocate a line of at least USED chars. */
+extern int lcolnext (unicode_t c, int col);
+extern void lcolforget (line_p lp, int offs);
+extern int lcolstart (line_p lp, int offs, int col, int *pcol);
 
 extern int rdonly (void); /* Read Only error message, always returns FALSE.  */
 
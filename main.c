@@ -213,7 +213,7 @@ main (int argc, char **argv)
                 break;
               case 's': /* -s for initial search string.  */
                 searchflag = TRUE;
-                strscpy (pat, &argv[carg][2], sizeof (pat));
+                setpattern (&argv[carg][2]);
                 break;
               case 'v': /* -v for View File.  */
                 viewflag = TRUE;
@@ -352,6 +352,7 @@ edinit (char *bname)
   curwp = wp;
   wp->w_wndp = NULL; /* Initialize window.  */
   wp->w_bufp = bp;
+  wattach (wp);
   bp->b_nwnd = 1; /* Displayed.  */
   wp->w_linep = bp->b_linep;
   wp->w_dotp = bp->b_linep;
@@ -456,6 +457,7 @@ cexit (int status)
       window_p tmp;
 
       tmp = wp->w_wndp;
+      wdetach (wp);
       free (wp);
       wp = tmp;
     }
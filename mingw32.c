@@ -63,6 +63,7 @@ struct terminal term =
   vv, /* tteeop, */
   vv, /* ttbeep, */
   vi, /* ttrev, */
+  vi, /* ttattr, */
   is  /* ttcres */
 #if COLOR
   , iv /* ttfcol, */
@@ -220,6 +221,14 @@ typahead (void)
 #endif
 }
 
+/* Wait up to msec milliseconds for a key, return TRUE if one came.  */
+int
+ttwait (int msec)
+{
+  (void) msec;
+  return TRUE; /* Cannot wait, go read the key.  */
+}
+
 static void
 ttmove (int l, int c)
 {
@@ -14,6 +14,7 @@
 #include "bind.h"
 #include "bindable.h"
 #include "buffer.h"
+#include "diff.h"
 #include "display.h"
 #include "eval.h"
 #include "exec.h"
@@ -23,7 +24,10 @@
 #include "random.h"
 #include "region.h"
 #include "search.h"
+#include "sort.h"
 #include "spawn.h"
+#include "syntax.h"
+#include "undo.h"
 #include "window.h"
 #include "word.h"
 
@@ -56,6 +60,7 @@ struct name_bind names[] =
   { "count-words", wordcount },
 #endif
   { "ctlx-prefix", cex },
+  { "define-syntax", definesyntax },
   { "delete-blank-lines", deblank },
   { "delete-buffer", killbuffer },
   { "delete-mode", delmode },
@@ -70,12 +75,15 @@ struct name_bind names[] =
   { "describe-key", deskey },
 #if AEDIT
   { "detab-line", detab },
+  { "detab-region", detabregion },
 #endif
+  { "diff-buffers", diffbuffers },
   { "end-macro", ctlxrp },
   { "end-of-file", gotoeob },
   { "end-of-line", gotoeol },
 #if AEDIT
   { "entab-line", entab },
+  { "entab-region", entabregion },
 #endif
   { "exchange-point-and-mark", swapmark },
   { "execute-buffer", execbuf },
@@ -130,6 +138,7 @@ struct name_bind names[] =
   { "exit-emacs", quit },
 #if WORDPRO
   { "fill-paragraph", fillpara },
+  { "fill-region", fillregion },
 #endif
   { "filter-buffer", filter_buffer },
   { "find-file", filefind },
@@ -188,6 +197,7 @@ struct name_bind names[] =
   { "quick-exit", quickexit },
   { "quote-character", quote },
   { "read-file", fileread },
+  { "redo", redo },
   { "redraw-display", reposition },
   { "resize-window", resize },
   { "restore-window", restwnd },
@@ -208,8 +218,12 @@ struct name_bind names[] =
   { "set", setvar },
   { "set-fill-column", setfillcol },
   { "set-mark", setmark },
+  { "set-syntax", setsyntax },
   { "shell-command", spawn },
   { "shrink-window", shrinkwind },
+#if AEDIT
+  { "sort-region", sortregion },
+#endif
   { "split-current-window", splitwind },
   { "store-macro", storemac },
 #if PROC
@@ -218,11 +232,21 @@ struct name_bind names[] =
 #if BSD | SVR4
   { "suspend-emacs", bktoshell },
 #endif
+  { "syntax-block-comment", syntaxblockcomment },
+  { "syntax-keywords", syntaxkeywords },
+  { "syntax-line-comment", syntaxlinecomment },
+  { "syntax-numbers", syntaxnumbers },
+  { "syntax-strings", syntaxstrings },
   { "transpose-characters", twiddle },
 #if AEDIT
   { "trim-line", trim },
+  { "trim-region", trimregion },
 #endif
   { "unbind-key", unbindkey },
+  { "undo", undo },
+#if AEDIT
+  { "uniq-region", uniqregion },
+#endif
   { "universal-argument", unarg },
   { "unmark-buffer", unmark },
   { "update-screen", upscreen },
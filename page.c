@@ -0,0 +1,820 @@
+/* page.c -- implements page.h */
+#include "page.h"
+
+/*  page.c
+ *
+ *      The routines in this file let a file too big to be read in whole
+ *      be viewed a page at a time.  A file of PGMINSIZE bytes or more
+ *      that is read into a buffer in VIEW mode is paged: the buffer only
+ *      holds the lines of a few pages of PGLINES lines around its windows,
+ *      and reads the others again from the file when a move takes it
+ *      near them.  The pages are found through an index of the offset of
+ *      every PGLINES-th line of the file, built a slice at a time while
+ *      the keyboard is idle, or right away as far as a move needs it.
+ *
+ *      The lines of a paged buffer come and go under the commands, so
+ *      the windows on it keep their places by line number while its pages
+ *      change.  A command holding line pointers of its own across moves
+ *      that may page, as an incremental search does, pins the pages: they
+ *      may then grow, up to PGPINMAX of them, but are not let go.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "estruct.h"
+#include "input.h"
+#include "mlout.h"
+#include "search.h"
+#include "syntax.h"
+#include "termio.h"
+#include "window.h"
+
+#define PGLINES   1024        /* # of lines in a page.  */
+#define PGMINSIZE (16L << 20) /* Smallest file that is paged.  */
+#define PGMAXRES  8           /* Most pages kept around the windows.  */
+#define PGPINMAX  64          /* Most pages kept while pinned.  */
+#define PGBUFSIZ  65536       /* # of bytes indexed at a time.  */
+#define PGSLICE   16          /* # of those when a move waits.  */
+
+struct pager
+{
+  struct pager *p_next; /* Next paged buffer.  */
+  buffer_p p_bp;        /* The buffer.  */
+  int p_fd;             /* Its file.  */
+  off_t p_size;         /* Size of the file.  */
+  bool p_dos;           /* Lines end with CR LF.  */
+  off_t *p_index;       /* Offset of the first line of each page.  */
+  long p_nindex;        /* # of pages indexed.  */
+  long p_maxindex;      /* Room in p_index.  */
+  off_t p_indexed;      /* # of bytes indexed.  */
+  long p_nlines;        /* # of lines in them.  */
+  bool p_lastnl;        /* The last of them is a newline.  */
+  bool p_complete;      /* The whole file is indexed.  */
+  long p_first;         /* First page held.  */
+  long p_npages;        /* # of pages held.  */
+  long p_nres;          /* # of lines held.  */
+};
+
+/* A line pointer into a paged buffer, while its pages change.  */
+struct pgmark
+{
+  line_p *m_lpp; /* Where the pointer is kept.  */
+  int *m_offp;   /* And the offset in its line.  */
+  long m_lnum;   /* Number of its line, -1 if none.  */
+};
+
+int pgpinned = 0; /* Line pointers of paged buffers are held.  */
+
+static struct pager *pgheadp = NULL; /* Paged buffers.  */
+
+/*
+ * Index nbuf more buffers of the file of pg.  Return FALSE if out of
+ * memory.
+ */
+static bool
+pgscan (struct pager *pg, int nbuf)
+{
+  static char *buf = NULL;
+
+  if (buf == NULL && (buf = malloc (PGBUFSIZ)) == NULL)
+    return FALSE;
+
+  while (nbuf-- > 0 && !pg->p_complete)
+    {
+      off_t left = pg->p_size - pg->p_indexed;
+      ssize_t got = -1;
+
+      if (lseek (pg->p_fd, pg->p_indexed, SEEK_SET) != (off_t) -1)
+        do
+          got = read (pg->p_fd, buf, left < PGBUFSIZ ? left : PGBUFSIZ);
+        while (got < 0 && errno == EINTR);
+
+      if (got <= 0)
+        pg->p_size = pg->p_indexed; /* Shrunk under us.  */
+      else
+        {
+          long nlines = pg->p_nlines;
+          long nindex = pg->p_nindex;
+          char *p;
+
+          for (p = buf; (p = memchr (p, '\n', buf + got - p)) != NULL;)
+            {
+              off_t next = pg->p_indexed + (++p - buf);
+
+              if (++pg->p_nlines % PGLINES != 0 || next >= pg->p_size)
+                continue;
+
+              if (pg->p_nindex == pg->p_maxindex)
+                {
+                  off_t *index;
+
+                  index = realloc (pg->p_index,
+                                   2 * pg->p_maxindex * sizeof (off_t));
+                  if (index == NULL)
+                    {
+                      /* Take up the buffer again on the next call.  */
+                      pg->p_nlines = nlines;
+                      pg->p_nindex = nindex;
+                      return FALSE;
+                    }
+
+                  pg->p_index = index;
+                  pg->p_maxindex *= 2;
+                }
+
+              pg->p_index[pg->p_nindex++] = next;
+            }
+
+          pg->p_lastnl = buf[got - 1] == '\n';
+          pg->p_indexed += got;
+        }
+
+      if (pg->p_indexed >= pg->p_size)
+        {
+          pg->p_complete = TRUE;
+          if (pg->p_size > 0 && !pg->p_lastnl)
+            pg->p_nlines++; /* Last line without a newline.  */
+        }
+    }
+
+  return TRUE;
+}
+
+/*
+ * Index the file of pg until the end of page k is known.  Return FALSE
+ * if out of memory.
+ */
+static bool
+pgensure (struct pager *pg, long k)
+{
+  if (!pg->p_complete && k - pg->p_nindex > PGSLICE)
+    mloutstr ("(Indexing...)");
+
+  while (!pg->p_complete && pg->p_nindex <= k + 1)
+    if (!pgscan (pg, PGSLICE))
+      {
+        mloutstr ("(MEMORY EXHAUSTED)");
+        return FALSE;
+      }
+
+  return TRUE;
+}
+
+/*
+ * The last page of the file is held.
+ */
+static bool
+pgatend (struct pager *pg)
+{
+  return pg->p_complete && pg->p_first + pg->p_npages == pg->p_nindex;
+}
+
+/*
+ * Read page k of the file of pg into a chain of lines, *pfirst to
+ * *plast.  A page short of lines, but the last, is made up with empty
+ * ones.  Return the number of lines, or -1 if out of memory.
+ */
+static long
+pgread (struct pager *pg, long k, line_p *pfirst, line_p *plast)
+{
+  off_t start = pg->p_index[k];
+  off_t end = k + 1 < pg->p_nindex ? pg->p_index[k + 1] : pg->p_size;
+  size_t len = end > start ? end - start : 0;
+  size_t got = 0;
+  line_p first = NULL;
+  line_p last = NULL;
+  long n = 0;
+  long nbytes = 0;
+  char *text;
+  char *p;
+
+  if ((text = malloc (len + 1)) == NULL)
+    {
+      mloutstr ("(MEMORY EXHAUSTED)");
+      return -1;
+    }
+
+  if (lseek (pg->p_fd, start, SEEK_SET) != (off_t) -1)
+    while (got < len)
+      {
+        ssize_t s = read (pg->p_fd, text + got, len - got);
+
+        if (s < 0 && errno == EINTR)
+          continue;
+        if (s <= 0)
+          break;
+        got += s;
+      }
+
+  p = text;
+  while (n < PGLINES && (p < text + got || k + 1 < pg->p_nindex))
+    {
+      char *nl = p < text + got ? memchr (p, '\n', text + got - p) : NULL;
+      char *eol = nl != NULL ? nl : text + got;
+      line_p lp;
+
+      if (pg->p_dos && eol > p && eol[-1] == '\r')
+        eol--;
+
+      if ((lp = lalloc (eol - p)) == NULL)
+        {
+          while ((lp = first) != NULL)
+            {
+              first = lforw (lp);
+              free (lp);
+            }
+
+          free (text);
+          return -1;
+        }
+
+      memcpy (lp->l_text, p, eol - p);
+      lp->l_fp = NULL;
+      lp->l_bp = last;
+      if (last == NULL)
+        first = lp;
+      else
+        last->l_fp = lp;
+
+      last = lp;
+      n++;
+      nbytes += llength (lp) + 1;
+      p = nl != NULL ? nl + 1 : text + got;
+    }
+
+  free (text);
+  bcount (pg->p_bp, nbytes, n); /* Held once linked in.  */
+  *pfirst = first;
+  *plast = last;
+  return n;
+}
+
+/*
+ * Let go of n lines of paged buffer bp, from lp on.
+ */
+static void
+pgdrop (buffer_p bp, line_p lp, long n)
+{
+  while (n-- > 0)
+    {
+      line_p next = lforw (lp);
+
+      bcount (bp, -(llength (lp) + 1), -1);
+      lp->l_bp->l_fp = next;
+      next->l_bp = lp->l_bp;
+      lexforget (lp);
+      free (lp);
+      lp = next;
+    }
+}
+
+/*
+ * The line numbered lnum of the buffer of pg, or the nearest line held,
+ * in which case *pexact is cleared.
+ */
+static line_p
+pgat (struct pager *pg, long lnum, bool *pexact)
+{
+  line_p hp = pg->p_bp->b_linep;
+  long start = pg->p_first * PGLINES;
+  line_p lp;
+
+  *pexact = TRUE;
+  if (pg->p_nres == 0)
+    return hp;
+
+  if (lnum < start)
+    {
+      *pexact = FALSE;
+      return lforw (hp);
+    }
+
+  if (lnum >= start + pg->p_nres)
+    {
+      if (pgatend (pg))
+        return hp;
+
+      *pexact = FALSE;
+      return lback (hp);
+    }
+
+  /* Walk from the nearer end.  */
+  lnum -= start;
+  if (lnum < pg->p_nres / 2)
+    for (lp = lforw (hp); lnum-- > 0; lp = lforw (lp))
+      ;
+  else
+    for (lp = hp; lnum++ < pg->p_nres; lp = lback (lp))
+      ;
+
+  return lp;
+}
+
+static void
+pgmark (struct pgmark *mp, buffer_p bp, line_p *lpp, int *offp)
+{
+  mp->m_lpp = lpp;
+  mp->m_offp = offp;
+  mp->m_lnum = *lpp != NULL ? pglnum (bp, *lpp) : -1;
+}
+
+/*
+ * Take the line pointers into buffer bp, and the number of their lines.
+ */
+static struct pgmark *
+pgmarks (buffer_p bp, int *pn)
+{
+  struct pgmark *marks;
+  struct bpos *pp;
+  int n = 0;
+
+  for (pp = bp->b_pos; pp != NULL; pp = pp->p_next)
+    n++;
+
+  if ((marks = malloc (n * sizeof (struct pgmark))) == NULL)
+    {
+      mloutstr ("(MEMORY EXHAUSTED)");
+      return NULL;
+    }
+
+  n = 0;
+  for (pp = bp->b_pos; pp != NULL; pp = pp->p_next)
+    /* The buffer's own are stale while a window shows it.  */
+    if (bp->b_nwnd == 0 || (pp != &bp->b_bpos[0] && pp != &bp->b_bpos[1]))
+      pgmark (&marks[n++], bp, pp->p_lpp, pp->p_offp);
+
+  *pn = n;
+  return marks;
+}
+
+/*
+ * Hold pages lo to hi of the buffer of pg, as many of them as there are,
+ * and no others.  Return FALSE if they could not all be read.
+ */
+static bool
+pgrange (struct pager *pg, long lo, long hi)
+{
+  buffer_p bp = pg->p_bp;
+  line_p hp = bp->b_linep;
+  struct pgmark *marks;
+  window_p wp;
+  bool ok = TRUE;
+  long last;
+  int nmarks;
+  int i;
+
+  if (!pgensure (pg, hi))
+    return FALSE;
+
+  /* Past the end, keep as many pages, ending with the last one.  */
+  if (hi >= pg->p_nindex)
+    {
+      lo -= hi - (pg->p_nindex - 1);
+      hi = pg->p_nindex - 1;
+    }
+
+  if (lo < 0)
+    lo = 0;
+
+  last = pg->p_first + pg->p_npages - 1;
+  if (pg->p_npages > 0 && lo == pg->p_first && hi == last)
+    return TRUE;
+
+  if ((marks = pgmarks (bp, &nmarks)) == NULL)
+    return FALSE;
+
+  /* Let go of the pages out of the range.  */
+  if (pg->p_npages > 0 && (hi < pg->p_first || lo > last))
+    {
+      pgdrop (bp, lforw (hp), pg->p_nres);
+      pg->p_npages = pg->p_nres = 0;
+    }
+
+  if (pg->p_npages == 0)
+    {
+      pg->p_first = lo;
+      last = lo - 1;
+    }
+  else
+    {
+      if (lo > pg->p_first)
+        {
+          pgdrop (bp, lforw (hp), (lo - pg->p_first) * PGLINES);
+          pg->p_nres -= (lo - pg->p_first) * PGLINES;
+          pg->p_first = lo;
+        }
+
+      if (hi < last)
+        {
+          long n = pg->p_nres - (hi - pg->p_first + 1) * PGLINES;
+          line_p lp = hp;
+          long j;
+
+          for (j = 0; j < n; j++)
+            lp = lback (lp);
+
+          pgdrop (bp, lp, n);
+          pg->p_nres -= n;
+          last = hi;
+        }
+    }
+
+  /* Read those missing.  */
+  while (ok && pg->p_first > lo)
+    {
+      line_p first, lp;
+      long n = pgread (pg, pg->p_first - 1, &first, &lp);
+
+      if (!(ok = n >= 0))
+        break;
+
+      first->l_bp = hp;
+      lp->l_fp = lforw (hp);
+      lforw (hp)->l_bp = lp;
+      hp->l_fp = first;
+      pg->p_first--;
+      pg->p_nres += n;
+    }
+
+  while (ok && last < hi)
+    {
+      line_p first, lp;
+      long n = pgread (pg, last + 1, &first, &lp);
+
+      if (!(ok = n >= 0))
+        break;
+
+      first->l_bp = lback (hp);
+      lp->l_fp = hp;
+      lback (hp)->l_fp = first;
+      hp->l_bp = lp;
+      last++;
+      pg->p_nres += n;
+    }
+
+  pg->p_npages = last - pg->p_first + 1;
+
+  /* Put the line pointers back where they were, or as near.  */
+  for (i = 0; i < nmarks; i++)
+    if (marks[i].m_lnum >= 0)
+      {
+        bool exact;
+
+        *marks[i].m_lpp = pgat (pg, marks[i].m_lnum, &exact);
+        if (marks[i].m_offp != NULL
+            && (!exact || *marks[i].m_offp > llength (*marks[i].m_lpp)))
+          *marks[i].m_offp = 0;
+      }
+
+  free (marks);
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp)
+      wp->w_flag |= WFHARD | WFMODE;
+
+  return ok;
+}
+
+/*
+ * Page the file of buffer bp, if it is one big enough.  Return FALSE for
+ * it to be read in as usual.
+ */
+bool
+pgopen (buffer_p bp)
+{
+  struct pager *pg;
+  struct stat st;
+  char *buf;
+  ssize_t got;
+  int fd;
+
+  if ((fd = open (bp->b_fname, O_RDONLY)) < 0)
+    return FALSE;
+
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode)
+      || st.st_size < PGMINSIZE
+      || (pg = malloc (sizeof (struct pager))) == NULL)
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  if ((pg->p_index = malloc (64 * sizeof (off_t))) == NULL)
+    {
+      free (pg);
+      close (fd);
+      return FALSE;
+    }
+
+  pg->p_bp = bp;
+  pg->p_fd = fd;
+  pg->p_size = st.st_size;
+  pg->p_dos = FALSE;
+  pg->p_index[0] = 0;
+  pg->p_nindex = 1;
+  pg->p_maxindex = 64;
+  pg->p_indexed = 0;
+  pg->p_nlines = 0;
+  pg->p_lastnl = FALSE;
+  pg->p_complete = FALSE;
+  pg->p_first = 0;
+  pg->p_npages = 0;
+  pg->p_nres = 0;
+  pg->p_next = pgheadp;
+  pgheadp = pg;
+  bp->b_pgr = pg;
+
+  /* Tell the end of line and the encoding from the first lines.  */
+  if ((buf = malloc (PGBUFSIZ)) != NULL)
+    {
+      if ((got = read (fd, buf, PGBUFSIZ)) > 0)
+        {
+          char *text = buf;
+          char *end;
+          int code = FALSE;
+          int pos;
+
+          if ((end = memchr (text, '\n', got)) != NULL && end > text
+              && end[-1] == '\r')
+            {
+              pg->p_dos = TRUE;
+              bp->b_mode |= MDDOS;
+            }
+
+          /* Up to the last whole line.  */
+          while (got > 0 && text[got - 1] != '\n')
+            got--;
+
+          for (pos = utf8_ascii_span (text, got); pos < got && code >= 0;
+               pos += utf8_ascii_span (&text[pos], got - pos))
+            {
+              unicode_t uc;
+              int bytes = utf8_to_unicode (text, pos, got, &uc);
+
+              pos += bytes;
+              code = bytes > 1 ? TRUE : -1;
+            }
+
+          if (code == TRUE)
+            bp->b_mode |= MDUTF8;
+        }
+
+      free (buf);
+    }
+
+  if (!pgrange (pg, 0, 1))
+    {
+      pgclose (bp);
+      while (lforw (bp->b_linep) != bp->b_linep)
+        lfree (bp, lforw (bp->b_linep));
+      return FALSE;
+    }
+
+  mloutfmt ("(Paging %D bytes, %d lines at a time)", (long) pg->p_size,
+            PGLINES);
+  return TRUE;
+}
+
+/*
+ * Stop paging buffer bp.  The lines held stay in it.
+ */
+void
+pgclose (buffer_p bp)
+{
+  struct pager *pg = bp->b_pgr;
+  struct pager **pp;
+
+  if (pg == NULL)
+    return;
+
+  for (pp = &pgheadp; *pp != pg; pp = &(*pp)->p_next)
+    ;
+  *pp = pg->p_next;
+
+  close (pg->p_fd);
+  free (pg->p_index);
+  free (pg);
+  bp->b_pgr = NULL;
+}
+
+/*
+ * Number of line lp of paged buffer bp in its file, from 0.  The end of
+ * the buffer counts as the line after the last held.
+ */
+long
+pglnum (buffer_p bp, line_p lp)
+{
+  long lnum = bp->b_pgr->p_first * PGLINES;
+  line_p clp;
+
+  for (clp = lforw (bp->b_linep); clp != lp && clp != bp->b_linep;
+       clp = lforw (clp))
+    lnum++;
+
+  return lnum;
+}
+
+/*
+ * Line lnum of paged buffer bp, held with the pages around it, or the
+ * end of the buffer if the file is shorter.
+ */
+line_p
+pgline (buffer_p bp, long lnum)
+{
+  struct pager *pg = bp->b_pgr;
+  long start = pg->p_first * PGLINES;
+  bool exact;
+
+  if (lnum < start || lnum > start + pg->p_nres
+      || (lnum == start + pg->p_nres && !pgatend (pg)))
+    {
+      long k;
+
+      if (pgensure (pg, lnum / PGLINES) && pg->p_complete
+          && lnum > pg->p_nlines)
+        lnum = pg->p_nlines;
+
+      k = lnum / PGLINES;
+      pgrange (pg, k - 1, k + 1);
+    }
+
+  return pgat (pg, lnum, &exact);
+}
+
+/*
+ * Move *plp of paged buffer bp n lines down, or up if n is negative,
+ * reading its pages as needed.  Return the part of the move that goes
+ * beyond the file.
+ */
+int
+pgmove (buffer_p bp, line_p *plp, int n)
+{
+  struct pager *pg = bp->b_pgr;
+  long to = pglnum (bp, *plp) + n;
+  long left = 0;
+
+  if (to < 0)
+    {
+      left = to;
+      to = 0;
+    }
+  else if (n > 0 && pgensure (pg, to / PGLINES) && pg->p_complete
+           && to > pg->p_nlines)
+    {
+      left = to - pg->p_nlines;
+      to = pg->p_nlines;
+    }
+
+  *plp = pgline (bp, to);
+  return left;
+}
+
+/*
+ * A scan of paged buffer bp in direction dir is at line lp.  If that is
+ * the last line held that way, read the next page of the file, letting
+ * go of those behind unless pinned.
+ */
+void
+pgedge (buffer_p bp, line_p lp, int dir)
+{
+  struct pager *pg = bp->b_pgr;
+  long last = pg->p_first + pg->p_npages - 1;
+
+  if (dir == FORWARD)
+    {
+      if (lforw (lp) != bp->b_linep || lp == bp->b_linep || pgatend (pg))
+        return;
+
+      if (pgpinned == 0)
+        pgrange (pg, last, last + 1);
+      else if (pg->p_npages < PGPINMAX)
+        pgrange (pg, pg->p_first, last + 1);
+    }
+  else
+    {
+      if (lback (lp) != bp->b_linep || pg->p_first == 0)
+        return;
+
+      if (pgpinned == 0)
+        pgrange (pg, pg->p_first - 1, pg->p_first);
+      else if (pg->p_npages < PGPINMAX)
+        pgrange (pg, pg->p_first - 1, last);
+    }
+}
+
+/*
+ * The lines held of buffer bp reach the end of its file in direction
+ * dir, as they always do when it is not paged.
+ */
+bool
+pgends (buffer_p bp, int dir)
+{
+  if (bp->b_pgr == NULL)
+    return TRUE;
+
+  return dir == FORWARD ? pgatend (bp->b_pgr) : bp->b_pgr->p_first == 0;
+}
+
+/*
+ * Percentage of paged buffer bp before line lp, by lines once the whole
+ * file is indexed, by bytes until then.
+ */
+int
+pgratio (buffer_p bp, line_p lp)
+{
+  struct pager *pg = bp->b_pgr;
+  long lnum = pglnum (bp, lp);
+
+  if (pg->p_complete)
+    return pg->p_nlines != 0 ? (int) (100.0 * lnum / pg->p_nlines) : 0;
+
+  return (int) (100.0 * pg->p_index[lnum / PGLINES] / pg->p_size);
+}
+
+/*
+ * Number of lines of paged buffer bp, as far as its file is indexed.
+ */
+long
+pgcount (buffer_p bp)
+{
+  return bp->b_pgr->p_nlines;
+}
+
+/*
+ * Size of the file of paged buffer bp.
+ */
+long
+pgsize (buffer_p bp)
+{
+  return bp->b_pgr->p_size;
+}
+
+/*
+ * Hold the pages of each paged buffer around its windows: those around
+ * "." in the current window, or the first one on the buffer, and those
+ * of its other windows when they are near enough.
+ */
+void
+pgsync (void)
+{
+  struct pager *pg;
+
+  for (pg = pgheadp; pg != NULL; pg = pg->p_next)
+    {
+      buffer_p bp = pg->p_bp;
+      line_p dotp = bp->b_dotp;
+      window_p wp;
+      long lo;
+      long hi;
+
+      if (curwp->w_bufp == bp)
+        dotp = curwp->w_dotp;
+      else
+        for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+          if (wp->w_bufp == bp)
+            {
+              dotp = wp->w_dotp;
+              break;
+            }
+
+      lo = pglnum (bp, dotp) / PGLINES - 1;
+      hi = lo + 2;
+      for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+        if (wp->w_bufp == bp)
+          {
+            long top = pglnum (bp, wp->w_linep) / PGLINES;
+            long bot = pglnum (bp, wp->w_dotp) / PGLINES;
+            long nlo = top < lo ? top : lo;
+            long nhi = bot > hi ? bot : hi;
+
+            if (nhi - nlo < PGMAXRES)
+              {
+                lo = nlo;
+                hi = nhi;
+              }
+          }
+
+      pgrange (pg, lo, hi);
+    }
+}
+
+/*
+ * Index the files of the paged buffers while no key is waiting.
+ */
+void
+pgidle (void)
+{
+  struct pager *pg;
+
+  for (pg = pgheadp; pg != NULL; pg = pg->p_next)
+    while (!pg->p_complete && kbdmode != PLAY && !typahead ())
+      if (!pgscan (pg, 1))
+        return;
+}
+
+/* end of page.c */
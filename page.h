@@ -0,0 +1,22 @@
+#ifndef _PAGE_H_
+#define _PAGE_H_
+
+#include "buffer.h"
+#include "line.h"
+
+extern int pgpinned; /* Line pointers of paged buffers are held.  */
+
+bool pgopen (buffer_p bp);
+void pgclose (buffer_p bp);
+long pglnum (buffer_p bp, line_p lp);
+line_p pgline (buffer_p bp, long lnum);
+int pgmove (buffer_p bp, line_p *plp, int n);
+void pgedge (buffer_p bp, line_p lp, int dir);
+bool pgends (buffer_p bp, int dir);
+int pgratio (buffer_p bp, line_p lp);
+long pgcount (buffer_p bp);
+long pgsize (buffer_p bp);
+void pgsync (void);
+void pgidle (void);
+
+#endif
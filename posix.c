@@ -26,6 +26,9 @@
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
 
 #if defined(_FREEBSD_C_SOURCE)
 # define COMPAT_43TTY 1
@@ -158,13 +161,15 @@ ttflush (void)
     exit (15);
 }
 
+/* Bytes read from the terminal and not taken yet.  */
+static char buf[32];
+static int pending;
+
 /* Read a character from the terminal, performing no editing and doing no echo at all.
    Very simple on CPM, because the system can do exactly what you want.  */
 int
 ttgetc (void)
 {
-  static char buf[32];
-  static int pending;
   unicode_t c;
   int count, bytes = 1, expected;
 
@@ -246,12 +251,29 @@ typahead (void)
   int x; /* Holds # of pending chars.  */
   if (ioctl (0, FIONREAD, &x) < 0)
     x = 0;
-  return x;
+  return pending + x;
 #else
-  return 0;
+  return pending;
 #endif
 }
 
+/* Wait up to msec milliseconds for a key, return TRUE if one came.  */
+int
+ttwait (int msec)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+  if (pending)
+    return TRUE;
+
+  FD_ZERO (&rfds);
+  FD_SET (STDIN_FILENO, &rfds);
+  tv.tv_sec = msec / 1000;
+  tv.tv_usec = msec % 1000 * 1000L;
+  return select (STDIN_FILENO + 1, &rfds, NULL, NULL, &tv) != 0;
+}
+
 #else
 typedef int dummy;
 #endif /* not POSIX */
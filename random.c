@@ -9,6 +9,7 @@
  *  Modified by Petri Kutvonen
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,10 +20,17 @@
 #include "display.h"
 #include "estruct.h"
 #include "execute.h"
+#include "fence.h"
 #include "input.h"
+#include "journal.h"
 #include "line.h"
+#include "mlout.h"
+#include "page.h"
+#include "region.h"
 #include "search.h"
+#include "syntax.h"
 #include "terminal.h"
+#include "undo.h"
 #include "window.h"
 
 /* Names of colors.  */
@@ -92,11 +100,13 @@ setfillcol (bool f, int n)
 int
 showcpos (bool f, int n)
 {
-  line_p lp;         /* current line */
-  int numchars;      /* # of chars in file */
-  int numlines;      /* # of lines in file */
-  int predchars;     /* # chars preceding point */
-  int predlines;     /* # lines preceding point */
+  line_p flp, blp;   /* lines on from and back from "." */
+  long numchars;     /* # of chars in file */
+  long numlines;     /* # of lines in file */
+  long predchars;    /* # chars preceding point */
+  long predlines;    /* # lines preceding point */
+  long nfchars, nflines; /* # from the line of "." on */
+  int eol;           /* # of chars of a newline */
   unicode_t curchar; /* character under cursor */
   unsigned int bytes;    /* length of unicode sequence */
   int ratio;
@@ -104,35 +114,48 @@ showcpos (bool f, int n)
   int savepos; /* temp save for current offset */
   int ecol;    /* column pos/end of current line */
 
-  /* start counting chars and lines */
-  numchars = 0;
-  numlines = 0;
+  /* The totals are kept; count from "." to the nearer end for the rest.  */
+  eol = (curbp->b_mode & MDDOS) ? 2 : 1;
+  numchars = curbp->b_nbytes + (eol - 1) * curbp->b_nlines;
+  numlines = curbp->b_nlines;
   predchars = 0;
   predlines = 0;
+  nfchars = 0;
+  nflines = 0;
   bytes = lgetchar (&curchar);
-  for (lp = lforw (curbp->b_linep); lp != curbp->b_linep; lp = lforw (lp))
+  flp = curwp->w_dotp;
+  blp = lback (curwp->w_dotp);
+  while (flp != curbp->b_linep && blp != curbp->b_linep)
     {
-      /* if we are on the current line, record it */
-      if (lp == curwp->w_dotp)
-        {
-          predlines = numlines;
-          predchars = numchars + curwp->w_doto;
-        }
-      /* on to the next line */
-      numlines++;
-      numchars += llength (lp) + ((curbp->b_mode & MDDOS) ? 2 : 1);
+      nflines++;
+      nfchars += llength (flp) + eol;
+      flp = lforw (flp);
+      predlines++;
+      predchars += llength (blp) + eol;
+      blp = lback (blp);
+    }
+  if (flp == curbp->b_linep)
+    {
+      predlines = numlines - nflines;
+      predchars = numchars - nfchars;
     }
+  predchars += curwp->w_doto;
 
   /* if at end of file, record it */
   if (curwp->w_dotp == curbp->b_linep)
     {
-      predlines = numlines;
-      predchars = numchars;
 #if PKCODE
       curchar = 0;
 #endif
     }
 
+  /* Lines of a paged buffer count in its whole file.  */
+  if (curbp->b_pgr != NULL)
+    {
+      predlines += pglnum (curbp, lforw (curbp->b_linep));
+      numlines = pgcount (curbp);
+    }
+
   /* Get real column and end-of-line column. */
   col = getccol (FALSE);
   savepos = curwp->w_doto;
@@ -145,7 +168,7 @@ showcpos (bool f, int n)
     ratio = (100L * predchars) / numchars;
 
   /* summarize and report the info */
-  mlwrite ("Line %d/%d Col %d/%d Char %D/%D (%d%%) char = %s%x", predlines + 1,
+  mlwrite ("Line %D/%D Col %d/%d Char %D/%D (%d%%) char = %s%x", predlines + 1,
            numlines + 1, col, ecol, predchars, numchars, ratio,
            (bytes > 1) ? "\\u" : "0x", curchar);
   return TRUE;
@@ -158,6 +181,9 @@ getcline (void)
   line_p lp; /* Current line.  */
   int numlines; /* # of lines before point.  */
 
+  if (curbp->b_pgr != NULL)
+    return pglnum (curbp, curwp->w_dotp) + 1;
+
   /* Starting at the beginning of the buffer.  */
   lp = lforw (curbp->b_linep);
 
@@ -186,6 +212,8 @@ getccol (int bflg)
   int len = llength (dlp);
 
   col = i = 0;
+  if (!bflg)
+    i = lcolstart (dlp, byte_offset, INT_MAX, &col);
   while (i < byte_offset)
     {
       unicode_t c;
@@ -193,14 +221,7 @@ getccol (int bflg)
       i += utf8_to_unicode (dlp->l_text, i, len, &c);
       if (bflg && c != ' ' && c != '\t') /* Request Stop at first non-blank.  */
         break;
-      if (c == '\t')
-        col += tabwidth - col % tabwidth;
-      else if (c < 0x20 || c == 0x7F) /* Displayed as ^C.  */
-        col += 2;
-      else if (c >= 0x80 && c <= 0xa0) /* Displayed as \xx.  */
-        col += 3;
-      else
-        col++;
+      col = lcolnext (c, col);
     }
   return col;
 }
@@ -218,25 +239,18 @@ setccol (int pos)
   int llen; /* length of line in bytes */
   char *text;
 
-  col = 0;
   llen = llength (curwp->w_dotp);
   text = curwp->w_dotp->l_text;
 
   /* scan the line until we are at or past the target column */
-  for (i = 0; i < llen && col < pos;)
+  i = lcolstart (curwp->w_dotp, INT_MAX, pos, &col);
+  while (i < llen && col < pos)
     {
       unicode_t c; /* character being scanned */
 
       /* advance one character */
       i += utf8_to_unicode (text, i, llen, &c);
-      if (c == '\t')
-        col += tabwidth - col % tabwidth;
-      else if (c < 0x20 || c == 0x7F) /* displayed as ^C */
-        col += 2;
-      else if (c >= 0x80 && c <= 0xa0) /* displayed as \xx */
-        col += 3;
-      else
-        col++;
+      col = lcolnext (c, col);
     }
 
   /* set us at the new position */
@@ -346,67 +360,185 @@ insert_tab (bool f, int n)
 }
 
 #if AEDIT
+/* How retab() rewrites a line.  */
+#define RTDETAB 0 /* Tabs to spaces.  */
+#define RTENTAB 1 /* Runs of blanks to tabs where they reach a tab stop.  */
+#define RTTRIM  2 /* Blanks at the end dropped.  */
+
 /*
- * change tabs to spaces
- *
- * int f, n;    default flag and numeric repeat count
+ * Put in out, if not NULL, the blanks from column col to col2, with
+ * tabs where they can go if tabs.  Return their number.
  */
-int
-detab (bool f, int n)
+static int
+blanks (char *out, int col, int col2, bool tabs)
 {
-  int inc; /* Increment to next line [sgn(n)].  */
+  int n = 0;
+
+  if (tabs)
+    for (;;)
+      {
+        int stop = col + tabwidth - col % tabwidth;
+
+        if (stop > col2)
+          break;
+        if (out != NULL)
+          out[n] = (stop - col == 1) ? ' ' : '\t';
+        n++;
+        col = stop;
+      }
+
+  if (out != NULL)
+    memset (&out[n], ' ', col2 - col);
+  return n + col2 - col;
+}
 
-  if (curbp->b_mode & MDVIEW)
-    /* Do not allow this command if we are in read only mode.  */
-    return rdonly ();
+/*
+ * Rewrite the len bytes of text as how says into out, if not NULL, and
+ * return the length of the result.  Blanks go a run at a time, and the
+ * other printable ASCII a span at a time.
+ */
+static int
+tabtext (const char *text, int len, int how, char *out)
+{
+  int i = 0;
+  int n = 0;
+  int col = 0;
+  int blank = -1; /* Offset of the next space, len if none.  */
 
-  if (f == FALSE)
-    n = 1;
+  if (how == RTTRIM)
+    {
+      while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\t'))
+        len--;
+      if (out != NULL)
+        memcpy (out, text, len);
+      return len;
+    }
 
-  /* Loop thru detabbing N lines.  */
-  inc = ((n > 0) ? 1 : -1);
-  while (n)
+  while (i < len)
     {
-      curwp->w_doto = 0; /* Start at the beginning.  */
+      int run;
 
-      /* Detab the entire current line.  */
-      while (curwp->w_doto < llength (curwp->w_dotp))
+      if (text[i] == ' ' || text[i] == '\t')
         {
-          /* If we have a tab.  */
-          if (curwbyte () == '\t')
-            {
-              int size;
+          int col2 = col;
+
+          for (; i < len && (text[i] == ' ' || text[i] == '\t'); i++)
+            col2 = (text[i] == '\t') ? col2 + tabwidth - col2 % tabwidth
+                                     : col2 + 1;
+          n += blanks (out != NULL ? &out[n] : NULL, col, col2,
+                       how == RTENTAB);
+          col = col2;
+          continue;
+        }
 
-              ldelchar (1, FALSE);
-              size = tabwidth - curwp->w_doto % tabwidth;
-              insspace (TRUE, size);
-              forwchar (TRUE, size);
-            }
-          else
-            forwchar (FALSE, 1);
+      if (blank < i)
+        {
+          const char *sp = memchr (&text[i], ' ', len - i);
+
+          blank = (sp != NULL) ? sp - text : len;
         }
+      if ((run = utf8_print_span (&text[i], blank - i)) > 0)
+        col += run;
+      else
+        {
+          unicode_t c;
 
-      /* Advance/or back to the next line.  */
-      if (forwline (TRUE, inc) == FALSE)
+          run = utf8_to_unicode (text, i, len, &c);
+          col = lcolnext (c, col);
+        }
+
+      if (out != NULL)
+        memcpy (&out[n], &text[i], run);
+      n += run;
+      i += run;
+    }
+
+  return n;
+}
+
+/* Return the column of byte offs of the len bytes of text.  */
+static int
+textcol (const char *text, int len, int offs)
+{
+  int i = 0;
+  int col = 0;
+
+  while (i < offs)
+    {
+      unicode_t c;
+
+      i += utf8_to_unicode (text, i, len, &c);
+      col = lcolnext (c, col);
+    }
+  return col;
+}
+
+/*
+ * Return the offset of the character of the len bytes of text shown at
+ * column col, or len if none is.
+ */
+static int
+textoffs (const char *text, int len, int col)
+{
+  int i = 0;
+  int c0 = 0;
+
+  while (i < len)
+    {
+      unicode_t c;
+      int k = utf8_to_unicode (text, i, len, &c);
+      int c2 = lcolnext (c, c0);
+
+      if (c2 > col)
         break;
+      i += k;
+      c0 = c2;
+    }
+  return i;
+}
 
-      n -= inc;
+/*
+ * Rewrite line lp of the current buffer as how says, in one replacement
+ * by a text of the size worked out first.  The places on it stay at the
+ * same columns.  Return FALSE if out of memory.
+ */
+static int
+retab (line_p lp, int how)
+{
+  struct bpos *pp;
+  char *text;
+  int len;
+  int status;
+
+  len = tabtext (lp->l_text, llength (lp), how, NULL);
+  if ((text = malloc (len + 1)) == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return FALSE;
     }
-  curwp->w_doto = 0; /* To the begining of the line.  */
-  thisflag &= ~CFCPCN; /* Flag that this resets the goal column.  */
-  lchange (WFEDIT); /* Yes, we have made at least an edit.  */
-  return (n == 0) ? TRUE : FALSE;
+  tabtext (lp->l_text, llength (lp), how, text);
+  if (len == llength (lp) && memcmp (text, lp->l_text, len) == 0)
+    {
+      free (text); /* Nothing to change.  */
+      return TRUE;
+    }
+
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+    if (*pp->p_lpp == lp && pp->p_offp != NULL)
+      *pp->p_offp = textoffs (text, len, textcol (lp->l_text, llength (lp),
+                                                   *pp->p_offp));
+  status = lreplace (lp, text, len);
+  free (text);
+  return status;
 }
 
 /*
- * change spaces to tabs where posible
- *
- * int f, n;    default flag and numeric repeat count
+ * Rewrite n lines from that of dot on, or back if n < 0, as how says.
+ * Leave dot at the start of the last line.
  */
-int
-entab (bool f, int n)
+static int
+retablines (bool f, int n, int how)
 {
-#define nextab(a) (a + tabwidth - a % tabwidth)
   int inc; /* Increment to next line [sgn(n)].  */
 
   if (curbp->b_mode & MDVIEW)
@@ -416,54 +548,11 @@ entab (bool f, int n)
   if (f == FALSE)
     n = 1;
 
-  /* Loop thru entabbing N lines.  */
   inc = ((n > 0) ? 1 : -1);
   while (n)
     {
-      int fspace; /* Pointer to first space if in a run.  */
-      int ccol; /* Current cursor column.  */
-
-      curwp->w_doto = 0; /* Start at the beginning.  */
-
-      /* Entab the entire current line.  */
-      fspace = -1;
-      ccol = 0;
-      while (curwp->w_doto < llength (curwp->w_dotp))
-        {
-          /* See if it is time to compress.  */
-          if ((fspace >= 0) && (nextab (fspace) <= ccol))
-            {
-              if (ccol - fspace < 2)
-                fspace = -1;
-              else
-                {
-                  /* There is a bug here dealing with mixed space/tabed
-                     lines, so it will get fixed.  */
-                  backchar (TRUE, ccol - fspace);
-                  ldelete (ccol - fspace, FALSE);
-                  linsert (1, '\t');
-                  fspace = -1;
-                }
-            }
-
-          /* Get the current character.  */
-          switch (curwbyte ())
-            {
-            case '\t': /* A tab. Count them up.  */
-              ccol = nextab (ccol);
-              break;
-            case ' ': /* A space. Compress? */
-              if (fspace == -1)
-                fspace = ccol;
-              ccol++;
-              break;
-            default: /* Any other char. Just count.  */
-              ccol++;
-              fspace = -1;
-            }
-
-          forwchar (FALSE, 1);
-        }
+      if (curwp->w_dotp != curbp->b_linep && !retab (curwp->w_dotp, how))
+        return FALSE;
 
       /* Advance/or back to the next line.  */
       if (forwline (TRUE, inc) == FALSE)
@@ -473,10 +562,101 @@ entab (bool f, int n)
     }
   curwp->w_doto = 0; /* To the begining of the line.  */
   thisflag &= ~CFCPCN; /* Flag that this resets the goal column.  */
-  lchange (WFEDIT); /* Yes, we have made at least an edit.  */
   return (n == 0) ? TRUE : FALSE;
 }
 
+/*
+ * Rewrite the lines of the region as how says, each line once and all of
+ * them undone as one.
+ */
+static int
+retabregion (int how)
+{
+  struct region region;
+  line_p lp;
+  long size; /* # of bytes of the region left from the start of lp */
+  int status;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+  if ((status = getregion (&region)) != TRUE)
+    return status;
+
+  lp = region.r_linep;
+  size = region.r_offset + region.r_size;
+  undbulk (lp);
+  for (;;)
+    {
+      line_p next = lforw (lp);
+
+      size -= llength (lp) + 1;
+      if (!retab (lp, how))
+        return FALSE;
+      if (size <= 0 || next == curbp->b_linep)
+        break;
+      lp = next;
+    }
+  thisflag &= ~CFCPCN; /* Flag that this resets the goal column.  */
+  return TRUE;
+}
+
+/*
+ * change tabs to spaces
+ *
+ * int f, n;    default flag and numeric repeat count
+ */
+int
+detab (bool f, int n)
+{
+  return retablines (f, n, RTDETAB);
+}
+
+/*
+ * change spaces to tabs where posible
+ *
+ * int f, n;    default flag and numeric repeat count
+ */
+int
+entab (bool f, int n)
+{
+  return retablines (f, n, RTENTAB);
+}
+
+/*
+ * change the tabs of the lines of the region to spaces
+ *
+ * int f, n;    ignored numeric arguments
+ */
+int
+detabregion (bool f, int n)
+{
+  return retabregion (RTDETAB);
+}
+
+/*
+ * change the spaces of the lines of the region to tabs
+ * where posible
+ *
+ * int f, n;    ignored numeric arguments
+ */
+int
+entabregion (bool f, int n)
+{
+  return retabregion (RTENTAB);
+}
+
+/*
+ * trim the trailing whitespace of the lines of the region
+ *
+ * int f, n;    ignored numeric arguments
+ */
+int
+trimregion (bool f, int n)
+{
+  return retabregion (RTTRIM);
+}
+
 /*
  * trim trailing whitespace from the point to eol
  *
@@ -512,7 +692,13 @@ trim (bool f, int n)
             break;
         }
 
+      undline (lp);
+      lcolforget (lp, length);
+      lexcut (lp, length);
+      bcount (curbp, length - lp->l_used, 0);
       lp->l_used = length;
+      lexdirty (lp);
+      jrnreplace (lp);
 
       /* advance/or back to the next line */
       if (forwline (TRUE, inc) == FALSE)
@@ -969,6 +1155,14 @@ adjustmode (int kind, int global)
     {
       if (strcasecmp (cbuf, modename[i]) == 0)
         {
+          if (kind == FALSE && global == 0 && (1 << i) == MDVIEW
+              && curbp->b_pgr != NULL)
+            {
+              free (cbuf);
+              mlwrite ("%%A paged buffer stays in VIEW mode");
+              return FALSE;
+            }
+
           /* finding a match, we process it */
           if (kind == TRUE)
             if (global)
@@ -981,7 +1175,10 @@ adjustmode (int kind, int global)
             curbp->b_mode &= ~(1 << i);
           /* display new mode line */
           if (global == 0)
-            upmode ();
+            {
+              upmode ();
+              hlrefresh (curbp);
+            }
           mlerase (); /* erase the junk */
           free (cbuf);
           return TRUE;
@@ -1002,88 +1199,22 @@ adjustmode (int kind, int global)
 int
 getfence (bool f, int n)
 {
-  line_p oldlp; /* original line pointer */
-  int oldoff;         /* and offset */
-  int sdir;           /* direction of search (1/-1) */
-  int count;          /* current fence level count */
-  char ch;            /* fence type to match against */
-  char ofence;        /* open fence */
-  char c;             /* current character in scan */
-
-  /* save the original cursor position */
-  oldlp = curwp->w_dotp;
-  oldoff = curwp->w_doto;
-
-  /* get the current character */
-  if (oldoff == llength (oldlp))
-    ch = '\n';
-  else
-    ch = lgetc (oldlp, oldoff);
-
-  /* setup proper matching fence */
-  switch (ch)
+  line_p lp; /* where the match is */
+  int offs;
+
+  /* find the fence matching the current character */
+  lp = curwp->w_dotp;
+  offs = curwp->w_doto;
+  if (offs == llength (lp)
+      || fencefind (lgetc (lp, offs), &lp, &offs, NULL, 0) != TRUE)
     {
-    case '(':
-      ofence = ')';
-      sdir = FORWARD;
-      break;
-    case '{':
-      ofence = '}';
-      sdir = FORWARD;
-      break;
-    case '[':
-      ofence = ']';
-      sdir = FORWARD;
-      break;
-    case ')':
-      ofence = '(';
-      sdir = REVERSE;
-      break;
-    case '}':
-      ofence = '{';
-      sdir = REVERSE;
-      break;
-    case ']':
-      ofence = '[';
-      sdir = REVERSE;
-      break;
-    default:
       TTbeep ();
       return FALSE;
     }
 
-  /* scan until we find a match, or reach the end of file */
-  count = 1;
-  do
-    {
-      if (boundry (curwp->w_dotp, curwp->w_doto, sdir))
-        {
-          /* at buffer limit, no match to be found */
-          /* restore the current position */
-          curwp->w_dotp = oldlp;
-          curwp->w_doto = oldoff;
-          TTbeep ();
-          return FALSE;
-        }
-
-      if (sdir == FORWARD)
-        forwchar (FALSE, 1);
-      else
-        backchar (FALSE, 1);
-
-      /* if no eol */
-      if (curwp->w_doto != llength (curwp->w_dotp))
-        {
-          c = curwbyte ();
-          if (c == ch)
-            ++count;
-          else if (c == ofence)
-            --count;
-        }
-    }
-  while (count > 0);
-
   /* we have a match, move the sucker */
+  curwp->w_dotp = lp;
+  curwp->w_doto = offs;
   curwp->w_flag |= WFMOVE;
   return TRUE;
 }
@@ -12,6 +12,7 @@ extern int hardtab; /* Use hard tab instead of soft tab.  */
 
 #define CFCPCN 0x0001 /* Last command was "C-P", "C-N".  */
 #define CFKILL 0x0002 /* Last command was a kill.  */
+#define CFTYPE 0x0004 /* Last command was a self-insert.  */
 
 extern int thisflag; /* Flags, this command.  */
 extern int lastflag; /* Flags, last command.  */
@@ -28,6 +29,9 @@ int insert_tab (bool f, int n);
 int detab (bool f, int n);
 int entab (bool f, int n);
 int trim (bool f, int n);
+int detabregion (bool f, int n);
+int entabregion (bool f, int n);
+int trimregion (bool f, int n);
 #endif
 int openline (bool f, int n);
 int insert_newline (bool f, int n);
@@ -15,9 +15,12 @@
 
 #include "buffer.h"
 #include "estruct.h"
+#include "journal.h"
 #include "line.h"
 #include "mlout.h"
 #include "random.h"
+#include "syntax.h"
+#include "undo.h"
 #include "window.h"
 
 /*
@@ -113,12 +116,17 @@ lowerregion (bool f, int n)
   lchange (WFHARD);
   linep = region.r_linep;
   loffs = region.r_offset;
+  lexdirty (linep);
+  undline (linep);
   while (region.r_size--)
     {
       if (loffs == llength (linep))
         {
+          jrnreplace (linep);
           linep = lforw (linep);
           loffs = 0;
+          lexdirty (linep);
+          undline (linep);
         }
       else
         {
@@ -142,6 +150,7 @@ lowerregion (bool f, int n)
           loffs++;
         }
     }
+  jrnreplace (linep);
   return SUCCESS;
 }
 
@@ -170,12 +179,17 @@ upperregion (bool f, int n)
   lchange (WFHARD);
   linep = region.r_linep;
   loffs = region.r_offset;
+  lexdirty (linep);
+  undline (linep);
   while (region.r_size--)
     {
       if (loffs == llength (linep))
         {
+          jrnreplace (linep);
           linep = lforw (linep);
           loffs = 0;
+          lexdirty (linep);
+          undline (linep);
         }
       else
         {
@@ -185,6 +199,7 @@ upperregion (bool f, int n)
           loffs++;
         }
     }
+  jrnreplace (linep);
   return TRUE;
 }
 
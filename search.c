@@ -72,7 +72,10 @@
 #include "isa.h"
 #include "line.h"
 #include "mlout.h"
+#include "page.h"
 #include "terminal.h"
+#include "undo.h"
+#include "utf8.h"
 #include "util.h"
 #include "window.h"
 
@@ -86,12 +89,58 @@
 unsigned int matchlen = 0;
 static unsigned int mlenold = 0;
 char *patmatch = NULL;
-static line_p matchline = NULL;
-static int matchoff = 0;
+line_p matchline = NULL;
+int matchoff = 0;
 
-spat_t pat;  /* Search pattern.  */
-spat_t tap;  /* Reversed pattern array.  */
-spat_t rpat; /* replacement pattern.  */
+/*
+ * The patterns live on the heap and are replaced as a whole by
+ * setpattern() and setrpattern().  Until then they share nopat.
+ */
+static char nopat[1];
+char *pat = nopat;  /* Search pattern.  */
+char *tap = nopat;  /* Reversed pattern array.  */
+char *rpat = nopat; /* replacement pattern.  */
+
+/* Most bytes accepted when a pattern is typed at the prompt.  */
+#define NPATIN 4096
+
+/*
+ * Case folding of the ASCII range, rebuilt by setfold() whenever a search
+ * starts, or matches are highlighted, in a buffer whose EXACT mode differs
+ * from the one the table was built for.  Code points outside the ASCII range go through
+ * unicode_fold() instead.
+ */
+static unsigned char foldtab[0x80];
+static int foldexact = -1;
+
+/*
+ * Matches of the search pattern in the lines displayed in Hilite mode.
+ * The cache is indexed by the address of the line.  An entry holds the
+ * byte offsets of the start and end of each match on its line, and is
+ * good for as long as hlgen keeps the value it was made with and the
+ * buffer keeps its EXACT and MAGIC modes.  Edits
+ * drop the entry of the line they change, or bump hlgen when they may
+ * have changed more than one line.
+ */
+#define NHLCACHE 256
+
+struct hlentry
+{
+  line_p h_line;  /* Line of the matches, NULL if unused.  */
+  unsigned h_gen; /* Value of hlgen when they were found.  */
+  int h_mode;     /* EXACT and MAGIC modes they were found in.  */
+  int h_from;     /* Offset the scan started from.  */
+  int h_to;       /* Offset it stopped at.  */
+  int h_n;        /* Number of offsets in h_offs.  */
+  int h_size;     /* Allocated size of h_offs.  */
+  int *h_offs;    /* Start and end of each match.  */
+};
+
+static struct hlentry hlcache[NHLCACHE];
+static unsigned hlgen;
+#if MAGIC
+static bool hlmcfail; /* The magic pattern did not compile.  */
+#endif
 
 #ifdef MAGIC
 # define BELL 0x07 /* Bell character.  */
@@ -126,9 +175,10 @@ spat_t rpat; /* replacement pattern.  */
 
 /*
  * HICHAR - 1 is the largest character we will deal with.
- * HIBYTE represents the number of bytes in the bitmap.
+ * HIBYTE represents the number of bytes in the bitmap.  A class
+ * allocates two bitmaps, the second holding the case folded members.
  */
-# define HICHAR 256
+# define HICHAR 0x800
 # define HIBYTE (HICHAR >> 3)
 
 /*
@@ -157,24 +207,34 @@ struct magic_replacement
  * were actual metacharacters in the search and replace strings -
  * if not, then we don't have to use the slower MAGIC mode
  * search functions.
+ *
+ * The magic arrays are sized after the pattern they are made from,
+ * one element per pattern character plus the terminating MCNIL.
+ * They stay compiled until the pattern changes, NULL meaning there
+ * is nothing compiled yet.
  */
 static short int magical;
 static short int rmagical;
-static struct magic mcpat[NPAT]; /* The magic pattern. */
-static struct magic tapcm[NPAT]; /* The reversed magic patterni. */
-static struct magic_replacement rmcpat[NPAT]; /* The replacement magic array.  */
+static struct magic *mcpat; /* The magic pattern. */
+static struct magic *tapcm; /* The reversed magic patterni. */
+static struct magic_replacement *rmcpat; /* The replacement magic array.  */
 
 static int mcscanner (struct magic *mcpatrn, int direct, int beg_or_end);
 #endif
 
 static int amatch (struct magic *mcptr, int direct, line_p *pcwline,
                    int *pcwoff);
-static int readpattern (char *prompt, char *apat, int srch);
+static int readpattern (char *prompt, int srch);
 static int replaces (int kind, int f, int n);
 static int nextch (line_p *pcurline, int *pcuroff, int dir);
+static void setfold (int mode);
+static int cpeq (unicode_t bc, unicode_t pc);
+static unsigned int matchspan (line_p sline, int soff, line_p eline, int eoff);
 static int mcstr (void);
 static int rmcstr (void);
+static char *rmcdup (const char *str, int len);
 static int mceq (int bc, struct magic *mt);
+static int mcpchr (char **ppatptr);
 static int cclmake (char **ppatptr, struct magic *mcptr);
 static int biteq (int bc, char *cclmap);
 static char *clearbits (void);
@@ -206,16 +266,16 @@ forwsearch (bool f, int n)
    * n is positive (n == 0 will go through once, which
    * is just fine).
    */
-  if ((status = readpattern ("Search", &pat[0], TRUE)) == TRUE)
+  if ((status = readpattern ("Search", TRUE)) == TRUE)
     {
       do
         {
 #if MAGIC
           if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
-            status = mcscanner (&mcpat[0], FORWARD, PTEND);
+            status = mcscanner (mcpat, FORWARD, PTEND);
           else
 #endif
-            status = scanner (&pat[0], FORWARD, PTEND);
+            status = scanner (pat, FORWARD, PTEND);
         }
       while (--n > 0 && status);
 
@@ -256,7 +316,7 @@ forwhunt (bool f, int n)
       return FALSE;
     }
 #if MAGIC
-  if ((curwp->w_bufp->b_mode & MDMAGIC) != 0 && mcpat[0].mc_type == MCNIL)
+  if ((curwp->w_bufp->b_mode & MDMAGIC) != 0 && mcpat == NULL)
     {
       if (!mcstr ())
         return FALSE;
@@ -271,10 +331,10 @@ forwhunt (bool f, int n)
     {
 #if MAGIC
       if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
-        status = mcscanner (&mcpat[0], FORWARD, PTEND);
+        status = mcscanner (mcpat, FORWARD, PTEND);
       else
 #endif
-        status = scanner (&pat[0], FORWARD, PTEND);
+        status = scanner (pat, FORWARD, PTEND);
     }
   while (--n > 0 && status);
 
@@ -313,16 +373,16 @@ backsearch (bool f, int n)
    * n is positive (n == 0 will go through once, which
    * is just fine).
    */
-  if ((status = readpattern ("Reverse search", &pat[0], TRUE)) == TRUE)
+  if ((status = readpattern ("Reverse search", TRUE)) == TRUE)
     {
       do
         {
 #if MAGIC
           if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
-            status = mcscanner (&tapcm[0], REVERSE, PTBEG);
+            status = mcscanner (tapcm, REVERSE, PTBEG);
           else
 #endif
-            status = scanner (&tap[0], REVERSE, PTBEG);
+            status = scanner (tap, REVERSE, PTBEG);
         }
       while (--n > 0 && status);
 
@@ -361,7 +421,7 @@ backhunt (bool f, int n)
       return FALSE;
     }
 #if MAGIC
-  if ((curwp->w_bufp->b_mode & MDMAGIC) != 0 && tapcm[0].mc_type == MCNIL)
+  if ((curwp->w_bufp->b_mode & MDMAGIC) != 0 && tapcm == NULL)
     {
       if (!mcstr ())
         return FALSE;
@@ -376,10 +436,10 @@ backhunt (bool f, int n)
     {
 #if MAGIC
       if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
-        status = mcscanner (&tapcm[0], REVERSE, PTBEG);
+        status = mcscanner (tapcm, REVERSE, PTBEG);
       else
 #endif
-        status = scanner (&tap[0], REVERSE, PTBEG);
+        status = scanner (tap, REVERSE, PTBEG);
     }
   while ((--n > 0) && status);
 
@@ -409,6 +469,8 @@ mcscanner (struct magic *mcpatrn, int direct, int beg_or_end)
 {
   line_p curline; /* current line during scan */
   int curoff;           /* position within current line */
+  long olnum = 0;       /* line of "." in a paged buffer */
+  int ooff;             /* and its offset */
 
   /* If we are going in reverse, then the 'end' is actually
    * the beginning of the pattern.  Toggle it.
@@ -427,22 +489,36 @@ mcscanner (struct magic *mcpatrn, int direct, int beg_or_end)
    */
   curline = curwp->w_dotp;
   curoff = curwp->w_doto;
+  setfold (curwp->w_bufp->b_mode);
+
+  /* The pages of a paged buffer may let go of "." while scanning.
+   */
+  ooff = curoff;
+  if (curbp->b_pgr != NULL)
+    olnum = pglnum (curbp, curline);
 
   /* Scan each character until we hit the head link record.
    */
   while (!boundry (curline, curoff, direct))
     {
       /* Save the current position in case we need to
-       * restore it on a match, and initialize matchlen to
-       * zero in case we are doing a search for replacement.
+       * restore it on a match.
        */
       matchline = curline;
       matchoff = curoff;
-      matchlen = 0;
 
       if (amatch (mcpatrn, direct, &curline, &curoff))
         {
-          /* A successfull match! Reset the global "." pointers.  */
+          /* A successfull match!  Folded characters need not
+           * have the width of the pattern ones, so measure the
+           * match in the buffer.
+           */
+          if (direct == FORWARD)
+            matchlen = matchspan (matchline, matchoff, curline, curoff);
+          else
+            matchlen = matchspan (curline, curoff, matchline, matchoff);
+
+          /* Reset the global "." pointers.  */
           if (beg_or_end == PTEND)
             { /* at end of string */
               curwp->w_dotp = curline;
@@ -461,7 +537,13 @@ mcscanner (struct magic *mcpatrn, int direct, int beg_or_end)
 
       /* Advance the cursor.
        */
-      nextch (&curline, &curoff, direct);
+      nextcp (&curline, &curoff, direct);
+    }
+
+  if (curbp->b_pgr != NULL)
+    {
+      curwp->w_dotp = pgline (curbp, olnum);
+      curwp->w_doto = ooff;
     }
 
   return FALSE; /* We could not find a match. */
@@ -480,7 +562,7 @@ mcscanner (struct magic *mcpatrn, int direct, int beg_or_end)
 static int
 amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
 {
-  int c;                /* character at current position */
+  unicode_t c;          /* character at current position */
   line_p curline; /* current line during scan */
   int curoff;           /* position within current line */
   int nchars;
@@ -516,7 +598,7 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
 
   while (mcptr->mc_type != MCNIL)
     {
-      c = nextch (&curline, &curoff, direct);
+      c = nextcp (&curline, &curoff, direct);
 
       if (mcptr->mc_type & CLOSURE)
         {
@@ -527,7 +609,7 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
           nchars = 0;
           while (c != '\n' && mceq (c, mcptr))
             {
-              c = nextch (&curline, &curoff, direct);
+              c = nextcp (&curline, &curoff, direct);
               nchars++;
             }
 
@@ -542,13 +624,10 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
 
           while (1)
             {
-              nextch (&curline, &curoff, direct ^ REVERSE);
+              nextcp (&curline, &curoff, direct ^ REVERSE);
 
               if (amatch (mcptr, direct, &curline, &curoff))
-                {
-                  matchlen += nchars;
-                  goto success;
-                }
+                goto success;
 
               if (nchars-- == 0)
                 return FALSE;
@@ -577,7 +656,7 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
             {
               if (curoff == llength (curline))
                 {
-                  c = nextch (&curline, &curoff, direct ^ REVERSE);
+                  nextcp (&curline, &curoff, direct ^ REVERSE);
                   goto success;
                 }
               else
@@ -588,7 +667,7 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
             {
               if (curoff == 0)
                 {
-                  c = nextch (&curline, &curoff, direct ^ REVERSE);
+                  nextcp (&curline, &curoff, direct ^ REVERSE);
                   goto success;
                 }
               else
@@ -602,10 +681,8 @@ amatch (struct magic *mcptr, int direct, line_p *pcwline, int *pcwoff)
             return FALSE;
         }
 
-      /* Increment the length counter and
-       * advance the pattern pointer.
+      /* Advance the pattern pointer.
        */
-      matchlen++;
       mcptr++;
     } /* End of mcptr loop. */
 
@@ -630,22 +707,37 @@ success:
 int
 scanner (const char *patrn, int direct, int beg_or_end)
 {
-  int c;                 /* character at current position */
-  const char *patptr;    /* pointer into pattern */
+  unicode_t c;           /* character at current position */
+  unicode_t pc;          /* character of the pattern */
+  unsigned int patlen;   /* length of the pattern in bytes */
+  unsigned int patidx;   /* position in the pattern */
+  unsigned int pc0len;   /* length of the first pattern character */
   line_p curline;  /* current line during scan */
   int curoff;            /* position within current line */
   line_p scanline; /* current line during scanning */
   int scanoff;           /* position in scanned line */
+  long olnum = 0;        /* line of "." in a paged buffer */
+  int ooff;              /* and its offset */
 
   /* If we are going in reverse, then the 'end' is actually
    * the beginning of the pattern.  Toggle it.
    */
   beg_or_end ^= direct;
 
-  /* Set up local pointers to global ".".
+  /* Set up local pointers to global ".", the fold table
+   * and the first character of the pattern.
    */
   curline = curwp->w_dotp;
   curoff = curwp->w_doto;
+  setfold (curwp->w_bufp->b_mode);
+  patlen = strlen (patrn);
+  pc0len = utf8_to_unicode (patrn, 0, patlen, &pc);
+
+  /* The pages of a paged buffer may let go of "." while scanning.
+   */
+  ooff = curoff;
+  if (curbp->b_pgr != NULL)
+    olnum = pglnum (curbp, curline);
 
   /* Scan each character until we hit the head link record.
    */
@@ -660,29 +752,38 @@ scanner (const char *patrn, int direct, int beg_or_end)
       /* Get the character resolving newlines, and
        * test it against first char in pattern.
        */
-      c = nextch (&curline, &curoff, direct);
+      c = nextcp (&curline, &curoff, direct);
 
-      if (eq (c, patrn[0]))
+      if (cpeq (c, pc))
         { /* if we find it.. */
           /* Setup scanning pointers.
            */
           scanline = curline;
           scanoff = curoff;
-          patptr = &patrn[0];
 
           /* Scan through the pattern for a match.
            */
-          while (*++patptr != '\0')
+          for (patidx = pc0len; patidx < patlen;)
             {
-              c = nextch (&scanline, &scanoff, direct);
+              unicode_t tc;
+
+              c = nextcp (&scanline, &scanoff, direct);
+              patidx += utf8_to_unicode (patrn, patidx, patlen, &tc);
 
-              if (!eq (c, *patptr))
+              if (!cpeq (c, tc))
                 goto fail;
             }
 
           /* A SUCCESSFULL MATCH!!!
-           * reset the global "." pointers
+           * Measure it, since folding may change the width
+           * of a character, and reset the global "." pointers.
            */
+          mlenold = matchlen;
+          if (direct == FORWARD)
+            matchlen = matchspan (matchline, matchoff, scanline, scanoff);
+          else
+            matchlen = matchspan (scanline, scanoff, matchline, matchoff);
+
           if (beg_or_end == PTEND)
             { /* at end of string */
               curwp->w_dotp = scanline;
@@ -701,6 +802,12 @@ scanner (const char *patrn, int direct, int beg_or_end)
     fail:; /* continue to search */
     }
 
+  if (curbp->b_pgr != NULL)
+    {
+      curwp->w_dotp = pgline (curbp, olnum);
+      curwp->w_doto = ooff;
+    }
+
   return FALSE; /* We could not find a match */
 }
 
@@ -709,14 +816,45 @@ scanner (const char *patrn, int direct, int beg_or_end)
  *  from the pattern.  If we are not in EXACT mode, fold out the case.
  */
 int
-eq (unsigned char bc, unsigned char pc)
+eq (unicode_t bc, unicode_t pc)
+{
+  setfold (curwp->w_bufp->b_mode);
+  return cpeq (bc, pc);
+}
+
+/*
+ * setfold -- Make foldtab[] match the EXACT mode in mode.
+ */
+static void
+setfold (int mode)
+{
+  int exact;
+  int c;
+
+  exact = (mode & MDEXACT) != 0;
+  if (exact == foldexact)
+    return;
+
+  for (c = 0; c < 0x80; c++)
+    foldtab[c] = (!exact && isupper (c)) ? flipcase (c) : c;
+  foldexact = exact;
+}
+
+/*
+ * cpeq -- eq() for code points, once setfold() has run.  ASCII is
+ *  compared through the fold table, anything else is folded through
+ *  the unicode table.
+ */
+static int
+cpeq (unicode_t bc, unicode_t pc)
 {
-  if ((curwp->w_bufp->b_mode & MDEXACT) == 0)
+  if ((bc | pc) < 0x80)
+    return foldtab[bc] == foldtab[pc];
+
+  if (!foldexact)
     {
-      if (islower (bc))
-        bc = flipcase (bc);
-      if (islower (pc))
-        pc = flipcase (pc);
+      bc = unicode_fold (bc);
+      pc = unicode_fold (pc);
     }
 
   return bc == pc;
@@ -732,10 +870,11 @@ setprompt (char *tpat, unsigned tpat_size, char *prompt, char *apat)
 }
 
 /*
- * readpattern -- Read a pattern.  Stash it in apat.  If it is the
- *  search string, create the reverse pattern and the magic
- *  pattern, assuming we are in MAGIC mode (and defined that way).
- *  Apat is not updated if the user types in an empty line.  If
+ * readpattern -- Read a pattern.  Stash it in pat, or in rpat if it is
+ *  not the search string.  If it is the search string, create the
+ *  reverse pattern and the magic pattern, assuming we are in MAGIC
+ *  mode (and defined that way).
+ *  The pattern is not updated if the user types in an empty line.  If
  *  the user typed an empty line, and there is no old pattern, it is
  *  an error.  Display the old pattern, in the style of Jeff Lomicka.
  *  There is some do-it-yourself control expansion.  Change to using
@@ -743,52 +882,117 @@ setprompt (char *tpat, unsigned tpat_size, char *prompt, char *apat)
  *  string.
  */
 static int
-readpattern (char *prompt, char *apat, int srch)
+readpattern (char *prompt, int srch)
 {
   int status;
   char tpat[NPAT + 20];
   char *dynpat; /* dynamically allocated pattern buffer */
 
-  setprompt (tpat, NPAT / 2, prompt, apat);
+  setprompt (tpat, NPAT / 2, prompt, srch ? pat : rpat);
 
   /* Read a pattern.  Either we get one,
    * or we just get the META charater, and use the previous pattern.
    * Then, if it's the search string, make a reversed pattern.
    * *Then*, make the meta-pattern, if we are defined that way.
    */
-  status = newmlargt (&dynpat, tpat, NPAT);
+  status = newmlargt (&dynpat, tpat, NPATIN);
   if (status == TRUE)
     {
-      strscpy (apat, dynpat, NPAT);
+      status = srch ? setpattern (dynpat) : setrpattern (dynpat);
       free (dynpat);
-      if (srch)
-        { /* If we are doing the search string. */
-          /* Reverse string copy, and remember
-           * the length for substitution purposes.
-           */
-          rvstrcpy (tap, apat);
-          mlenold = matchlen = strlen (apat);
-        }
-#if MAGIC
-      /* Only make the meta-pattern if in magic mode,
-       * since the pattern in question might have an
-       * invalid meta combination.
+      if (status != TRUE)
+        return status;
+
+      /* Remember the length for substitution purposes.
        */
-      if ((curwp->w_bufp->b_mode & MDMAGIC) == 0)
-        {
-          mcclear ();
-          rmcclear ();
-        }
-      else
-        status = srch ? mcstr () : rmcstr ();
-#endif
+      if (srch)
+        mlenold = matchlen = strlen (pat);
     }
-  else if (status == FALSE && apat[0] != 0) /* Old one */
+  else if (status == FALSE && (srch ? pat : rpat)[0] != 0) /* Old one */
     status = TRUE;
 
+#if MAGIC
+  /* Only make the meta-pattern if in magic mode,
+   * since the pattern in question might have an
+   * invalid meta combination.  An old pattern keeps
+   * the meta-pattern it was compiled to.
+   */
+  if (status == TRUE && (curwp->w_bufp->b_mode & MDMAGIC) != 0)
+    {
+      if (srch && mcpat == NULL)
+        status = mcstr ();
+      else if (!srch && rmcpat == NULL)
+        status = rmcstr ();
+    }
+#endif
+
   return status;
 }
 
+/*
+ * setpattern -- Make str the search pattern, along with its reversed
+ *  form.  The magic pattern of the previous one is dropped, and will
+ *  be compiled again when it is first needed.
+ */
+int
+setpattern (const char *str)
+{
+  size_t len;
+  char *npat, *ntap;
+
+  len = strlen (str);
+  npat = malloc (len + 1);
+  ntap = malloc (len + 1);
+  if (npat == NULL || ntap == NULL)
+    {
+      free (npat);
+      free (ntap);
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+
+  memcpy (npat, str, len + 1);
+  rvstrcpy (ntap, npat);
+  if (pat != nopat)
+    {
+      free (pat);
+      free (tap);
+    }
+  pat = npat;
+  tap = ntap;
+#if MAGIC
+  mcclear ();
+  hlmcfail = FALSE;
+#endif
+  hlrefresh (NULL);
+  return TRUE;
+}
+
+/*
+ * setrpattern -- Make str the replacement pattern, dropping the
+ *  replacement magic array of the previous one.
+ */
+int
+setrpattern (const char *str)
+{
+  char *nrpat;
+
+  if ((nrpat = malloc (strlen (str) + 1)) == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+
+  strcpy (nrpat, str);
+  if (rpat != nopat)
+    free (rpat);
+  rpat = nrpat;
+#if MAGIC
+  rmcclear ();
+#endif
+  return TRUE;
+}
+
 /*
  * savematch -- We found the pattern?  Let's save it away.
  */
@@ -822,19 +1026,23 @@ savematch (void)
 }
 
 /*
- * rvstrcpy -- Reverse string copy.
+ * rvstrcpy -- Reverse string copy.  UTF-8 sequences are kept in order,
+ *  so that the reversed pattern still decodes to the same characters.
  */
 void
 rvstrcpy (char *rvstr, char *str)
 {
-  int i;
+  unsigned int i, len, bytes;
+  unicode_t c;
 
-  str += (i = strlen (str));
+  len = strlen (str);
+  rvstr[len] = '\0';
 
-  while (i-- > 0)
-    *rvstr++ = *--str;
-
-  *rvstr = '\0';
+  for (i = 0; i < len; i += bytes)
+    {
+      bytes = utf8_to_unicode (str, i, len, &c);
+      memcpy (&rvstr[len - i - bytes], &str[i], bytes);
+    }
 }
 
 /*
@@ -879,7 +1087,7 @@ replaces (int kind, int f, int n)
   int nlflag;            /* last char of search string a <NL>? */
   int nlrepl;            /* was a replace done on the last line? */
   char c;                /* input char for query */
-  spat_t tpat;           /* temporary to hold search pattern */
+  char tpat[NPAT + 20];  /* temporary to hold search pattern */
   line_p origline; /* original "." position */
   int origoff;           /* and offset (for . query option) */
   line_p lastline; /* position of last replace and */
@@ -900,20 +1108,20 @@ replaces (int kind, int f, int n)
   /* Ask the user for the text of a pattern.
    */
   if ((status = readpattern ((kind == FALSE ? "Replace" : "Query replace"),
-                             &pat[0], TRUE)) != TRUE)
+                             TRUE)) != TRUE)
     return status;
 
   /* Ask for the replacement string.  */
-  if ((status = readpattern ("with", &rpat[0], FALSE)) == ABORT)
+  if ((status = readpattern ("with", FALSE)) == ABORT)
     return status;
 
   /* Find the length of the replacement string.  */
-  rlength = strlen (&rpat[0]);
+  rlength = strlen (rpat);
 
   /* Set up flags so we can make sure not to do a recursive
    * replace on the last line.
    */
-  nlflag = (pat[matchlen - 1] == '\n');
+  nlflag = (pat[strlen (pat) - 1] == '\n');
   nlrepl = FALSE;
 
   if (kind)
@@ -921,9 +1129,9 @@ replaces (int kind, int f, int n)
       /* Build query replace question string.
        */
       strcpy (tpat, "Replace '");
-      expandp (&pat[0], &tpat[strlen (tpat)], NPAT / 3);
+      expandp (pat, &tpat[strlen (tpat)], NPAT / 3);
       strcat (tpat, "' with '");
-      expandp (&rpat[0], &tpat[strlen (tpat)], NPAT / 3);
+      expandp (rpat, &tpat[strlen (tpat)], NPAT / 3);
       strcat (tpat, "'? ");
 
       /* Initialize last replaced pointers.
@@ -940,6 +1148,9 @@ replaces (int kind, int f, int n)
   numsub = 0;
   nummatch = 0;
 
+  /* All the substitutions are undone as one.  */
+  undbulk (curwp->w_dotp);
+
   while ((f == FALSE || n > nummatch) && (nlflag == FALSE || nlrepl == FALSE))
     {
       /* Search for the pattern.
@@ -950,12 +1161,12 @@ replaces (int kind, int f, int n)
 #if MAGIC
       if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
         {
-          if (!mcscanner (&mcpat[0], FORWARD, PTBEG))
+          if (!mcscanner (mcpat, FORWARD, PTBEG))
             break;
         }
       else
 #endif
-          if (!scanner (&pat[0], FORWARD, PTBEG))
+          if (!scanner (pat, FORWARD, PTBEG))
         break; /* all done */
 
       ++nummatch; /* Increment # of matches */
@@ -986,7 +1197,6 @@ replaces (int kind, int f, int n)
 #endif
             case 'y': /* yes, substitute */
             case ' ':
-              savematch ();
               break;
 
 #if PKCODE
@@ -1064,9 +1274,12 @@ replaces (int kind, int f, int n)
       /* end of "if kind" */
       /*
        * Delete the sucker, and insert its
+       * replacement.  The match is saved first, both
+       * for the 'u' query option and for '&' in the
        * replacement.
        */
-      status = delins (matchlen, &rpat[0], TRUE);
+      savematch ();
+      status = delins (matchlen, rpat, TRUE);
       if (status != TRUE)
         return status;
 
@@ -1110,7 +1323,7 @@ delins (int dlength, char *instr, int use_meta)
 #if MAGIC
       if ((rmagical && use_meta) && (curwp->w_bufp->b_mode & MDMAGIC) != 0)
     {
-      rmcptr = &rmcpat[0];
+      rmcptr = rmcpat;
       while (rmcptr->mc_type != MCNIL && status == TRUE)
         {
           if (rmcptr->mc_type == LITCHAR)
@@ -1191,6 +1404,10 @@ boundry (line_p curline, int curoff, int dir)
 {
   int border;
 
+  /* A paged buffer reads on from its file.  */
+  if (curbp->b_pgr != NULL)
+    pgedge (curbp, curline, dir);
+
   if (dir == FORWARD)
     {
       border = (curoff == llength (curline))
@@ -1250,6 +1467,243 @@ nextch (line_p *pcurline, int *pcuroff, int dir)
   return c;
 }
 
+/*
+ * nextcp -- nextch() for whole characters.  UTF-8 sequences are decoded
+ *  to their code point and skipped as a unit, other bytes are returned
+ *  as they are.
+ */
+unicode_t
+nextcp (line_p *pcurline, int *pcuroff, int dir)
+{
+  line_p curline;
+  int curoff;
+  unicode_t c;
+
+  curline = *pcurline;
+  curoff = *pcuroff;
+
+  if (dir == FORWARD)
+    {
+      if (curoff == llength (curline))
+        {
+          curline = lforw (curline);
+          curoff = 0;
+          c = '\n';
+        }
+      else if ((c = lgetc (curline, curoff) & 0xFF) < 0x80)
+        curoff++;
+      else
+        curoff += utf8_to_unicode (curline->l_text, curoff,
+                                   llength (curline), &c);
+    }
+  else
+    {
+      if (curoff == 0)
+        {
+          curline = lback (curline);
+          curoff = llength (curline);
+          c = '\n';
+        }
+      else if ((c = lgetc (curline, --curoff) & 0xFF) >= 0x80)
+        {
+          unsigned int delta;
+          unicode_t uc;
+
+          delta = utf8_revdelta ((unsigned char *) &curline->l_text[curoff],
+                                 curoff);
+          if (delta != 0
+              && utf8_to_unicode (curline->l_text, curoff - delta,
+                                  llength (curline), &uc) == delta + 1)
+            {
+              curoff -= delta;
+              c = uc;
+            }
+        }
+    }
+  *pcurline = curline;
+  *pcuroff = curoff;
+
+  return c;
+}
+
+/*
+ * matchspan -- Number of bytes from one position to a later one, each
+ *  line break counting as one.
+ */
+static unsigned int
+matchspan (line_p sline, int soff, line_p eline, int eoff)
+{
+  unsigned int len = 0;
+
+  while (sline != eline)
+    {
+      len += llength (sline) - soff + 1;
+      sline = lforw (sline);
+      soff = 0;
+    }
+
+  return len + eoff - soff;
+}
+
+#define hlslot(lp) (&hlcache[((size_t) (lp) >> 4) % NHLCACHE])
+
+/*
+ * hlmatchat -- Offset of the end of a match of the pattern starting at
+ *  offset off of line lp, or -1 if there is none that ends on the same
+ *  line.  mode holds the MAGIC mode of its buffer.
+ */
+static int
+hlmatchat (line_p lp, int off, int patlen, int mode)
+{
+  line_p scanline = lp;
+  int scanoff = off;
+  int patidx;
+
+#if MAGIC
+  if (magical && (mode & MDMAGIC) != 0)
+    {
+      if (!amatch (mcpat, FORWARD, &scanline, &scanoff) || scanline != lp)
+        return -1;
+      return scanoff;
+    }
+#endif
+
+  for (patidx = 0; patidx < patlen;)
+    {
+      unicode_t pc;
+      unicode_t c;
+
+      patidx += utf8_to_unicode (pat, patidx, patlen, &pc);
+      c = nextcp (&scanline, &scanoff, FORWARD);
+      if (scanline != lp || !cpeq (c, pc))
+        return -1;
+    }
+
+  return scanoff;
+}
+
+/*
+ * hlmatches -- Find the matches of the search pattern in line lp of
+ *  buffer bp that can show between byte offsets from and to, as its
+ *  modes have them match, or take them from the cache.  *poffs is set to
+ *  the start and end offset of each match, in order, and the number of
+ *  offsets is returned.
+ */
+int
+hlmatches (buffer_p bp, line_p lp, int from, int to, int **poffs)
+{
+  struct hlentry *hp;
+  int mode;
+  int patlen;
+  int off;
+
+  mode = bp->b_mode & (MDEXACT | MDMAGIC);
+  patlen = strlen (pat);
+
+  /* A plain match is at most four bytes for each byte of the pattern,
+   * so one that shows from "from" on starts no further left.  A magic one can
+   * be as long as the line.
+   */
+  if ((mode & MDMAGIC) != 0 || from < 4 * patlen)
+    from = 0;
+  else
+    from -= 4 * patlen;
+  while (from > 0 && (lp->l_text[from] & 0xC0) == 0x80)
+    from--; /* To the start of a character.  */
+  if (to > llength (lp))
+    to = llength (lp);
+
+  hp = hlslot (lp);
+  *poffs = hp->h_offs;
+  if (hp->h_line == lp && hp->h_gen == hlgen && hp->h_mode == mode
+      && hp->h_from <= from && hp->h_to >= to)
+    return hp->h_n;
+
+  setfold (mode);
+  hp->h_line = lp;
+  hp->h_gen = hlgen;
+  hp->h_mode = mode;
+  hp->h_from = from;
+  hp->h_to = to;
+  hp->h_n = 0;
+  if (patlen == 0)
+    return 0;
+
+#if MAGIC
+  if ((mode & MDMAGIC) != 0 && mcpat == NULL)
+    {
+      /* Compile once for each pattern, not for every line.  */
+      if (hlmcfail || !mcstr ())
+        {
+          hlmcfail = TRUE;
+          return 0;
+        }
+    }
+#endif
+
+  off = from;
+  while (off < to)
+    {
+      int end;
+
+      end = hlmatchat (lp, off, patlen, mode);
+      if (end <= off)
+        {
+          unicode_t c;
+
+          off += utf8_to_unicode (lp->l_text, off, llength (lp), &c);
+          continue;
+        }
+
+      if (hp->h_n + 2 > hp->h_size)
+        {
+          int nsize = hp->h_size ? 2 * hp->h_size : 16;
+          int *noffs = realloc (hp->h_offs, nsize * sizeof (int));
+
+          if (noffs == NULL)
+            break;
+          hp->h_offs = *poffs = noffs;
+          hp->h_size = nsize;
+        }
+      hp->h_offs[hp->h_n++] = off;
+      hp->h_offs[hp->h_n++] = end;
+      off = end;
+    }
+
+  return hp->h_n;
+}
+
+/*
+ * hlforget -- Drop the cached matches of line lp, or of all the lines
+ *  if lp is NULL.
+ */
+void
+hlforget (line_p lp)
+{
+  struct hlentry *hp;
+
+  if (lp == NULL)
+    hlgen++;
+  else if ((hp = hlslot (lp))->h_line == lp)
+    hp->h_line = NULL;
+}
+
+/*
+ * hlrefresh -- The pattern or the way it matches has changed.  Forget
+ *  all the matches and redraw the windows that show them, along with
+ *  those of buffer bp if it is not NULL.
+ */
+void
+hlrefresh (buffer_p bp)
+{
+  window_p wp;
+
+  hlgen++;
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp || (wp->w_bufp->b_mode & MDHILIT) != 0)
+      wp->w_flag |= WFHARD;
+}
+
 #if MAGIC
 /*
  * mcstr -- Set up the 'magic' array.  The closure symbol is taken as
@@ -1274,16 +1728,24 @@ mcstr (void)
   int status = TRUE;
   int does_closure = FALSE;
 
-  /* If we had metacharacters in the struct magic array previously,
-   * free up any bitmaps that may have been allocated.
+  /* If we had a struct magic array previously, free it up
+   * along with any bitmaps that may have been allocated.
    */
-  if (magical)
-    mcclear ();
+  mcclear ();
+
+  mj = strlen (pat) + 1;
+  mcpat = malloc (mj * sizeof (struct magic));
+  tapcm = malloc (mj * sizeof (struct magic));
+  if (mcpat == NULL || tapcm == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      mcclear ();
+      return FALSE;
+    }
 
-  magical = FALSE;
   mj = 0;
-  mcptr = &mcpat[0];
-  patptr = &pat[0];
+  mcptr = mcpat;
+  patptr = pat;
 
   while ((pchr = *patptr) && status)
     {
@@ -1342,7 +1804,7 @@ mcstr (void)
         default:
         litcase:
           mcptr->mc_type = LITCHAR;
-          mcptr->u.lchar = pchr;
+          mcptr->u.lchar = pchr = mcpchr (&patptr);
           does_closure = (pchr != '\n');
           break;
         } /* End of switch. */
@@ -1365,7 +1827,7 @@ mcstr (void)
    */
   if (status)
     {
-      rtpcm = &tapcm[0];
+      rtpcm = tapcm;
       while (--mj >= 0)
         {
 #if USG | BSD
@@ -1397,10 +1859,17 @@ rmcstr (void)
   int status = TRUE;
   int mj;
 
-  patptr = &rpat[0];
-  rmcptr = &rmcpat[0];
+  rmcclear ();
+
+  rmcptr = rmcpat = malloc ((strlen (rpat) + 1) * sizeof (*rmcpat));
+  if (rmcpat == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+
+  patptr = rpat;
   mj = 0;
-  rmagical = FALSE;
 
   while (*patptr && status == TRUE)
     {
@@ -1417,13 +1886,11 @@ rmcstr (void)
           if (mj != 0)
             {
               rmcptr->mc_type = LITCHAR;
-              if ((rmcptr->rstr = malloc (mj + 1)) == NULL)
+              if ((rmcptr->rstr = rmcdup (patptr - mj, mj)) == NULL)
                 {
-                  mloutstr ("%Memory exhausted");
                   status = FALSE;
                   break;
                 }
-              strncpy (rmcptr->rstr, patptr - mj, mj);
               rmcptr++;
               mj = 0;
             }
@@ -1435,19 +1902,15 @@ rmcstr (void)
         case MC_ESC:
           rmcptr->mc_type = LITCHAR;
 
-          /* We malloc mj plus two here, instead
-           * of one, because we have to count the
-           * current character.
+          /* We copy mj plus one here, because
+           * we have to count the current character.
            */
-          if ((rmcptr->rstr = malloc (mj + 2)) == NULL)
+          if ((rmcptr->rstr = rmcdup (patptr - mj, mj + 1)) == NULL)
             {
-              mloutstr ("%Memory exhausted");
               status = FALSE;
               break;
             }
 
-          strncpy (rmcptr->rstr, patptr - mj, mj + 1);
-
           /* If MC_ESC is not the last character
            * in the string, find out what it is
            * escaping, and overwrite the last
@@ -1470,16 +1933,10 @@ rmcstr (void)
   if (rmagical && mj > 0)
     {
       rmcptr->mc_type = LITCHAR;
-      if ((rmcptr->rstr = malloc (mj + 1)) == NULL)
-        {
-          mloutstr ("%Memory exhausted");
-          status = FALSE;
-        }
+      if ((rmcptr->rstr = rmcdup (patptr - mj, mj)) == NULL)
+        status = FALSE;
       else
-        {
-          strncpy (rmcptr->rstr, patptr - mj, mj);
-          rmcptr++;
-        }
+        rmcptr++;
     }
 
   rmcptr->mc_type = MCNIL;
@@ -1487,7 +1944,27 @@ rmcstr (void)
 }
 
 /*
- * mcclear -- Free up any CCL bitmaps, and MCNIL the struct magic search
+ * rmcdup -- Copy len bytes of the replacement string into a string of
+ *  their own.
+ */
+static char *
+rmcdup (const char *str, int len)
+{
+  char *dup;
+
+  if ((dup = malloc (len + 1)) == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return NULL;
+    }
+
+  memcpy (dup, str, len);
+  dup[len] = '\0';
+  return dup;
+}
+
+/*
+ * mcclear -- Free up any CCL bitmaps, and the struct magic search
  * arrays.
  */
 void
@@ -1495,20 +1972,25 @@ mcclear (void)
 {
   struct magic *mcptr;
 
-  mcptr = &mcpat[0];
-
-  while (mcptr->mc_type != MCNIL)
+  if (mcpat != NULL)
     {
-      if ((mcptr->mc_type & MASKCL) == CCL
-          || (mcptr->mc_type & MASKCL) == NCCL)
-        free (mcptr->u.cclmap);
-      mcptr++;
+      for (mcptr = mcpat; mcptr->mc_type != MCNIL; mcptr++)
+        {
+          if ((mcptr->mc_type & MASKCL) == CCL
+              || (mcptr->mc_type & MASKCL) == NCCL)
+            free (mcptr->u.cclmap);
+        }
     }
-  mcpat[0].mc_type = tapcm[0].mc_type = MCNIL;
+
+  /* The reversed array shares the bitmaps.  */
+  free (mcpat);
+  free (tapcm);
+  mcpat = tapcm = NULL;
+  magical = FALSE;
 }
 
 /*
- * rmcclear -- Free up any strings, and MCNIL the struct magic_replacement
+ * rmcclear -- Free up any strings, and the struct magic_replacement
  * array.
  */
 void
@@ -1516,16 +1998,18 @@ rmcclear (void)
 {
   struct magic_replacement *rmcptr;
 
-  rmcptr = &rmcpat[0];
-
-  while (rmcptr->mc_type != MCNIL)
+  if (rmcpat != NULL)
     {
-      if (rmcptr->mc_type == LITCHAR)
-        free (rmcptr->rstr);
-      rmcptr++;
+      for (rmcptr = rmcpat; rmcptr->mc_type != MCNIL; rmcptr++)
+        {
+          if (rmcptr->mc_type == LITCHAR)
+            free (rmcptr->rstr);
+        }
     }
 
-  rmcpat[0].mc_type = MCNIL;
+  free (rmcpat);
+  rmcpat = NULL;
+  rmagical = FALSE;
 }
 
 /*
@@ -1538,13 +2022,10 @@ mceq (int bc, struct magic *mt)
 {
   int result;
 
-#if PKCODE
-  bc = bc & 0xFF;
-#endif
   switch (mt->mc_type & MASKCL)
     {
     case LITCHAR:
-      result = eq (bc, mt->u.lchar);
+      result = cpeq (bc, mt->u.lchar);
       break;
 
     case ANY:
@@ -1552,22 +2033,17 @@ mceq (int bc, struct magic *mt)
       break;
 
     case CCL:
-      if (!(result = biteq (bc, mt->u.cclmap)))
-        {
-          if ((curwp->w_bufp->b_mode & MDEXACT) == 0 && (isletter (bc)))
-            {
-              result = biteq (flipcase (bc), mt->u.cclmap);
-            }
-        }
+      if (foldexact)
+        result = biteq (bc, mt->u.cclmap);
+      else
+        result = biteq (unicode_fold (bc), mt->u.cclmap + HIBYTE);
       break;
 
     case NCCL:
-      result = !biteq (bc, mt->u.cclmap);
-
-      if ((curwp->w_bufp->b_mode & MDEXACT) == 0 && (isletter (bc)))
-        {
-          result &= !biteq (flipcase (bc), mt->u.cclmap);
-        }
+      if (foldexact)
+        result = !biteq (bc, mt->u.cclmap);
+      else
+        result = !biteq (unicode_fold (bc), mt->u.cclmap + HIBYTE);
       break;
 
     default:
@@ -1580,6 +2056,24 @@ mceq (int bc, struct magic *mt)
   return result;
 }
 
+/*
+ * mcpchr -- Get the pattern character at *ppatptr as a code point.
+ *  *ppatptr is left on the last byte of its UTF-8 sequence, so that
+ *  a loop may automatically increment with safety.
+ */
+static int
+mcpchr (char **ppatptr)
+{
+  unicode_t c;
+
+  if ((**ppatptr & 0x80) == 0)
+    return **ppatptr;
+
+  /* The terminating '\0' ends any sequence, so four is safe.  */
+  *ppatptr += utf8_to_unicode (*ppatptr, 0, 4, &c) - 1;
+  return c;
+}
+
 /*
  * cclmake -- create the bitmap for the character class.
  *  ppatptr is left pointing to the end-of-character-class character,
@@ -1623,8 +2117,9 @@ cclmake (char **ppatptr, struct magic *mcptr)
   else
     {
       if (ochr == MC_ESC)
-        ochr = *++patptr;
+        patptr++;
 
+      ochr = mcpchr (&patptr);
       setbit (ochr, bmap);
       patptr++;
     }
@@ -1641,16 +2136,18 @@ cclmake (char **ppatptr, struct magic *mcptr)
             setbit (pchr, bmap);
           else
             {
-              pchr = *++patptr;
+              patptr++;
+              pchr = mcpchr (&patptr);
               while (++ochr <= pchr)
                 setbit (ochr, bmap);
             }
           break;
           /* Note: no break between case MC_ESC and the default.  */
         case MC_ESC:
-          pchr = *++patptr;
+          patptr++;
           /* falltrhough */
         default:
+          pchr = mcpchr (&patptr);
           setbit (pchr, bmap);
           break;
         }
@@ -1675,18 +2172,14 @@ cclmake (char **ppatptr, struct magic *mcptr)
 static int
 biteq (int bc, char *cclmap)
 {
-#if PKCODE
-  bc &= 0xFF;
-#else
   if (bc >= HICHAR)
     return FALSE;
-#endif
 
   return (*(cclmap + (bc >> 3)) & BIT (bc & 7)) ? TRUE : FALSE;
 }
 
 /*
- * clearbits -- Allocate and zero out a CCL bitmap.
+ * clearbits -- Allocate and zero out a CCL bitmap and its folded twin.
  */
 static char *
 clearbits (void)
@@ -1695,24 +2188,26 @@ clearbits (void)
   char *cclmap;
   int i;
 
-  if ((cclmap = cclstart = malloc (HIBYTE)) != NULL)
+  if ((cclmap = cclstart = malloc (2 * HIBYTE)) != NULL)
     {
-      for (i = 0; i < HIBYTE; i++)
+      for (i = 0; i < 2 * HIBYTE; i++)
         *cclmap++ = 0;
     }
   return cclstart;
 }
 
 /*
- * setbit -- Set a bit (ON only) in the bitmap.
+ * setbit -- Set a bit (ON only) in the bitmap, and the bit of its case
+ *  folding in the folded bitmap.
  */
 static void
 setbit (int bc, char *cclmap)
 {
-#if PKCODE
-  bc = bc & 0xFF;
-#endif
   if (bc < HICHAR)
     *(cclmap + (bc >> 3)) |= BIT (bc & 7);
+
+  bc = unicode_fold (bc);
+  if (bc < HICHAR)
+    *(cclmap + HIBYTE + (bc >> 3)) |= BIT (bc & 7);
 }
 #endif
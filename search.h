@@ -3,18 +3,21 @@
 
 #define MAGIC 1 /* include regular expression matching? */
 
+#include "buffer.h"
 #include "line.h"
+#include "utf8.h"
 #include <stddef.h>
 
-typedef char spat_t[128];    /* search pattern type */
-#define NPAT sizeof (spat_t) /* # of bytes, pattern   */
+#define NPAT 128 /* # of bytes of a pattern shown in prompts */
 
 extern unsigned int matchlen;
 extern char *patmatch;
+extern line_p matchline; /* Start of the last match */
+extern int matchoff;
 
-extern spat_t pat;  /* Search pattern               */
-extern spat_t tap;  /* Reversed pattern array.      */
-extern spat_t rpat; /* replacement pattern          */
+extern char *pat;  /* Search pattern               */
+extern char *tap;  /* Reversed pattern array.      */
+extern char *rpat; /* replacement pattern          */
 
 /*
  * PTBEG, PTEND, FORWARD, and REVERSE are all toggle-able values for
@@ -31,7 +34,8 @@ int forwsearch (bool f, int n);
 int forwhunt (bool f, int n);
 int backsearch (bool f, int n);
 int backhunt (bool f, int n);
-int eq (unsigned char bc, unsigned char pc);
+int eq (unicode_t bc, unicode_t pc);
+unicode_t nextcp (line_p *pcurline, int *pcuroff, int dir);
 void savematch (void);
 void rvstrcpy (char *rvstr, char *str);
 int sreplace (bool f, int n);
@@ -41,6 +45,12 @@ int expandp (char *srcstr, char *deststr, int maxlength);
 int boundry (line_p curline, int curoff, int dir);
 
 void setprompt (char *tpat, unsigned tpat_size, char *prompt, char *apat);
+int setpattern (const char *str);
+int setrpattern (const char *str);
+
+int hlmatches (buffer_p bp, line_p lp, int from, int to, int **poffs);
+void hlforget (line_p lp);
+void hlrefresh (buffer_p bp);
 
 #if MAGIC
 void mcclear (void);
@@ -0,0 +1,489 @@
+/* sort.c -- implements sort.h */
+#include "sort.h"
+
+/*  sort.c
+ *
+ *      The routines in this file sort the lines of the region and drop
+ *      the repeats among them, without copying any text.  Pointers to the
+ *      lines are gathered in an array, with the number each one starts
+ *      with when sorting by numbers, and the array is sorted by merging,
+ *      which keeps equal lines in the order they were.  With threads, the
+ *      array of a big region is cut into slices that are sorted at the
+ *      same time, then merged.  The lines are linked back in their new
+ *      order at the end.
+ *
+ *      Case is told apart in EXACT mode only, as when searching.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#if PTHREAD
+#include <pthread.h>
+#endif
+
+#include "buffer.h"
+#include "estruct.h"
+#include "journal.h"
+#include "line.h"
+#include "mlout.h"
+#include "random.h"
+#include "region.h"
+#include "syntax.h"
+#include "undo.h"
+#include "utf8.h"
+#include "window.h"
+
+#define SORTRUN     16    /* # of keys sorted by insertion.  */
+#define SORTSLICE   16384 /* Fewest keys worth a thread.  */
+#define SORTTHREADS 4     /* Most threads sorting at once.  */
+
+struct sortkey
+{
+  line_p k_line; /* The line.  */
+  union
+  {
+    double num;        /* The number it starts with, by numbers.  */
+    unsigned long pfx; /* Its first bytes as they compare, by text.  */
+  } k_u;
+};
+
+/* How the keys compare, set before sorting.  */
+static bool sortnum;  /* By the numbers the lines start with.  */
+static bool sortfold; /* Folding case.  */
+static bool sortrev;  /* In reverse order.  */
+
+/*
+ * Return the number line lp starts with after blanks, an optional sign,
+ * digits and a fraction, 0 if none.
+ */
+static double
+linenum (line_p lp)
+{
+  const char *cp = lp->l_text;
+  const char *end = cp + llength (lp);
+  double num = 0;
+  double scale;
+  bool neg = FALSE;
+
+  while (cp < end && (*cp == ' ' || *cp == '\t'))
+    cp++;
+  if (cp < end && (*cp == '-' || *cp == '+'))
+    neg = (*cp++ == '-');
+  while (cp < end && isdigit ((unsigned char) *cp))
+    num = num * 10 + (*cp++ - '0');
+  if (cp < end && *cp == '.')
+    for (cp++, scale = 0.1; cp < end && isdigit ((unsigned char) *cp);
+         scale /= 10)
+      num += (*cp++ - '0') * scale;
+
+  return neg ? -num : num;
+}
+
+/*
+ * Compare the text of lines a and b, as memcmp() would, folding case with
+ * sortfold.
+ */
+static int
+linecmp (line_p a, line_p b)
+{
+  int la = llength (a);
+  int lb = llength (b);
+  int i = 0;
+  int j = 0;
+
+  if (!sortfold)
+    {
+      int r = memcmp (a->l_text, b->l_text, (la < lb) ? la : lb);
+
+      return (r < 0) ? -1 : (r > 0) ? 1 : la - lb;
+    }
+
+  while (i < la && j < lb)
+    {
+      unicode_t ca, cb;
+
+      i += utf8_to_unicode (a->l_text, i, la, &ca);
+      j += utf8_to_unicode (b->l_text, j, lb, &cb);
+      ca = unicode_fold (ca);
+      cb = unicode_fold (cb);
+      if (ca != cb)
+        return (ca < cb) ? -1 : 1;
+    }
+  return (la - i) - (lb - j);
+}
+
+/*
+ * Return the first bytes of line lp packed in an unsigned long as they
+ * compare, the first one highest and nothing past the end.  Folding case,
+ * a character that does not fold into ASCII stops them as a byte above
+ * the others, and lines that differ only past it are told apart by the
+ * text.
+ */
+static unsigned long
+lineprefix (line_p lp)
+{
+  unsigned long pfx = 0;
+  bool stop = FALSE;
+  int i = 0;
+  int n;
+
+  for (n = 0; n < (int) sizeof (pfx); n++)
+    {
+      unicode_t c = 0;
+
+      if (stop || i >= llength (lp))
+        ;
+      else if (!sortfold)
+        c = lgetc (lp, i++);
+      else
+        {
+          i += utf8_to_unicode (lp->l_text, i, llength (lp), &c);
+          if ((c = unicode_fold (c)) >= 0x80)
+            {
+              c = 0xFF;
+              stop = TRUE;
+            }
+        }
+      pfx = (pfx << 8) | c;
+    }
+
+  return pfx;
+}
+
+/*
+ * Compare keys a and b.  By text, the prefixes tell most lines apart
+ * without going to their text.
+ */
+static int
+keycmp (const struct sortkey *a, const struct sortkey *b)
+{
+  int r;
+
+  if (sortnum)
+    r = (a->k_u.num < b->k_u.num) ? -1 : (a->k_u.num > b->k_u.num);
+  else if (a->k_u.pfx != b->k_u.pfx)
+    r = (a->k_u.pfx < b->k_u.pfx) ? -1 : 1;
+  else
+    r = linecmp (a->k_line, b->k_line);
+  return sortrev ? -r : r;
+}
+
+/* Merge the na keys at a and the nb at b, both in order, into out.  */
+static void
+merge (const struct sortkey *a, int na, const struct sortkey *b, int nb,
+       struct sortkey *out)
+{
+  while (na > 0 && nb > 0)
+    if (keycmp (b, a) < 0)
+      {
+        *out++ = *b++;
+        nb--;
+      }
+    else
+      {
+        *out++ = *a++;
+        na--;
+      }
+  memcpy (out, a, na * sizeof (*a));
+  memcpy (out + na, b, nb * sizeof (*b));
+}
+
+/* Sort the n keys at a, with as many at tmp for room.  */
+static void
+msort (struct sortkey *a, struct sortkey *tmp, int n)
+{
+  int h, i, j;
+
+  if (n <= SORTRUN)
+    {
+      for (i = 1; i < n; i++)
+        {
+          struct sortkey k = a[i];
+
+          for (j = i; j > 0 && keycmp (&k, &a[j - 1]) < 0; j--)
+            a[j] = a[j - 1];
+          a[j] = k;
+        }
+      return;
+    }
+
+  h = n / 2;
+  msort (a, tmp, h);
+  msort (a + h, tmp + h, n - h);
+  if (keycmp (&a[h], &a[h - 1]) < 0) /* Unless in order already.  */
+    {
+      merge (a, h, a + h, n - h, tmp);
+      memcpy (a, tmp, n * sizeof (*a));
+    }
+}
+
+#if PTHREAD
+struct sortjob
+{
+  struct sortkey *j_keys; /* A slice of the keys.  */
+  struct sortkey *j_tmp;  /* Room for it.  */
+  int j_n;                /* # of keys in it.  */
+};
+
+static void *
+sortslice (void *arg)
+{
+  struct sortjob *jp = arg;
+
+  msort (jp->j_keys, jp->j_tmp, jp->j_n);
+  return NULL;
+}
+#endif
+
+/*
+ * Sort the n keys at a, with as many at tmp for room.  With threads, many
+ * of them are cut into slices, each sorted by a thread of its own if one
+ * can be started, and the slices merged.
+ */
+static void
+sortkeys (struct sortkey *a, struct sortkey *tmp, int n)
+{
+#if PTHREAD
+  struct sortjob job[SORTTHREADS];
+  pthread_t thr[SORTTHREADS];
+  bool started[SORTTHREADS];
+  int nslices = n / SORTSLICE;
+  int i, w;
+
+  if (nslices > SORTTHREADS)
+    nslices = SORTTHREADS;
+  if (nslices > 1)
+    {
+      for (i = 0; i < nslices; i++)
+        {
+          int lo = (int) ((long) n * i / nslices);
+
+          job[i].j_keys = a + lo;
+          job[i].j_tmp = tmp + lo;
+          job[i].j_n = (int) ((long) n * (i + 1) / nslices) - lo;
+          started[i] = i > 0 && pthread_create (&thr[i], NULL, sortslice,
+                                                &job[i]) == 0;
+        }
+
+      for (i = 0; i < nslices; i++)
+        if (started[i])
+          pthread_join (thr[i], NULL);
+        else
+          sortslice (&job[i]); /* This thread's own, or one not started.  */
+
+      /* Merge the slices two by two, then the pairs, and so on.  */
+      for (w = 1; w < nslices; w *= 2)
+        for (i = 0; i + w < nslices; i += 2 * w)
+          {
+            struct sortjob *l = &job[i];
+            struct sortjob *r = &job[i + w];
+
+            merge (l->j_keys, l->j_n, r->j_keys, r->j_n, l->j_tmp);
+            l->j_n += r->j_n;
+            memcpy (l->j_keys, l->j_tmp, l->j_n * sizeof (*a));
+          }
+      return;
+    }
+#endif
+  msort (a, tmp, n);
+}
+
+/*
+ * Gather the lines of the region, from the one it starts in to the one
+ * it ends in, into a new array at *plines, and their number in *pn.
+ */
+static int
+getlines (line_p **plines, int *pn)
+{
+  struct region region;
+  line_p lp;
+  line_p *lines = NULL;
+  long size; /* # of bytes of the region left from the start of lp */
+  int max = 0;
+  int n = 0;
+  int status;
+
+  if ((status = getregion (&region)) != TRUE)
+    return status;
+
+  size = region.r_offset + region.r_size;
+  for (lp = region.r_linep;; lp = lforw (lp))
+    {
+      if (n == max)
+        {
+          line_p *more;
+
+          max = (max == 0) ? 64 : 2 * max;
+          if ((more = realloc (lines, max * sizeof (*lines))) == NULL)
+            {
+              free (lines);
+              mloutstr ("%Memory exhausted");
+              return FALSE;
+            }
+          lines = more;
+        }
+      if (lp == curbp->b_linep)
+        break;
+
+      lines[n++] = lp;
+      if ((size -= llength (lp) + 1) <= 0)
+        break;
+    }
+
+  *plines = lines;
+  *pn = n;
+  return TRUE;
+}
+
+/*
+ * Link the n lines at order, the lines at lines moved about, in their
+ * place.  The places on a line go to the one that takes its place.
+ */
+static void
+relink (line_p *lines, line_p *order, int n)
+{
+  line_p lp = lback (lines[0]);
+  line_p after = lforw (lines[n - 1]);
+  struct bpos *pp;
+  int i;
+
+  undlines (lines[0], lines[n - 1]);
+  jrnlines (lines[0], order, n);
+  lchange (WFHARD);
+
+  for (pp = curbp->b_pos; pp != NULL; pp = pp->p_next)
+    for (i = 0; i < n; i++)
+      if (*pp->p_lpp == lines[i])
+        {
+          *pp->p_lpp = order[i];
+          if (pp->p_offp != NULL && *pp->p_offp > llength (order[i]))
+            *pp->p_offp = llength (order[i]);
+          break;
+        }
+
+  for (i = 0; i < n; i++)
+    {
+      lp->l_fp = order[i];
+      order[i]->l_bp = lp;
+      lp = order[i];
+    }
+  lp->l_fp = after;
+  after->l_bp = lp;
+
+  /* Lex them again, from the line above or, at the top, from scratch.  */
+  if (lback (order[0]) == curbp->b_linep)
+    order[0]->l_lexst = LXUNKNOWN;
+  lexdirty (lback (order[0]));
+  for (i = 0; i < n; i++)
+    lexdirty (order[i]);
+}
+
+/*
+ * Sort the lines of the region.  With an argument other than 1 or -1, as
+ * from C-U, sort them by the numbers they start with; with a negative
+ * one, in reverse order.  Undone as one.
+ *
+ * int f, n;    default flag and numeric argument
+ */
+int
+sortregion (bool f, int n)
+{
+  struct sortkey *keys;
+  line_p *lines;
+  line_p *order;
+  int nlines;
+  int i;
+  int status;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+  if ((status = getlines (&lines, &nlines)) != TRUE)
+    return status;
+
+  keys = malloc ((2 * nlines + 1) * sizeof (*keys));
+  order = malloc ((nlines + 1) * sizeof (*order));
+  if (keys == NULL || order == NULL)
+    {
+      free (keys);
+      free (order);
+      free (lines);
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+
+  sortnum = f && (n > 1 || n < -1);
+  sortfold = (curbp->b_mode & MDEXACT) == 0;
+  sortrev = n < 0;
+  for (i = 0; i < nlines; i++)
+    {
+      keys[i].k_line = lines[i];
+      if (sortnum)
+        keys[i].k_u.num = linenum (lines[i]);
+      else
+        keys[i].k_u.pfx = lineprefix (lines[i]);
+    }
+  sortkeys (keys, keys + nlines, nlines);
+
+  for (i = 0; i < nlines; i++)
+    order[i] = keys[i].k_line;
+  for (i = 0; i < nlines && order[i] == lines[i]; i++)
+    ;
+  if (i < nlines)
+    relink (lines, order, nlines);
+
+  free (keys);
+  free (order);
+  free (lines);
+  thisflag &= ~CFCPCN; /* Flag that this resets the goal column.  */
+  return TRUE;
+}
+
+/*
+ * Drop each line of the region that repeats the line before it.  The
+ * places on a dropped line go to the start of the next one.  Undone as
+ * one.
+ *
+ * int f, n;    ignored numeric arguments
+ */
+int
+uniqregion (bool f, int n)
+{
+  line_p *lines;
+  line_p kept;
+  int nlines;
+  int ndrop = 0;
+  int i;
+  int status;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+  if ((status = getlines (&lines, &nlines)) != TRUE)
+    return status;
+
+  sortfold = (curbp->b_mode & MDEXACT) == 0;
+  kept = (nlines > 0) ? lines[0] : NULL;
+  for (i = 1; i < nlines; i++)
+    if (linecmp (lines[i], kept) != 0)
+      kept = lines[i];
+    else
+      {
+        if (ndrop++ == 0)
+          {
+            undlines (lines[0], lines[nlines - 1]);
+            lchange (WFHARD);
+          }
+        jrndelline (lines[i]);
+        lexdirty (kept); /* The line after it is another.  */
+        lfree (curbp, lines[i]);
+      }
+
+  free (lines);
+  mloutfmt ("(Dropped %d line%s)", ndrop, &"s"[ndrop == 1]);
+  thisflag &= ~CFCPCN; /* Flag that this resets the goal column.  */
+  return TRUE;
+}
+
+/* end of sort.c */
@@ -0,0 +1,9 @@
+#ifndef _SORT_H_
+#define _SORT_H_
+
+#include "defines.h"
+
+int sortregion (bool f, int n);
+int uniqregion (bool f, int n);
+
+#endif
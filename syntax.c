@@ -0,0 +1,935 @@
+/* syntax.c -- implements syntax.h */
+#include "syntax.h"
+
+/*  syntax.c
+ *
+ *      The routines in this file colour the text of a buffer by the rules
+ *      of a syntax, defined from macro files with the commands at the end.
+ *      A rule set only knows about line comments, one kind of block comment,
+ *      strings, numbers and keywords, which is enough for C and most
+ *      configuration files.
+ *
+ *      Only comments and strings can carry over to the next line, so the
+ *      lexer state at the start of a line is all that needs keeping.  It
+ *      lives in the line itself.  The edited lines of a buffer are queued,
+ *      and before the next redisplay they are lexed again, going on to the
+ *      lines below only until the state they start with is the same as it
+ *      was.  Typing in a line therefore costs one line, whatever the size of
+ *      the file, and opening a comment costs the lines it covers.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "fence.h"
+#include "input.h"
+#include "mlout.h"
+#include "terminal.h"
+#include "util.h"
+#include "window.h"
+
+#define LXCOMMENT 1 /* Inside a block comment.  */
+#define LXSTRING  2 /* Inside a string, plus the index of its delimiter.  */
+
+#define NSXHASH  64 /* # of keyword hash chains.  */
+#define NSXDELIM 8  /* # of string delimiters.  */
+#define NSXDLEN  8  /* # of bytes of a comment delimiter.  */
+
+/* A keyword and its attributes.  */
+struct sxword
+{
+  struct sxword *w_next; /* Next on the hash chain.  */
+  int w_attr;            /* Attributes.  */
+  int w_len;             /* Length of the word.  */
+  char w_text[1];        /* The word itself.  */
+};
+
+struct syntax
+{
+  struct syntax *sx_next;    /* Next defined syntax.  */
+  bname_t sx_name;           /* Name for set-syntax.  */
+  char sx_suffixes[NSTRING]; /* File suffixes, blank separated.  */
+  char sx_lcom[NSXDLEN];     /* Starts of line comments, blank separated.  */
+  char sx_bcbeg[NSXDLEN];    /* Start of a block comment.  */
+  char sx_bcend[NSXDLEN];    /* End of a block comment.  */
+  char sx_delims[NSXDELIM + 1]; /* String delimiters.  */
+  int sx_lcattr;             /* Attributes of line comments.  */
+  int sx_bcattr;             /* Attributes of block comments.  */
+  int sx_strattr;            /* Attributes of strings.  */
+  int sx_numattr;            /* Attributes of numbers.  */
+  struct sxword *sx_words[NSXHASH]; /* Keywords.  */
+};
+
+static struct syntax *sxhead; /* Defined syntaxes.  */
+static struct syntax *sxcur;  /* The one the rule commands add to.  */
+
+/*
+ * The states of the lexer inside a few long lines are kept as checkpoints,
+ * pairs of the offset of a token and the state it starts in, every LXSTEP
+ * bytes or so.  A row shown from far into such a line is then lexed from
+ * the nearest checkpoint on, as the columns are.  An edit drops the ones
+ * after it.
+ */
+#define NLXCACHE 4   /* # of lines with checkpoints.  */
+#define LXSTEP   256 /* # of bytes between checkpoints.  */
+
+struct lexpoint
+{
+  int p_offs; /* Byte offset of a token.  */
+  int p_st;   /* The state it starts in.  */
+};
+
+static struct lexcache
+{
+  line_p x_line;         /* The line, NULL if unused.  */
+  struct syntax *x_sx;   /* Syntax they were worked out with.  */
+  int x_n;               /* # of checkpoints, the first is at 0.  */
+  int x_max;             /* # allocated.  */
+  struct lexpoint *x_pt; /* The checkpoints.  */
+  unsigned int x_use;    /* When last used.  */
+} lexcache[NLXCACHE];
+
+static unsigned int lexuse;
+
+static const char *attrname[] =
+{
+  "black", "red", "green", "yellow", "blue", "magenta", "cyan", "white",
+  "bold", "underline", "reverse", NULL
+};
+
+#define sxwordc(c) (isalnum (c) || (c) == '_' || (c) >= 0x80)
+
+static unsigned int
+sxhash (const char *s, int len)
+{
+  unsigned int h = 0;
+
+  while (len-- > 0)
+    h = h * 31 + (*s++ & 0xFF);
+  return h % NSXHASH;
+}
+
+/*
+ * Attributes of keyword s of length len, 0 if it is not one.
+ */
+static int
+sxlookup (struct syntax *sx, const char *s, int len)
+{
+  struct sxword *wp;
+
+  for (wp = sx->sx_words[sxhash (s, len)]; wp != NULL; wp = wp->w_next)
+    if (wp->w_len == len && memcmp (wp->w_text, s, len) == 0)
+      return wp->w_attr;
+  return 0;
+}
+
+/* Give bytes from to to the attribute attr, in attrs from byte base on.  */
+static void
+sxfill (int *attrs, int base, int from, int to, int attr)
+{
+  if (attrs != NULL)
+    while (from < to)
+      attrs[from++ - base] = attr;
+}
+
+static int
+sxat (const char *s, int i, int len, const char *delim)
+{
+  int dlen = strlen (delim);
+
+  return dlen != 0 && i + dlen <= len && memcmp (s + i, delim, dlen) == 0
+         ? dlen : 0;
+}
+
+/*
+ * Length of the first of the blank separated delimiters in list found at
+ * byte i of s, 0 if none is.
+ */
+static int
+sxatany (const char *s, int i, int len, const char *list)
+{
+  char delim[NSXDLEN];
+  int dlen;
+
+  for (list += strspn (list, " \t"); *list != '\0';
+       list += strspn (list, " \t"))
+    {
+      dlen = strcspn (list, " \t");
+      memcpy (delim, list, dlen);
+      delim[dlen] = '\0';
+      if (sxat (s, i, len, delim) != 0)
+        return dlen;
+      list += dlen;
+    }
+  return 0;
+}
+
+/*
+ * Append a checkpoint for offset i in state st to xp, unless it is out of
+ * memory.
+ */
+static void
+lexmark (struct lexcache *xp, int i, int st)
+{
+  if (xp->x_n == xp->x_max)
+    {
+      int nmax = xp->x_max ? 2 * xp->x_max : 16;
+      struct lexpoint *newpt = realloc (xp->x_pt, nmax * sizeof *newpt);
+
+      if (newpt == NULL)
+        return;
+      xp->x_pt = newpt;
+      xp->x_max = nmax;
+    }
+  xp->x_pt[xp->x_n].p_offs = i;
+  xp->x_pt[xp->x_n].p_st = st;
+  xp->x_n++;
+}
+
+/*
+ * Lex bytes from to len of line lp, from starting a token in state st,
+ * storing their attributes in attrs, from that of byte from on, unless it
+ * is NULL.  Return the state
+ * the next line starts in, if len is the whole line.  Checkpoints are
+ * added to xp unless it is NULL.
+ */
+static int
+sxlex (struct syntax *sx, line_p lp, int from, int len, int st, int *attrs,
+       struct lexcache *xp)
+{
+  const char *s = lp->l_text;
+  int i = from, j, k, stop;
+  bool cont = FALSE; /* A string goes on past the end of the line.  */
+
+  while (i < len)
+    {
+      int c;
+
+      /* A delimiter cut short by len could be taken for other tokens.  */
+      if (xp != NULL && i >= xp->x_pt[xp->x_n - 1].p_offs + LXSTEP
+          && (len == llength (lp) || i + NSXDLEN <= len))
+        lexmark (xp, i, st);
+
+      /* Comments and strings are taken a step at a time, so that a long
+       * one gets checkpoints too.
+       */
+      stop = (len - i > LXSTEP) ? i + LXSTEP : len;
+      if (st == LXCOMMENT)
+        {
+          for (j = i; j < stop; j++)
+            if ((k = sxat (s, j, len, sx->sx_bcend)) != 0)
+              {
+                j += k;
+                st = 0;
+                break;
+              }
+          sxfill (attrs, from, i, j, sx->sx_bcattr);
+          i = j;
+          continue;
+        }
+
+      if (st >= LXSTRING)
+        {
+          c = sx->sx_delims[st - LXSTRING];
+          for (j = i; j < stop && (s[j] & 0xFF) != c; j++)
+            if (s[j] == '\\')
+              {
+                if (j + 1 == len)
+                  cont = TRUE;
+                else
+                  j++;
+              }
+          if (j < len && (s[j] & 0xFF) == c)
+            {
+              j++;
+              st = 0;
+            }
+          sxfill (attrs, from, i, j, sx->sx_strattr);
+          i = j;
+          continue;
+        }
+
+      c = s[i] & 0xFF;
+      if ((k = sxat (s, i, len, sx->sx_bcbeg)) != 0)
+        {
+          sxfill (attrs, from, i, i + k, sx->sx_bcattr);
+          i += k;
+          st = LXCOMMENT;
+        }
+      else if (sxatany (s, i, len, sx->sx_lcom) != 0)
+        {
+          sxfill (attrs, from, i, len, sx->sx_lcattr);
+          i = len;
+        }
+      else if (c != 0 && strchr (sx->sx_delims, c) != NULL)
+        {
+          sxfill (attrs, from, i, i + 1, sx->sx_strattr);
+          i++;
+          st = LXSTRING + (strchr (sx->sx_delims, c) - sx->sx_delims);
+        }
+      else if (sxwordc (c))
+        {
+          int attr;
+
+          for (j = i + 1; j < len; j++)
+            {
+              int d = s[j] & 0xFF;
+
+              if (!sxwordc (d) && !(d == '.' && isdigit (c)))
+                break;
+            }
+          if (isdigit (c))
+            attr = sx->sx_numattr;
+          else
+            attr = sxlookup (sx, s + i, j - i);
+          sxfill (attrs, from, i, j, attr);
+          i = j;
+        }
+      else
+        {
+          int attr = 0;
+
+          /* Keywords may start with one other character, as #include.  */
+          for (j = i + 1; j < len && sxwordc (s[j] & 0xFF); j++)
+            ;
+          if (j > i + 1)
+            attr = sxlookup (sx, s + i, j - i);
+          if (attr == 0)
+            j = i + 1;
+          sxfill (attrs, from, i, j, attr);
+          i = j;
+        }
+    }
+
+  if (st >= LXSTRING && !cont)
+    st = 0;
+  return st;
+}
+
+/*
+ * Return the state line lp of buffer bp starts in, lexing it from the
+ * nearest line above whose state is known.
+ */
+static int
+lexstart (buffer_p bp, line_p lp)
+{
+  line_p q = lp;
+  int st;
+
+  while ((q->l_lexst & LXSTATE) == LXUNKNOWN)
+    {
+      if (lback (q) == bp->b_linep)
+        {
+          q->l_lexst &= LXDIRTY;
+          break;
+        }
+      q = lback (q);
+    }
+
+  st = q->l_lexst & LXSTATE;
+  while (q != lp)
+    {
+      st = sxlex (bp->b_syntax, q, 0, llength (q), st, NULL, NULL);
+      q = lforw (q);
+      q->l_lexst = (q->l_lexst & LXDIRTY) | st;
+    }
+  return st;
+}
+
+/*
+ * Queue line lp of the current buffer for lexing, its text has changed.
+ */
+void
+lexdirty (line_p lp)
+{
+  buffer_p bp = curbp;
+
+  fencedirty (lp); /* Its fences are to be counted again as well.  */
+  if (bp->b_syntax == NULL || lp == bp->b_linep || (lp->l_lexst & LXDIRTY))
+    return;
+
+  lp->l_lexst |= LXDIRTY;
+  if (bp->b_nlexdirty >= NLEXDIRTY)
+    bp->b_nlexdirty = -1; /* Too many, lex the whole buffer.  */
+  else if (bp->b_nlexdirty >= 0)
+    bp->b_lexdirty[bp->b_nlexdirty++] = lp;
+}
+
+/*
+ * Line lp is about to be freed, drop it from the queues.
+ */
+void
+lexforget (line_p lp)
+{
+  buffer_p bp;
+  int i;
+
+  for (i = 0; i < NLXCACHE; i++)
+    if (lexcache[i].x_line == lp)
+      lexcache[i].x_line = NULL;
+
+  if ((lp->l_lexst & LXDIRTY) == 0)
+    return;
+
+  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+    for (i = 0; i < bp->b_nlexdirty; i++)
+      if (bp->b_lexdirty[i] == lp)
+        bp->b_lexdirty[i--] = bp->b_lexdirty[--bp->b_nlexdirty];
+}
+
+/*
+ * Forget the state of every line of buffer bp, after its syntax changed.
+ */
+void
+lexreset (buffer_p bp)
+{
+  line_p lp = bp->b_linep;
+  window_p wp;
+
+  lexcut (NULL, -1); /* The rules may have changed as well.  */
+  do
+    {
+      lp->l_lexst = LXUNKNOWN;
+      lp = lforw (lp);
+    }
+  while (lp != bp->b_linep);
+  bp->b_nlexdirty = 0;
+
+  for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+    if (wp->w_bufp == bp)
+      wp->w_flag |= WFHARD;
+}
+
+/*
+ * Lex the queued lines of buffer bp again, and the lines below them until
+ * their state settles.  Return TRUE if the state of some line changed, so
+ * that the whole of the windows of the buffer need redrawing.
+ */
+int
+lexsync (buffer_p bp)
+{
+  struct syntax *sx = bp->b_syntax;
+  line_p lp, next;
+  int i, st, old;
+  int changed = FALSE;
+
+  if (sx == NULL || bp->b_nlexdirty == 0)
+    return FALSE;
+
+  if (bp->b_nlexdirty < 0)
+    {
+      /* Walk from the top to the first line never lexed.  The states
+       * below it may be stale, forget them.
+       */
+      bool stop = FALSE;
+
+      st = 0;
+      for (lp = lforw (bp->b_linep); lp != bp->b_linep; lp = lforw (lp))
+        {
+          old = lp->l_lexst;
+          if (!stop && old == LXUNKNOWN)
+            stop = TRUE;
+          if (stop)
+            {
+              lp->l_lexst = LXUNKNOWN;
+              continue;
+            }
+          if ((old & LXSTATE) != st)
+            changed = TRUE;
+          lp->l_lexst = st;
+          st = sxlex (sx, lp, 0, llength (lp), st, NULL, NULL);
+        }
+      bp->b_nlexdirty = 0;
+      return changed;
+    }
+
+  for (i = 0; i < bp->b_nlexdirty; i++)
+    {
+      lp = bp->b_lexdirty[i];
+      if ((lp->l_lexst & LXDIRTY) == 0)
+        continue; /* Done on the way down from another one.  */
+
+      lp->l_lexst &= LXSTATE;
+      st = lexstart (bp, lp);
+      while ((next = lforw (lp)) != bp->b_linep)
+        {
+          st = sxlex (sx, lp, 0, llength (lp), st, NULL, NULL);
+          old = next->l_lexst;
+          if (old == LXUNKNOWN || old == st)
+            break; /* Never lexed, or settled.  */
+
+          if ((old & LXSTATE) != st)
+            changed = TRUE;
+          next->l_lexst = st;
+          lp = next;
+        }
+    }
+  bp->b_nlexdirty = 0;
+  return changed;
+}
+
+/*
+ * Drop the checkpoints of line lp past byte offs, the line is about to
+ * change there.  NULL for lp drops those of all lines.
+ */
+void
+lexcut (line_p lp, int offs)
+{
+  struct lexcache *xp;
+
+  for (xp = lexcache; xp < &lexcache[NLXCACHE]; xp++)
+    if (lp == NULL || xp->x_line == lp)
+      while (xp->x_n > 1 && xp->x_pt[xp->x_n - 1].p_offs > offs)
+        xp->x_n--;
+}
+
+/*
+ * Return the checkpoints of line lp of buffer bp, which starts in state
+ * st, or NULL if it is too short to be worth a slot.
+ */
+static struct lexcache *
+lexslot (buffer_p bp, line_p lp, int st)
+{
+  struct lexcache *xp, *lru = lexcache;
+
+  for (xp = lexcache; xp < &lexcache[NLXCACHE]; xp++)
+    {
+      if (xp->x_line == lp)
+        break;
+      if (xp->x_use < lru->x_use)
+        lru = xp;
+    }
+
+  if (xp == &lexcache[NLXCACHE])
+    {
+      if (llength (lp) < LXSTEP)
+        return NULL;
+      xp = lru;
+      xp->x_line = lp;
+      xp->x_n = 0;
+    }
+
+  if (xp->x_n == 0 || xp->x_sx != bp->b_syntax || xp->x_pt[0].p_st != st)
+    {
+      xp->x_n = 0;
+      xp->x_sx = bp->b_syntax;
+      lexmark (xp, 0, st);
+      if (xp->x_n == 0)
+        {
+          xp->x_line = NULL;
+          return NULL;
+        }
+    }
+  xp->x_use = ++lexuse;
+
+  /* Drop checkpoints a shortening left behind.  */
+  while (xp->x_n > 1 && xp->x_pt[xp->x_n - 1].p_offs > llength (lp))
+    xp->x_n--;
+  return xp;
+}
+
+/*
+ * Return the attributes of the bytes of line lp of buffer bp from byte
+ * from up to byte end, or NULL if it has no syntax.  They are worked out
+ * from the last checkpoint before them, whose offset is put in *pbase:
+ * the attribute of byte i is at i - *pbase.  Checkpoints missing up to
+ * from are laid first, so that the attributes kept are for about a row.
+ */
+int *
+lexline (buffer_p bp, line_p lp, int from, int end, int *pbase)
+{
+  static int *attrs = NULL;
+  static int nattrs = 0;
+  struct lexcache *xp;
+  int st;
+
+  if (bp->b_syntax == NULL)
+    return NULL;
+
+  if (end > llength (lp))
+    end = llength (lp);
+  st = lexstart (bp, lp);
+  xp = lexslot (bp, lp, st);
+  if (xp == NULL)
+    from = 0;
+  else
+    {
+      struct lexpoint *pt = &xp->x_pt[xp->x_n - 1];
+      int lo = 0, hi;
+
+      /* Lay the checkpoints up to from first, keeping no attributes.  */
+      if (pt->p_offs + LXSTEP < from)
+        sxlex (bp->b_syntax, lp, pt->p_offs, from, pt->p_st, NULL, xp);
+
+      /* Find the last checkpoint not past from.  */
+      hi = xp->x_n - 1;
+      while (lo < hi)
+        {
+          int mid = (lo + hi + 1) / 2;
+
+          if (xp->x_pt[mid].p_offs <= from)
+            lo = mid;
+          else
+            hi = mid - 1;
+        }
+      from = xp->x_pt[lo].p_offs;
+      st = xp->x_pt[lo].p_st;
+    }
+
+  if (end - from > nattrs)
+    {
+      int *newattrs = realloc (attrs, (end - from + 64) * sizeof *attrs);
+
+      if (newattrs == NULL)
+        return NULL;
+      attrs = newattrs;
+      nattrs = end - from + 64;
+    }
+
+  sxlex (bp->b_syntax, lp, from, end, st, attrs, xp);
+  *pbase = from;
+  return attrs;
+}
+
+/*
+ * Give buffer bp the syntax whose suffixes match file name fname, if any.
+ */
+void
+sxattach (buffer_p bp, const char *fname)
+{
+  struct syntax *sx;
+  const char *base, *sfx;
+
+  base = strrchr (fname, '/');
+  base = (base == NULL) ? fname : base + 1;
+  sfx = strrchr (base, '.');
+  sfx = (sfx == NULL) ? base : sfx + 1;
+
+  for (sx = sxhead; sx != NULL; sx = sx->sx_next)
+    {
+      const char *cp = sx->sx_suffixes;
+
+      while (*cp != '\0')
+        {
+          int len = strcspn (cp, " \t");
+
+          if (len != 0 && ((strncmp (cp, sfx, len) == 0 && sfx[len] == '\0')
+                           || (strncmp (cp, base, len) == 0
+                               && base[len] == '\0')))
+            goto found;
+          cp += len;
+          cp += strspn (cp, " \t");
+        }
+    }
+
+found:
+  bp->b_syntax = sx;
+  lexreset (bp);
+}
+
+/*
+ * Relex the buffers using syntax sx, its rules changed.
+ */
+static void
+sxchanged (struct syntax *sx)
+{
+  buffer_p bp;
+
+  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+    if (bp->b_syntax == sx)
+      lexreset (bp);
+}
+
+static struct syntax *
+sxfind (const char *name)
+{
+  struct syntax *sx;
+
+  for (sx = sxhead; sx != NULL; sx = sx->sx_next)
+    if (strcmp (sx->sx_name, name) == 0)
+      break;
+  return sx;
+}
+
+/*
+ * Parse the blank separated attribute names in s.
+ */
+static int
+sxattr (const char *s, int *pattr)
+{
+  int attr = 0;
+
+  for (s += strspn (s, " \t"); *s != '\0'; s += strspn (s, " \t"))
+    {
+      int i, len = strcspn (s, " \t");
+
+      for (i = 0; attrname[i] != NULL; i++)
+        if (strncmp (attrname[i], s, len) == 0 && attrname[i][len] == '\0')
+          break;
+
+      if (i < 8)
+        attr = (attr & ~ATFGMASK) | ATFG (i);
+      else if (attrname[i] == NULL)
+        {
+          mloutfmt ("%%No such attribute: %s", s);
+          return FALSE;
+        }
+      else
+        attr |= (i == 8) ? ATBOLD : (i == 9) ? ATUNDER : ATREV;
+      s += len;
+    }
+
+  *pattr = attr;
+  return TRUE;
+}
+
+/*
+ * Read the attributes argument of a rule command.
+ */
+static int
+sxgetattr (int *pattr)
+{
+  char *buf;
+  int status;
+
+  if (sxcur == NULL)
+    {
+      mloutstr ("%No syntax being defined");
+      return FALSE;
+    }
+
+  status = newmlarg (&buf, "Attributes: ", 0);
+  if (status == TRUE)
+    {
+      status = sxattr (buf, pattr);
+      free (buf);
+    }
+  return status;
+}
+
+/*
+ * Start the definition of a syntax, used for the files with the given
+ * suffixes.  Defining it again replaces its rules.
+ */
+int
+definesyntax (bool f, int n)
+{
+  struct syntax *sx;
+  char *name, *sfx;
+  int status, i;
+
+  status = newmlarg (&name, "Syntax name: ", sizeof (bname_t));
+  if (status != TRUE)
+    return status;
+
+  status = newmlarg (&sfx, "File suffixes: ", 0);
+  if (status != TRUE)
+    {
+      free (name);
+      return status;
+    }
+
+  sx = sxfind (name);
+  if (sx == NULL)
+    {
+      sx = malloc (sizeof *sx);
+      if (sx == NULL)
+        {
+          free (name);
+          free (sfx);
+          return FALSE;
+        }
+      for (i = 0; i < NSXHASH; i++)
+        sx->sx_words[i] = NULL;
+      sx->sx_next = sxhead;
+      sxhead = sx;
+    }
+
+  for (i = 0; i < NSXHASH; i++)
+    while (sx->sx_words[i] != NULL)
+      {
+        struct sxword *wp = sx->sx_words[i];
+
+        sx->sx_words[i] = wp->w_next;
+        free (wp);
+      }
+
+  strscpy (sx->sx_name, name, sizeof sx->sx_name);
+  strscpy (sx->sx_suffixes, sfx, sizeof sx->sx_suffixes);
+  sx->sx_lcom[0] = sx->sx_bcbeg[0] = sx->sx_bcend[0] = '\0';
+  sx->sx_delims[0] = '\0';
+  sx->sx_lcattr = sx->sx_bcattr = sx->sx_strattr = sx->sx_numattr = 0;
+  free (name);
+  free (sfx);
+
+  sxcur = sx;
+  sxchanged (sx);
+  return TRUE;
+}
+
+/*
+ * Highlight the current buffer with the named syntax, "none" for no
+ * highlighting.
+ */
+int
+setsyntax (bool f, int n)
+{
+  struct syntax *sx = NULL;
+  char *name;
+  int status;
+
+  status = newmlarg (&name, "Syntax: ", sizeof (bname_t));
+  if (status != TRUE)
+    return status;
+
+  if (strcmp (name, "none") != 0 && (sx = sxfind (name)) == NULL)
+    {
+      mloutfmt ("%%No such syntax: %s", name);
+      free (name);
+      return FALSE;
+    }
+
+  free (name);
+  curbp->b_syntax = sx;
+  lexreset (curbp);
+  return TRUE;
+}
+
+/*
+ * Add the blank separated keywords of the second argument to the syntax
+ * being defined, with the attributes of the first.
+ */
+int
+syntaxkeywords (bool f, int n)
+{
+  char *buf, *cp;
+  int status, attr;
+
+  if ((status = sxgetattr (&attr)) != TRUE)
+    return status;
+
+  status = newmlarg (&buf, "Keywords: ", 0);
+  if (status != TRUE)
+    return status;
+
+  for (cp = buf + strspn (buf, " \t"); *cp != '\0'; cp += strspn (cp, " \t"))
+    {
+      int len = strcspn (cp, " \t");
+      unsigned int h = sxhash (cp, len);
+      struct sxword *wp = malloc (sizeof *wp + len);
+
+      if (wp == NULL)
+        {
+          status = FALSE;
+          break;
+        }
+      memcpy (wp->w_text, cp, len);
+      wp->w_text[len] = '\0';
+      wp->w_len = len;
+      wp->w_attr = attr;
+      wp->w_next = sxcur->sx_words[h];
+      sxcur->sx_words[h] = wp;
+      cp += len;
+    }
+
+  free (buf);
+  sxchanged (sxcur);
+  return status;
+}
+
+/*
+ * Set the starts of the line comments of the syntax being defined, more
+ * than one are separated by blanks.
+ */
+int
+syntaxlinecomment (bool f, int n)
+{
+  char *buf;
+  int status, attr;
+
+  if ((status = sxgetattr (&attr)) != TRUE)
+    return status;
+
+  status = newmlarg (&buf, "Comment start: ", NSXDLEN);
+  if (status != TRUE)
+    return status;
+
+  strscpy (sxcur->sx_lcom, buf, sizeof sxcur->sx_lcom);
+  sxcur->sx_lcattr = attr;
+  free (buf);
+  sxchanged (sxcur);
+  return TRUE;
+}
+
+/*
+ * Set the start and end of the block comments of the syntax being defined.
+ */
+int
+syntaxblockcomment (bool f, int n)
+{
+  char *beg, *end;
+  int status, attr;
+
+  if ((status = sxgetattr (&attr)) != TRUE)
+    return status;
+
+  status = newmlarg (&beg, "Comment start: ", NSXDLEN);
+  if (status != TRUE)
+    return status;
+
+  status = newmlarg (&end, "Comment end: ", NSXDLEN);
+  if (status != TRUE)
+    {
+      free (beg);
+      return status;
+    }
+
+  strscpy (sxcur->sx_bcbeg, beg, sizeof sxcur->sx_bcbeg);
+  strscpy (sxcur->sx_bcend, end, sizeof sxcur->sx_bcend);
+  sxcur->sx_bcattr = attr;
+  free (beg);
+  free (end);
+  sxchanged (sxcur);
+  return TRUE;
+}
+
+/*
+ * Set the string delimiters of the syntax being defined.
+ */
+int
+syntaxstrings (bool f, int n)
+{
+  char *buf;
+  int status, attr;
+
+  if ((status = sxgetattr (&attr)) != TRUE)
+    return status;
+
+  status = newmlarg (&buf, "Delimiters: ", NSXDELIM + 1);
+  if (status != TRUE)
+    return status;
+
+  strscpy (sxcur->sx_delims, buf, sizeof sxcur->sx_delims);
+  sxcur->sx_strattr = attr;
+  free (buf);
+  sxchanged (sxcur);
+  return TRUE;
+}
+
+/*
+ * Set the attributes of the numbers of the syntax being defined.
+ */
+int
+syntaxnumbers (bool f, int n)
+{
+  int status, attr;
+
+  if ((status = sxgetattr (&attr)) != TRUE)
+    return status;
+
+  sxcur->sx_numattr = attr;
+  sxchanged (sxcur);
+  return TRUE;
+}
@@ -0,0 +1,36 @@
+#ifndef _SYNTAX_H_
+#define _SYNTAX_H_
+
+#include "buffer.h"
+#include "line.h"
+#include "retcode.h"
+
+/*
+ * The state of the lexer at the start of a line is kept in its l_lexst.
+ * LXUNKNOWN is for a line that has not been lexed yet, and LXDIRTY marks
+ * a line whose text changed since the state of the next line was worked
+ * out from it.
+ */
+#define LXSTATE   0x7FFF /* Mask of the state itself.  */
+#define LXUNKNOWN 0x7FFF /* Not lexed yet.  */
+#define LXDIRTY   0x8000 /* Changed since lexed.  */
+
+#define lexcopy(dst, src) ((dst)->l_lexst = (src)->l_lexst & LXSTATE)
+
+void lexdirty (line_p lp);
+void lexforget (line_p lp);
+void lexreset (buffer_p bp);
+int lexsync (buffer_p bp);
+void lexcut (line_p lp, int offs);
+int *lexline (buffer_p bp, line_p lp, int from, int end, int *pbase);
+void sxattach (buffer_p bp, const char *fname);
+
+int definesyntax (bool f, int n);
+int setsyntax (bool f, int n);
+int syntaxkeywords (bool f, int n);
+int syntaxlinecomment (bool f, int n);
+int syntaxblockcomment (bool f, int n);
+int syntaxstrings (bool f, int n);
+int syntaxnumbers (bool f, int n);
+
+#endif
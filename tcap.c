@@ -52,6 +52,8 @@ static void tcapeeol (void);
 static void tcapeeop (void);
 static void tcapbeep (void);
 static void tcaprev (int);
+static void tcapattr (int);
+static void tcapoff (char *str, int attr);
 static int  tcapcres (char *);
 static void tcapscrollregion (int top, int bot);
 static void putpad (char *str);
@@ -70,9 +72,11 @@ static void tcapscroll_reg (int from, int to, int nlines);
 static void tcapscroll_delins (int from, int to, int nlines);
 # endif
 
-# define TCAPSLEN 315
+# define TCAPSLEN 640
 static char tcapbuf[TCAPSLEN];
 static char *UP, PC, *CM, *CE, *CL, *SO, *SE;
+static char *ME, *MD, *US, *UE, *AF, *AB, *OP;
+static int tcattr = -1; /* Attributes in effect, -1 if unknown.  */
 
 # if PKCODE
 static char *TI, *TE;
@@ -117,6 +121,7 @@ struct terminal term =
   tcapeeop,
   tcapbeep,
   tcaprev,
+  tcapattr,
   tcapcres
 # if COLOR
   , tcapfcol
@@ -187,6 +192,13 @@ tcapopen (void)
       SO = tgetstr ("so", &p);
       if (SO != NULL)
         revexist = TRUE;
+      ME = tgetstr ("me", &p); /* Character attributes.  */
+      MD = tgetstr ("md", &p);
+      US = tgetstr ("us", &p);
+      UE = tgetstr ("ue", &p);
+      AF = tgetstr ("AF", &p);
+      AB = tgetstr ("AB", &p);
+      OP = tgetstr ("op", &p);
 # if PKCODE
       if (tgetnum ("sg") > 0)
         {
@@ -257,6 +269,7 @@ tcapkopen (void)
   ttflush ();
   ttrow = 999;
   ttcol = 999;
+  tcattr = -1;
   sgarbf = TRUE;
 # endif
   strcpy (sres, "NORMAL");
@@ -297,13 +310,88 @@ tcapeeop (void)
 static void
 tcaprev (int state)
 {
-  if (state)
+  tcapattr (state ? ATREV : 0);
+}
+
+/*
+ * Change the character attributes, sending only what differs from the
+ * attributes in effect.  Those that cannot be turned off one at a time
+ * are turned off along with all the others, and the ones still wanted
+ * turned on again.
+ *
+ * @attr: ATBOLD, ATUNDER and ATREV with the ATFG() and ATBG() colors.
+ */
+static void
+tcapattr (int attr)
+{
+  int off; /* Attributes to turn off.  */
+  int on;  /* Attributes to turn on.  */
+
+  if (attr == tcattr)
+    return;
+
+  if (tcattr < 0)
+    off = ~0;
+  else
     {
-      if (SO != NULL)
-        putpad (SO);
+      off = tcattr & ~attr & (ATBOLD | ATUNDER | ATREV);
+      if ((tcattr & ATFGMASK) != 0 && (attr & ATFGMASK) == 0)
+        off |= ATFGMASK;
+      if ((tcattr & ATBGMASK) != 0 && (attr & ATBGMASK) == 0)
+        off |= ATBGMASK;
+    }
+
+  if (off != 0)
+    {
+      if (ME != NULL
+          && (tcattr < 0 || (off & ATBOLD) != 0
+              || ((off & ATUNDER) != 0 && UE == NULL)
+              || ((off & ATREV) != 0 && SE == NULL)
+              || ((off & (ATFGMASK | ATBGMASK)) != 0 && OP == NULL)))
+        tcapoff (ME, ~0);
+      else
+        {
+          if (tcattr < 0)
+            tcattr = 0;
+          if ((off & ATUNDER) != 0 && UE != NULL)
+            tcapoff (UE, ATUNDER);
+          if ((off & ATREV) != 0 && SE != NULL)
+            tcapoff (SE, ATREV);
+          if ((off & (ATFGMASK | ATBGMASK)) != 0 && OP != NULL)
+            tcapoff (OP, ATFGMASK | ATBGMASK);
+          tcattr &= ~off;
+        }
     }
-  else if (SE != NULL)
-    putpad (SE);
+
+  on = attr & ~tcattr;
+  if ((on & ATBOLD) != 0 && MD != NULL)
+    putpad (MD);
+  if ((on & ATUNDER) != 0 && US != NULL)
+    putpad (US);
+  if ((on & ATREV) != 0 && SO != NULL)
+    putpad (SO);
+  if ((attr & ATFGMASK) != 0 && (attr & ATFGMASK) != (tcattr & ATFGMASK)
+      && AF != NULL)
+    putpad (tgoto (AF, 0, ((attr & ATFGMASK) >> 4) - 1));
+  if ((attr & ATBGMASK) != 0 && (attr & ATBGMASK) != (tcattr & ATBGMASK)
+      && AB != NULL)
+    putpad (tgoto (AB, 0, ((attr & ATBGMASK) >> 8) - 1));
+
+  tcattr = attr;
+}
+
+/*
+ * Send the string turning off attr.  Many terminals turn off all the
+ * attributes with the same string, which leaves none in effect.
+ */
+static void
+tcapoff (char *str, int attr)
+{
+  putpad (str);
+  if (attr == ~0 || (ME != NULL && strcmp (str, ME) == 0))
+    tcattr = 0;
+  else
+    tcattr &= ~attr;
 }
 
 /* Change screen resolution.  */
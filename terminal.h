@@ -39,6 +39,7 @@ struct terminal
   void (*t_eeop) (void);        /* Erase to end of page.        */
   void (*t_beep) (void);        /* Beep.                        */
   void (*t_rev) (int);          /* set reverse video state      */
+  void (*t_attr) (int);         /* set character attributes     */
   int (*t_rez) (char *);        /* change screen resolution     */
 #if COLOR
   int (*t_setfor) ();  /* set forground color          */
@@ -64,6 +65,7 @@ struct terminal
 #define TTeeop (*term.t_eeop)
 #define TTbeep (*term.t_beep)
 #define TTrev (*term.t_rev)
+#define TTattr (*term.t_attr)
 #define TTrez (*term.t_rez)
 #if COLOR
 # define TTforg (*term.t_setfor)
@@ -73,6 +75,18 @@ struct terminal
 # define TTscroll (*term.t_scroll)
 #endif
 
+/*
+ * Character attributes for t_attr.  A color field holds one more than
+ * the color number, 0 meaning the default color of the terminal.
+ */
+#define ATBOLD  (1 << 0) /* Bold.  */
+#define ATUNDER (1 << 1) /* Underlined.  */
+#define ATREV   (1 << 2) /* Reverse video.  */
+#define ATFG(c) (((c) + 1) << 4) /* Foreground color c, 0 to 7.  */
+#define ATBG(c) (((c) + 1) << 8) /* Background color c, 0 to 7.  */
+#define ATFGMASK (0xF << 4)
+#define ATBGMASK (0xF << 8)
+
 /* Terminal table defined only in term.c */
 extern struct terminal term;
 
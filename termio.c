@@ -20,6 +20,8 @@
 #include "utf8.h"
 
 #include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 int ttrow = HUGE; /* Row location of HW cursor */
@@ -262,6 +264,30 @@ typahead (void)
 #  endif
 }
 # endif
+
+/* Wait up to msec milliseconds for a key, return TRUE if one came.  */
+int
+ttwait (int msec)
+{
+# if UNIX
+  fd_set rfds;
+  struct timeval tv;
+
+#  if USG
+  if (kbdqp)
+    return TRUE;
+#  endif
+
+  FD_ZERO (&rfds);
+  FD_SET (0, &rfds);
+  tv.tv_sec = msec / 1000;
+  tv.tv_usec = msec % 1000 * 1000L;
+  return select (1, &rfds, NULL, NULL, &tv) != 0;
+# else
+  (void) msec;
+  return TRUE; /* Cannot wait, go read the key.  */
+# endif
+}
 #else
 typedef int dummy;
 #endif /* not POSIX */
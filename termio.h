@@ -18,5 +18,6 @@ extern int ttputc (unicode_t c);
 extern void ttflush (void);
 extern int ttgetc (void);
 extern int typahead (void);
+extern int ttwait (int msec);
 
 #endif
@@ -0,0 +1,1033 @@
+/* undo.c -- implements undo.h */
+#include "undo.h"
+
+/*  undo.c
+ *
+ *      The routines in this file keep a log of the edits made to each
+ *      buffer, so that they can be undone and redone.  The primitives of
+ *      line.c report each edit before making it, as bytes inserted or
+ *      deleted at a line and offset, a newline being a byte.  The records
+ *      are packed one after the other into chunks of UNDCHUNK bytes, and
+ *      a record that goes on from the one before, as typing or repeated
+ *      deleting does, is merged into it.
+ *
+ *      The records of one command make a group, which undo takes back as
+ *      a whole; consecutive self-inserting keys share a group.  Undoing
+ *      moves a cursor back through the log, redoing moves it forward, and
+ *      a new edit drops the records past it.  When the log of a buffer
+ *      grows past UNDMAX bytes, its oldest groups are dropped.
+ *
+ *      A command that changes many lines, as replacing or filling does,
+ *      opens a bulk record instead.  Its edits make no record of their
+ *      own, but the old text of the lines they reach is saved as they
+ *      reach them, and the new text of all those lines joins it in one
+ *      record when the command is done.
+ *
+ *      Lines count from 0, and are found as by the journal, walking from
+ *      the line before the last edit.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "journal.h"
+#include "mlout.h"
+#include "random.h"
+#include "syntax.h"
+#include "window.h"
+
+#define UNDCHUNK 65536      /* # of bytes in a chunk of the log.  */
+#define UNDMAX   (8L << 20) /* Most bytes of log kept for a buffer.  */
+
+/* Types of records.  */
+#define UNDINS  0 /* Bytes were inserted.  */
+#define UNDDEL  1 /* Bytes were deleted.  */
+#define UNDBULK 2 /* Lines were changed, old then new text.  */
+
+/* Flags of records.  */
+#define UNDGROUP 0x01 /* First record of a group.  */
+#define UNDATEND 0x02 /* Made a line at the end, newline and all.  */
+
+struct undrec
+{
+  int r_size;            /* # of bytes of the record, with its text.  */
+  int r_prev;            /* Size of the record before in the chunk.  */
+  unsigned char r_type;  /* UNDINS, UNDDEL or UNDBULK.  */
+  unsigned char r_flags; /* UNDGROUP, UNDATEND.  */
+  int r_line;            /* Line of the edit.  */
+  int r_offs;            /* Offset in it.  */
+  int r_len;             /* # of bytes of text, old ones for UNDBULK.  */
+  int r_nlen;            /* # of new bytes for UNDBULK.  */
+  char r_text[1];        /* The text.  */
+};
+
+struct undchunk
+{
+  struct undchunk *c_next; /* Newer chunk.  */
+  struct undchunk *c_prev; /* Older chunk.  */
+  int c_size;              /* # of bytes for records.  */
+  int c_first;             /* Offset of the first record kept.  */
+  int c_used;              /* End of the records.  */
+  int c_last;              /* Offset of the last record.  */
+  char c_data[1];          /* The records.  */
+};
+
+struct undo
+{
+  struct undchunk *u_head; /* Oldest chunk.  */
+  struct undchunk *u_tail; /* Newest chunk.  */
+  struct undchunk *u_cur;  /* Chunk of the next record to redo, or NULL.  */
+  int u_curoff;            /* Its offset there.  */
+  long u_total;            /* # of bytes in the chunks.  */
+  long u_seq;              /* Command of the last record.  */
+  long u_lost;             /* Command whose records were dropped.  */
+  bool u_merge;            /* The last record may be merged into.  */
+  int u_eline;             /* Line where the text it inserts ends.  */
+  int u_eoffs;             /* Offset there, -1 if it deletes.  */
+  line_p u_line;           /* Line before the last edit, NULL if unknown.  */
+  int u_lnum;              /* Its number.  */
+  bool u_blost;            /* The bulk record is too big to keep.  */
+  int u_bstart;            /* First line it covers.  */
+  line_p u_bbefore;        /* Line before the lines it covers.  */
+  line_p u_bafter;         /* Line after them.  */
+  char *u_btext;           /* Their old text.  */
+  long u_blen;             /* # of bytes of it.  */
+  long u_bsize;            /* # of bytes allocated for it.  */
+};
+
+#define UNDALIGN sizeof (int)
+#define RECSIZE(len) \
+  ((int) ((offsetof (struct undrec, r_text) + (len) + UNDALIGN - 1) \
+          & ~(UNDALIGN - 1)))
+#define REC(cp, off) ((struct undrec *) &(cp)->c_data[off])
+
+static long undseq = 0;        /* Number of the command running.  */
+static bool undoing = FALSE;   /* Edits come from undo or redo.  */
+static buffer_p bulkbp = NULL; /* Buffer with an open bulk record.  */
+
+static struct undo *
+undget (buffer_p bp)
+{
+  struct undo *up = bp->b_und;
+
+  if (undoing)
+    return NULL;
+
+  if (up == NULL)
+    {
+      if ((up = malloc (sizeof (*up))) == NULL)
+        return NULL;
+
+      up->u_head = up->u_tail = up->u_cur = NULL;
+      up->u_curoff = 0;
+      up->u_total = 0;
+      up->u_seq = up->u_lost = -1;
+      up->u_merge = FALSE;
+      up->u_line = NULL;
+      up->u_lnum = 0;
+      up->u_btext = NULL;
+      up->u_blen = up->u_bsize = 0;
+      bp->b_und = up;
+    }
+  return up;
+}
+
+/* Remember the line before line lp, number n, which the edit leaves.  */
+static void
+undhint (struct undo *up, line_p lp, int n)
+{
+  if (n > 0 && lback (lp) != curbp->b_linep)
+    {
+      up->u_line = lback (lp);
+      up->u_lnum = n - 1;
+    }
+  else
+    up->u_line = NULL;
+}
+
+/* Free chunk cp and the newer ones.  */
+static void
+undfree (struct undo *up, struct undchunk *cp)
+{
+  struct undchunk *next;
+
+  if (cp == NULL)
+    return;
+
+  up->u_tail = cp->c_prev;
+  if (up->u_tail != NULL)
+    up->u_tail->c_next = NULL;
+  else
+    up->u_head = NULL;
+  for (; cp != NULL; cp = next)
+    {
+      next = cp->c_next;
+      up->u_total -= cp->c_size;
+      free (cp);
+    }
+  up->u_cur = NULL;
+  up->u_merge = FALSE;
+}
+
+/* Drop the records past the cursor, which were undone.  */
+static void
+undcut (struct undo *up)
+{
+  struct undchunk *cp = up->u_cur;
+
+  if (cp == NULL)
+    return;
+
+  undfree (up, cp->c_next);
+  if (up->u_curoff == cp->c_first)
+    undfree (up, cp);
+  else
+    {
+      cp->c_last = up->u_curoff - REC (cp, up->u_curoff)->r_prev;
+      cp->c_used = up->u_curoff;
+    }
+  up->u_cur = NULL;
+  up->u_merge = FALSE;
+}
+
+/* Drop the oldest groups until the log fits in UNDMAX bytes.  */
+static void
+undtrim (struct undo *up)
+{
+  struct undchunk *cp;
+
+  while (up->u_total > UNDMAX && (cp = up->u_head) != NULL)
+    {
+      if (cp == up->u_tail)
+        {
+          undfree (up, cp);
+          return;
+        }
+
+      up->u_head = cp->c_next;
+      up->u_head->c_prev = NULL;
+      up->u_total -= cp->c_size;
+      free (cp);
+
+      /* The log must start with a group, skip the rest of this one.  */
+      while ((cp = up->u_head) != NULL)
+        {
+          while (cp->c_first < cp->c_used
+                 && (REC (cp, cp->c_first)->r_flags & UNDGROUP) == 0)
+            cp->c_first += REC (cp, cp->c_first)->r_size;
+          if (cp->c_first < cp->c_used)
+            break;
+
+          if (cp == up->u_tail)
+            {
+              undfree (up, cp);
+              return;
+            }
+          up->u_head = cp->c_next;
+          up->u_head->c_prev = NULL;
+          up->u_total -= cp->c_size;
+          free (cp);
+        }
+    }
+}
+
+/* Whether the edit about to be recorded goes on with typing.  */
+static bool
+undtyping (struct undo *up)
+{
+  return (thisflag & CFTYPE) != 0 && (lastflag & CFTYPE) != 0
+         && up->u_seq == undseq - 1;
+}
+
+/*
+ * Add a record of the given type for line k at offset offs, with room for
+ * len bytes of text, and return it with the text left to fill in.  Return
+ * NULL if it cannot be kept.
+ */
+static struct undrec *
+undadd (struct undo *up, int type, int k, int offs, long len)
+{
+  struct undchunk *cp;
+  struct undrec *rp;
+  int size;
+
+  if (up->u_lost == undseq)
+    return NULL;
+
+  undcut (up);
+  if (len > UNDMAX)
+    {
+      /* Too big to undo, and what was before cannot be undone past it.  */
+      undfree (up, up->u_head);
+      up->u_lost = undseq;
+      return NULL;
+    }
+
+  size = RECSIZE (len);
+  cp = up->u_tail;
+  if (cp == NULL || cp->c_size - cp->c_used < size)
+    {
+      int room = (size > UNDCHUNK) ? size : UNDCHUNK;
+
+      if ((cp = malloc (offsetof (struct undchunk, c_data) + room)) == NULL)
+        return NULL;
+
+      cp->c_size = room;
+      cp->c_first = cp->c_used = cp->c_last = 0;
+      cp->c_next = NULL;
+      cp->c_prev = up->u_tail;
+      if (up->u_tail != NULL)
+        up->u_tail->c_next = cp;
+      else
+        up->u_head = cp;
+      up->u_tail = cp;
+      up->u_total += room;
+    }
+
+  rp = REC (cp, cp->c_used);
+  rp->r_size = size;
+  rp->r_prev = (cp->c_used > cp->c_first) ? cp->c_used - cp->c_last : 0;
+  rp->r_type = type;
+  rp->r_flags = 0;
+  if (up->u_head == cp && cp->c_used == cp->c_first)
+    rp->r_flags |= UNDGROUP; /* First record of the log.  */
+  else if (up->u_seq != undseq && !undtyping (up))
+    rp->r_flags |= UNDGROUP;
+  rp->r_line = k;
+  rp->r_offs = offs;
+  rp->r_len = len;
+  rp->r_nlen = 0;
+  cp->c_last = cp->c_used;
+  cp->c_used += size;
+  up->u_seq = undseq;
+  up->u_merge = FALSE;
+  return rp;
+}
+
+/*
+ * Return the last record if the edit about to be recorded may be merged
+ * into it, or NULL.
+ */
+static struct undrec *
+undlast (struct undo *up, int type)
+{
+  struct undchunk *cp = up->u_tail;
+  struct undrec *rp;
+
+  if (!up->u_merge || up->u_cur != NULL || cp == NULL
+      || (up->u_seq != undseq && !undtyping (up)))
+    return NULL;
+
+  rp = REC (cp, cp->c_last);
+  return (rp->r_type == type) ? rp : NULL;
+}
+
+/* Make room for n more bytes of text in the last record rp.  */
+static bool
+undroom (struct undo *up, struct undrec *rp, long n)
+{
+  struct undchunk *cp = up->u_tail;
+  int size;
+
+  if (rp->r_len + n > UNDCHUNK)
+    return FALSE;
+
+  size = RECSIZE (rp->r_len + n);
+  if (size - rp->r_size > cp->c_size - cp->c_used)
+    return FALSE;
+
+  cp->c_used += size - rp->r_size;
+  rp->r_size = size;
+  up->u_seq = undseq;
+  return TRUE;
+}
+
+/*
+ * Number line lp of the current buffer for a record, and return the
+ * number, or -1 if the buffer keeps no log.
+ */
+static int
+undstart (line_p lp, struct undo **upp)
+{
+  struct undo *up = undget (curbp);
+  int k;
+
+  if (up == NULL)
+    return -1;
+
+  k = lnumber (curbp, lp, up->u_line, up->u_lnum);
+  if (k < 0)
+    {
+      /* Lost track of the lines, the log is no good any more.  */
+      unddiscard (curbp);
+      return -1;
+    }
+
+  undhint (up, lp, k);
+  *upp = up;
+  return k;
+}
+
+/* Save the text of the lines from lp up to end for the bulk record.  */
+static void
+undsave (struct undo *up, line_p lp, line_p end, bool front)
+{
+  line_p p;
+  long n = 0;
+  char *cp;
+
+  for (p = lp; p != end; p = lforw (p))
+    n += llength (p) + 1;
+  if (n == 0 || up->u_blost)
+    return;
+
+  if (up->u_blen + n > up->u_bsize)
+    {
+      long size = up->u_bsize * 2;
+
+      if (size < up->u_blen + n)
+        size = up->u_blen + n;
+      if (up->u_blen + n > UNDMAX
+          || (cp = realloc (up->u_btext, size)) == NULL)
+        {
+          up->u_blost = TRUE;
+          return;
+        }
+      up->u_btext = cp;
+      up->u_bsize = size;
+    }
+
+  cp = up->u_btext;
+  if (front)
+    memmove (cp + n, cp, up->u_blen);
+  else
+    cp += up->u_blen;
+  for (p = lp; p != end; p = lforw (p))
+    {
+      memcpy (cp, p->l_text, llength (p));
+      cp += llength (p);
+      *cp++ = '\n';
+    }
+  up->u_blen += n;
+}
+
+/*
+ * If a bulk record is open for the current buffer, have it cover the lines
+ * from lp to last, which an edit is about to change, and return TRUE.
+ */
+static bool
+undcover (line_p lp, line_p last)
+{
+  struct undo *up = curbp->b_und;
+  int k, kafter, klast;
+
+  if (bulkbp != curbp || undoing)
+    return FALSE;
+  if (up->u_blost)
+    return TRUE;
+
+  k = lnumber (curbp, lp, up->u_line, up->u_lnum);
+  kafter = lnumber (curbp, up->u_bafter, up->u_line, up->u_lnum);
+  klast = (last == lp) ? k : lnumber (curbp, last, up->u_line, up->u_lnum);
+  if (k < 0 || kafter < 0 || klast < 0)
+    {
+      up->u_blost = TRUE;
+      return TRUE;
+    }
+
+  if (k < up->u_bstart)
+    {
+      undsave (up, lp, lforw (up->u_bbefore), TRUE);
+      up->u_bbefore = lback (lp);
+      up->u_bstart = k;
+    }
+  if (klast >= kafter)
+    {
+      line_p end = (last == curbp->b_linep) ? last : lforw (last);
+
+      undsave (up, up->u_bafter, end, FALSE);
+      up->u_bafter = end;
+    }
+
+  undhint (up, lp, k);
+  return TRUE;
+}
+
+/*
+ * Record inserting n bytes at offset offs of line lp, which are text or,
+ * if it is NULL, n copies of byte c, then a newline with nl.
+ */
+static void
+undins (line_p lp, int offs, const char *text, int c, int n, bool nl)
+{
+  struct undo *up;
+  struct undrec *rp;
+  char *cp;
+  int k;
+
+  if (undcover (lp, lp) || (k = undstart (lp, &up)) < 0)
+    return;
+
+  if ((rp = undlast (up, UNDINS)) != NULL && up->u_eline == k
+      && up->u_eoffs == offs && undroom (up, rp, n + nl))
+    cp = &rp->r_text[rp->r_len];
+  else if ((rp = undadd (up, UNDINS, k, offs, n + nl)) != NULL)
+    {
+      cp = rp->r_text;
+      rp->r_len = 0;
+    }
+  else
+    return;
+
+  if (lp == curbp->b_linep && !nl)
+    rp->r_flags |= UNDATEND;
+
+  if (text != NULL)
+    memcpy (cp, text, n);
+  else
+    memset (cp, c, n);
+  if (nl)
+    cp[n] = '\n';
+  rp->r_len += n + nl;
+
+  up->u_merge = TRUE;
+  up->u_eline = nl ? k + 1 : k;
+  up->u_eoffs = nl ? 0 : offs + n;
+  undtrim (up);
+}
+
+/* Record inserting n copies of byte c at dot.  */
+void
+undinsert (int n, int c)
+{
+  if (n > 0)
+    undins (curwp->w_dotp, curwp->w_doto, NULL, c, n, FALSE);
+}
+
+/* Record splitting the line at dot.  */
+void
+undnewline (void)
+{
+  undins (curwp->w_dotp, curwp->w_doto, NULL, 0, 0, TRUE);
+}
+
+/* Record linking the new line lp in before line before.  */
+void
+undaddline (line_p before, line_p lp)
+{
+  undins (before, 0, lp->l_text, 0, llength (lp), TRUE);
+}
+
+/*
+ * Return the number of bytes that deleting n bytes at offset offs of line
+ * lp takes away, a newline being one, as ldelete() does, and put the last
+ * line they reach in *lastp.  Copy them to text unless it is NULL.
+ */
+static long
+undspan (line_p lp, int offs, int n, line_p *lastp, char *text)
+{
+  long len = 0;
+  int doto = offs;
+
+  while (n > 0 && lp != curbp->b_linep)
+    {
+      int chunk = llength (lp) - offs;
+
+      if (chunk > n)
+        chunk = n;
+      if (text != NULL)
+        memcpy (&text[len], &lp->l_text[offs], chunk);
+      len += chunk;
+      n -= chunk;
+      if (n == 0)
+        break;
+
+      if (lforw (lp) == curbp->b_linep)
+        {
+          /* The last line goes with its newline once it is empty.  */
+          if (doto == 0)
+            {
+              if (text != NULL)
+                text[len] = '\n';
+              len++;
+            }
+          break;
+        }
+
+      if (text != NULL)
+        text[len] = '\n';
+      len++;
+      n--;
+      lp = lforw (lp);
+      offs = 0;
+    }
+
+  *lastp = lp;
+  return len;
+}
+
+/* Record deleting n bytes at dot.  */
+void
+unddelete (int n)
+{
+  line_p lp = curwp->w_dotp;
+  int offs = curwp->w_doto;
+  struct undo *up;
+  struct undrec *rp;
+  line_p last;
+  long len;
+  int k;
+
+  if ((len = undspan (lp, offs, n, &last, NULL)) == 0
+      || undcover (lp, last) || (k = undstart (lp, &up)) < 0)
+    return;
+
+  rp = undlast (up, UNDDEL);
+  if (rp != NULL && rp->r_line == k && rp->r_offs == offs
+      && undroom (up, rp, len))
+    {
+      /* Deleting forward again.  */
+      undspan (lp, offs, n, &last, &rp->r_text[rp->r_len]);
+    }
+  else if (rp != NULL && rp->r_line == k && rp->r_offs == offs + len
+           && len <= llength (lp) - offs && undroom (up, rp, len))
+    {
+      /* Deleting backward on the same line.  */
+      memmove (&rp->r_text[len], rp->r_text, rp->r_len);
+      undspan (lp, offs, n, &last, rp->r_text);
+      rp->r_offs = offs;
+    }
+  else if ((rp = undadd (up, UNDDEL, k, offs, len)) != NULL)
+    {
+      rp->r_len = 0;
+      undspan (lp, offs, n, &last, rp->r_text);
+    }
+  else
+    return;
+
+  rp->r_len += len;
+  up->u_merge = TRUE;
+  up->u_eline = k;
+  up->u_eoffs = -1;
+  undtrim (up);
+}
+
+/*
+ * Close the open bulk record, adding the new text of its lines to it.
+ */
+static void
+undclose (void)
+{
+  buffer_p bp = bulkbp;
+  struct undo *up;
+  struct undrec *rp;
+  line_p lp;
+  long n = 0;
+  char *cp;
+
+  if (bp == NULL)
+    return;
+
+  bulkbp = NULL;
+  up = bp->b_und;
+  if (up->u_blost)
+    {
+      /* What was before cannot be undone past it.  */
+      undfree (up, up->u_head);
+      mloutstr ("(Change too big to undo)");
+    }
+  else
+    {
+      bool same = TRUE;
+
+      /* Nothing to record if the lines did not change after all.  */
+      for (lp = lforw (up->u_bbefore); lp != up->u_bafter; lp = lforw (lp))
+        {
+          if (same && (n + llength (lp) >= up->u_blen
+                       || memcmp (&up->u_btext[n], lp->l_text, llength (lp))
+                       || up->u_btext[n + llength (lp)] != '\n'))
+            same = FALSE;
+          n += llength (lp) + 1;
+        }
+      if (!(same && n == up->u_blen)
+          && (rp = undadd (up, UNDBULK, up->u_bstart, 0, up->u_blen + n))
+                 != NULL)
+        {
+          memcpy (rp->r_text, up->u_btext, up->u_blen);
+          rp->r_len = up->u_blen;
+          rp->r_nlen = n;
+          cp = &rp->r_text[up->u_blen];
+          for (lp = lforw (up->u_bbefore); lp != up->u_bafter; lp = lforw (lp))
+            {
+              memcpy (cp, lp->l_text, llength (lp));
+              cp += llength (lp);
+              *cp++ = '\n';
+            }
+          undtrim (up);
+        }
+    }
+
+  free (up->u_btext);
+  up->u_btext = NULL;
+  up->u_blen = up->u_bsize = 0;
+}
+
+/*
+ * A command is about to change many lines of the current buffer, from
+ * line lp on: gather its edits in a single record.
+ */
+void
+undbulk (line_p lp)
+{
+  struct undo *up;
+  int k;
+
+  if (bulkbp == curbp)
+    return;
+
+  undclose ();
+  if ((k = undstart (lp, &up)) < 0)
+    return;
+
+  up->u_blost = FALSE;
+  up->u_bstart = k;
+  up->u_bbefore = lback (lp);
+  up->u_bafter = lp;
+  up->u_blen = 0;
+  bulkbp = curbp;
+}
+
+/* Line lp of the current buffer is about to be changed in place.  */
+void
+undline (line_p lp)
+{
+  if (lp != curbp->b_linep)
+    {
+      undbulk (lp);
+      undcover (lp, lp);
+    }
+}
+
+/*
+ * Lines lp to last of the current buffer are about to be moved about or
+ * dropped, gather that in a single record.
+ */
+void
+undlines (line_p lp, line_p last)
+{
+  if (lp != curbp->b_linep)
+    {
+      undbulk (lp);
+      undcover (lp, last);
+    }
+}
+
+/*
+ * Called before each command: what follows is a new group of edits.
+ */
+void
+undmark (void)
+{
+  undclose ();
+  undseq++;
+}
+
+/* Line lp is being freed.  */
+void
+undforget (line_p lp)
+{
+  buffer_p bp;
+
+  for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+    if (bp->b_und != NULL)
+      {
+        if (bp->b_und->u_line == lp)
+          bp->b_und->u_line = NULL;
+        if (bp == bulkbp
+            && (bp->b_und->u_bbefore == lp || bp->b_und->u_bafter == lp))
+          bp->b_und->u_blost = TRUE;
+      }
+}
+
+/*
+ * Drop the log of buffer bp, whose text is being thrown away.
+ */
+void
+unddiscard (buffer_p bp)
+{
+  struct undo *up = bp->b_und;
+
+  if (bulkbp == bp)
+    bulkbp = NULL;
+  if (up == NULL)
+    return;
+
+  undfree (up, up->u_head);
+  free (up->u_btext);
+  free (up);
+  bp->b_und = NULL;
+}
+
+/*
+ * Put dot at offset offs of line number k of the current buffer.  Return
+ * FALSE if there is no such place.
+ */
+static bool
+undgoto (struct undo *up, int k, int offs)
+{
+  line_p lp;
+
+  if (offs < 0 || (lp = lnumbered (curbp, k, up->u_line, up->u_lnum)) == NULL
+      || offs > llength (lp) || (lp == curbp->b_linep && offs != 0))
+    return FALSE;
+
+  undhint (up, lp, k);
+  curwp->w_dotp = lp;
+  curwp->w_doto = offs;
+  return TRUE;
+}
+
+/* Insert the len bytes of text at dot.  */
+static bool
+undtext (const char *text, long len)
+{
+  const char *end = text + len;
+  const char *nl;
+
+  /* Up to the first newline, into the line at dot.  */
+  if (curwp->w_dotp != curbp->b_linep
+      && (nl = memchr (text, '\n', len)) != NULL)
+    {
+      for (; text < nl; text++)
+        if (linsert_byte (1, *text & 0xFF) != TRUE)
+          return FALSE;
+      if (lnewline () != TRUE)
+        return FALSE;
+      text++;
+    }
+
+  /* Whole lines, before the line at dot.  */
+  while ((nl = memchr (text, '\n', end - text)) != NULL)
+    {
+      line_p before = curwp->w_dotp;
+      line_p lp;
+
+      if ((lp = lalloc (nl - text)) == NULL)
+        return FALSE;
+
+      memcpy (lp->l_text, text, nl - text);
+      jrnaddline (before, lp);
+      lp->l_fp = before;
+      lp->l_bp = lback (before);
+      lback (before)->l_fp = lp;
+      before->l_bp = lp;
+      lexdirty (lp);
+      bcount (curbp, nl - text + 1, 1);
+      lchange (WFHARD);
+      text = nl + 1;
+    }
+
+  /* The rest, into the line at dot.  */
+  for (; text < end; text++)
+    if (linsert_byte (1, *text & 0xFF) != TRUE)
+      return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * Undo record rp, or redo it with redo.  Return FALSE if the buffer does
+ * not match it.
+ */
+static bool
+undapply (struct undo *up, struct undrec *rp, bool redo)
+{
+  const char *text = rp->r_text;
+  long del = 0;
+  long ins = 0;
+  bool status;
+
+  switch (rp->r_type)
+    {
+    case UNDINS:
+      if (redo)
+        ins = rp->r_len;
+      else
+        del = rp->r_len + ((rp->r_flags & UNDATEND) != 0);
+      break;
+    case UNDDEL:
+      if (redo)
+        del = rp->r_len;
+      else
+        ins = rp->r_len;
+      break;
+    case UNDBULK:
+      if (redo)
+        {
+          del = rp->r_len;
+          ins = rp->r_nlen;
+          text += rp->r_len;
+        }
+      else
+        {
+          del = rp->r_nlen;
+          ins = rp->r_len;
+        }
+      break;
+    }
+
+  if (!undgoto (up, rp->r_line, rp->r_offs))
+    return FALSE;
+
+  undoing = TRUE;
+  status = (del == 0 || ldelete (del, FALSE) == TRUE)
+           && (ins == 0 || undtext (text, ins));
+  if (status && redo && (rp->r_flags & UNDATEND) != 0
+      && text[ins - 1] == '\n')
+    status = lnewline () == TRUE; /* The line at the end was split.  */
+  undoing = FALSE;
+  return status;
+}
+
+/* Step the cursor back over a record and return it, or NULL if none.  */
+static struct undrec *
+undprev (struct undo *up)
+{
+  struct undchunk *cp = up->u_cur;
+  int off = up->u_curoff;
+
+  if (cp == NULL)
+    {
+      if ((cp = up->u_tail) == NULL)
+        return NULL;
+      off = cp->c_used;
+    }
+  if (off == cp->c_first)
+    {
+      if ((cp = cp->c_prev) == NULL)
+        return NULL;
+      off = cp->c_used;
+    }
+
+  off = (off == cp->c_used) ? cp->c_last : off - REC (cp, off)->r_prev;
+  up->u_cur = cp;
+  up->u_curoff = off;
+  return REC (cp, off);
+}
+
+/* Step the cursor forward over a record and return it, or NULL if none.  */
+static struct undrec *
+undnext (struct undo *up)
+{
+  struct undchunk *cp = up->u_cur;
+  struct undrec *rp;
+
+  if (cp == NULL)
+    return NULL;
+
+  rp = REC (cp, up->u_curoff);
+  up->u_curoff += rp->r_size;
+  if (up->u_curoff == cp->c_used)
+    {
+      up->u_cur = cp->c_next;
+      up->u_curoff = 0;
+    }
+  return rp;
+}
+
+/* The log does not match the buffer any more: drop it.  */
+static int
+undbad (void)
+{
+  unddiscard (curbp);
+  mloutstr ("%Undo log does not match the buffer, dropped");
+  return FALSE;
+}
+
+/*
+ * Undo the last command that changed the current buffer, n times.  The
+ * edits of consecutive self-inserting keys are undone together.
+ * Bound to "C-x u" and "C-_".
+ */
+int
+undo (bool f, int n)
+{
+  struct undo *up;
+  struct undrec *rp;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+  if (n < 0)
+    return redo (f, -n);
+
+  undclose ();
+  up = curbp->b_und;
+  while (n-- > 0)
+    {
+      if (up == NULL || (rp = undprev (up)) == NULL)
+        {
+          mloutstr ("%Nothing to undo");
+          return FALSE;
+        }
+
+      for (;;)
+        {
+          if (!undapply (up, rp, FALSE))
+            return undbad ();
+          if ((rp->r_flags & UNDGROUP) != 0)
+            break;
+          if ((rp = undprev (up)) == NULL)
+            return undbad ();
+        }
+
+      /* Leave dot where the group started.  */
+      undgoto (up, rp->r_line, rp->r_offs);
+    }
+
+  if (up != NULL)
+    up->u_merge = FALSE;
+  curwp->w_flag |= WFMOVE;
+  return TRUE;
+}
+
+/*
+ * Redo the last n commands undone in the current buffer.
+ * Bound to "M-_".
+ */
+int
+redo (bool f, int n)
+{
+  struct undo *up;
+  struct undrec *rp;
+
+  if (curbp->b_mode & MDVIEW)
+    /* Do not allow this command if we are in read only mode.  */
+    return rdonly ();
+  if (n < 0)
+    return undo (f, -n);
+
+  undclose ();
+  up = curbp->b_und;
+  while (n-- > 0)
+    {
+      if (up == NULL || (rp = undnext (up)) == NULL)
+        {
+          mloutstr ("%Nothing to redo");
+          return FALSE;
+        }
+
+      do
+        if (!undapply (up, rp, TRUE))
+          return undbad ();
+      while (up->u_cur != NULL
+             && (REC (up->u_cur, up->u_curoff)->r_flags & UNDGROUP) == 0
+             && (rp = undnext (up)) != NULL);
+    }
+
+  curwp->w_flag |= WFMOVE;
+  return TRUE;
+}
+
+/* end of undo.c */
@@ -0,0 +1,21 @@
+#ifndef _UNDO_H_
+#define _UNDO_H_
+
+#include "buffer.h"
+#include "line.h"
+
+void undinsert (int n, int c);
+void undnewline (void);
+void unddelete (int n);
+void undaddline (line_p before, line_p lp);
+void undbulk (line_p lp);
+void undline (line_p lp);
+void undlines (line_p lp, line_p last);
+void undmark (void);
+void undforget (line_p lp);
+void unddiscard (buffer_p bp);
+
+int undo (bool f, int n);
+int redo (bool f, int n);
+
+#endif
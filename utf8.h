@@ -3,9 +3,22 @@
 
 typedef unsigned int unicode_t;
 
+/* A tally of text, see utf8_count().  */
+struct utf8_count
+{
+  long c_chars;  /* # of characters.  */
+  long c_words;  /* # of words.  */
+  int c_inword;  /* The last character was in a word.  */
+};
+
 unsigned utf8_to_unicode (const char *line, unsigned index, unsigned len,
                           unicode_t *res);
 unsigned utf8_revdelta (unsigned char *buf, unsigned pos);
 unsigned unicode_to_utf8 (unicode_t c, char *utf8);
+unicode_t unicode_fold (unicode_t c);
+int unicode_width (unicode_t c);
+unsigned utf8_ascii_span (const char *buf, unsigned len);
+unsigned utf8_print_span (const char *buf, unsigned len);
+void utf8_count (struct utf8_count *cp, const char *buf, unsigned len);
 
 #endif
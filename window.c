@@ -227,6 +227,7 @@ onlywind (bool f, int n)
     {
       wp = wheadp;
       wheadp = wp->w_wndp;
+      wdetach (wp);
       if (--wp->w_bufp->b_nwnd == 0)
         {
           wp->w_bufp->b_dotp = wp->w_dotp;
@@ -240,6 +241,7 @@ onlywind (bool f, int n)
     {
       wp = curwp->w_wndp;
       curwp->w_wndp = wp->w_wndp;
+      wdetach (wp);
       if (--wp->w_bufp->b_nwnd == 0)
         {
           wp->w_bufp->b_dotp = wp->w_dotp;
@@ -327,6 +329,7 @@ delwind (bool f, int n)
     }
 
   /* get rid of the current window */
+  wdetach (curwp);
   if (--curwp->w_bufp->b_nwnd == 0)
     {
       curwp->w_bufp->b_dotp = curwp->w_dotp;
@@ -375,6 +378,7 @@ splitwind (bool f, int n)
   wp = xmalloc (sizeof (*wp));
   curbp->b_nwnd++; /* Displayed twice.     */
   wp->w_bufp = curbp;
+  wattach (wp);
   wp->w_dotp = curwp->w_dotp;
   wp->w_doto = curwp->w_doto;
   wp->w_markp = curwp->w_markp;
@@ -596,6 +600,30 @@ wpopup (void)
   return wp;
 }
 
+/*
+ * Window wp now shows its buffer: have the edits of the buffer keep its
+ * top line, dot and mark.
+ */
+void
+wattach (window_p wp)
+{
+  bposadd (wp->w_bufp, &wp->w_pos[0], &wp->w_linep, NULL);
+  bposadd (wp->w_bufp, &wp->w_pos[1], &wp->w_dotp, &wp->w_doto);
+  bposadd (wp->w_bufp, &wp->w_pos[2], &wp->w_markp, &wp->w_marko);
+}
+
+/*
+ * Window wp is taken off its buffer.
+ */
+void
+wdetach (window_p wp)
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    bposdel (wp->w_bufp, &wp->w_pos[i]);
+}
+
 int
 scrnextup (bool f, int n)
 { /* scroll the next window up (back) a page */
@@ -703,6 +731,7 @@ newsize (bool f, int n)
             {
 
               /* save the point/mark if needed */
+              wdetach (wp);
               if (--wp->w_bufp->b_nwnd == 0)
                 {
                   wp->w_bufp->b_dotp = wp->w_dotp;
@@ -29,6 +29,7 @@ struct window
   int w_ntrows;           /* # of rows of text in window.  */
   unsigned int w_force:1; /* If NZ, forcing row.  */
   unsigned char w_flag;   /* Flags.  */
+  struct bpos w_pos[3];   /* Top line, "." and "mark" in the buffer.  */
 #if COLOR
   char w_fcolor;          /* Current forground color.  */
   char w_bcolor;          /* Current background color.  */
@@ -75,5 +76,7 @@ extern int newwidth (bool f, int n);
 extern int getwpos (void);
 extern void cknewwindow (void);
 extern window_p wpopup (void); /* Pop up window creation.  */
+extern void wattach (window_p wp);
+extern void wdetach (window_p wp);
 
 #endif /* _WINDOW_H */
@@ -11,6 +11,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "basic.h"
 #include "buffer.h"
@@ -20,6 +22,8 @@
 #include "mlout.h"
 #include "random.h"
 #include "region.h"
+#include "undo.h"
+#include "utf8.h"
 #include "window.h"
 
 #define TAB 0x09 /* Tab character.  */
@@ -384,26 +388,330 @@ inword (void)
 }
 
 #if WORDPRO
+/* A word of a paragraph being filled.  */
+struct fword
+{
+  long w_offs;  /* Offset of its text in the words read.  */
+  int w_len;    /* # of bytes in it.  */
+  int w_width;  /* # of columns it takes.  */
+  int w_gap;    /* # of spaces before it, after a word on its line.  */
+};
+
+/*
+ * Break n words into lines, the first starting at column col0 and the
+ * others at margin, taking as many words on each line as fit the fill
+ * column.  Put the first word of each line in brk, then n, and return the
+ * number of lines.
+ */
+static int
+fillgreedy (struct fword *words, int n, int col0, int margin, int *brk)
+{
+  int nbrk = 0;
+  int i = 0;
+
+  while (i < n)
+    {
+      int col = (nbrk == 0 ? col0 : margin) + words[i].w_width;
+
+      brk[nbrk++] = i++;
+      while (i < n && col + words[i].w_gap + words[i].w_width <= fillcol)
+        {
+          col += words[i].w_gap + words[i].w_width;
+          i++;
+        }
+    }
+  brk[nbrk] = n;
+  return nbrk;
+}
+
+/*
+ * As fillgreedy(), but choose the breaks that make the lines but the last
+ * as even as they can be, the sum of the squares of the columns left
+ * before the fill column being the least.  Return -1 if out of memory.
+ */
+static int
+fillbalance (struct fword *words, int n, int col0, int margin, int *brk)
+{
+  double *cost; /* Least cost of the words from i on.  */
+  int *next;    /* First word of the line after that starting at i.  */
+  int nbrk = 0;
+  int i;
+
+  cost = malloc ((n + 1) * sizeof (*cost));
+  next = malloc ((n + 1) * sizeof (*next));
+  if (cost == NULL || next == NULL)
+    {
+      free (cost);
+      free (next);
+      return -1;
+    }
+
+  cost[n] = 0;
+  for (i = n - 1; i >= 0; i--)
+    {
+      int col = (i == 0 ? col0 : margin) + words[i].w_width;
+      int j = i;
+
+      cost[i] = -1;
+      for (;;)
+        {
+          double c = 0;
+
+          /* A word too wide for the column has a line of its own.  */
+          if (j < n - 1 && col < fillcol)
+            c = (double) (fillcol - col) * (fillcol - col);
+          c += cost[j + 1];
+          if (cost[i] < 0 || c < cost[i])
+            {
+              cost[i] = c;
+              next[i] = j + 1;
+            }
+
+          if (++j == n || col + words[j].w_gap + words[j].w_width > fillcol)
+            break;
+          col += words[j].w_gap + words[j].w_width;
+        }
+    }
+
+  for (i = 0; i < n; i = next[i])
+    brk[nbrk++] = i;
+  brk[nbrk] = n;
+
+  free (cost);
+  free (next);
+  return nbrk;
+}
+
+/*
+ * Fill the words of the lines from first to last, from offset offs of
+ * first on, to the fill column.  The text before offs stays, and the
+ * lines after the first start at column margin.  A sentence gets two
+ * spaces after it unless just.  The lines take as many words as fit, or
+ * with balance are made as even as they can be.  The words are read
+ * once, measured in columns, and the old lines replaced by the new ones
+ * in place.  Leave dot at the start of the line after them.  Return FALSE
+ * if out of memory.
+ */
+static int
+reflow (line_p first, int offs, line_p last, int margin, bool just,
+        bool balance)
+{
+  struct fword *words = NULL;
+  int nwords = 0;
+  int maxwords = 0;
+  int *brk = NULL;
+  int nbrk;
+  char *text;
+  char *buf = NULL;
+  long len = 0;
+  int nold = 0;
+  int col0;
+  line_p lp;
+  int i, k;
+  int status = FALSE;
+
+  /* Room for the words.  */
+  for (lp = first;; lp = lforw (lp))
+    {
+      len += llength (lp);
+      nold++;
+      if (lp == last)
+        break;
+    }
+  if ((text = malloc (len + 1)) == NULL)
+    {
+      mloutstr ("%Memory exhausted");
+      return FALSE;
+    }
+
+  /* Read them.  */
+  len = 0;
+  for (lp = first, i = offs;; lp = lforw (lp), i = 0)
+    {
+      while (i < llength (lp))
+        {
+          struct fword *wp;
+          int c = lgetc (lp, i);
+
+          if (c == ' ' || c == TAB)
+            {
+              i++;
+              continue;
+            }
+
+          if (nwords == maxwords)
+            {
+              struct fword *more;
+
+              maxwords = maxwords == 0 ? 64 : 2 * maxwords;
+              if ((more = realloc (words, maxwords * sizeof (*words))) == NULL)
+                goto nomem;
+              words = more;
+            }
+
+          wp = &words[nwords++];
+          wp->w_offs = len;
+          wp->w_width = 0;
+          wp->w_gap = (!just && nwords > 1 && text[len - 1] == '.') ? 2 : 1;
+          while (i < llength (lp) && (c = lgetc (lp, i)) != ' ' && c != TAB)
+            {
+              unicode_t uc;
+              unsigned int n = utf8_to_unicode (lp->l_text, i, llength (lp),
+                                                &uc);
+
+              wp->w_width += unicode_width (uc);
+              memcpy (&text[len], &lp->l_text[i], n);
+              len += n;
+              i += n;
+            }
+          wp->w_len = len - wp->w_offs;
+        }
+      if (lp == last)
+        break;
+    }
+
+  if (nwords == 0)
+    {
+      curwp->w_dotp = lforw (last);
+      curwp->w_doto = 0;
+      free (text);
+      return TRUE;
+    }
+
+  /* Break them into lines.  */
+  curwp->w_dotp = first;
+  curwp->w_doto = offs;
+  col0 = getccol (FALSE);
+  if ((brk = malloc ((nwords + 1) * sizeof (*brk))) == NULL
+      || (buf = malloc (offs + margin + len + 2L * nwords)) == NULL)
+    goto nomem;
+  nbrk = balance ? fillbalance (words, nwords, col0, margin, brk)
+                 : fillgreedy (words, nwords, col0, margin, brk);
+  if (nbrk < 0)
+    goto nomem;
+
+  /* Put them in place of the old lines, and make or drop the difference.  */
+  undbulk (first);
+  lp = NULL;
+  for (k = 0; k < nbrk; k++)
+    {
+      char *p = buf;
+
+      if (k == 0)
+        {
+          memcpy (p, first->l_text, offs);
+          p += offs;
+        }
+      else
+        {
+          memset (p, ' ', margin);
+          p += margin;
+        }
+      for (i = brk[k]; i < brk[k + 1]; i++)
+        {
+          if (i > brk[k])
+            {
+              memset (p, ' ', words[i].w_gap);
+              p += words[i].w_gap;
+            }
+          memcpy (p, &text[words[i].w_offs], words[i].w_len);
+          p += words[i].w_len;
+        }
+
+      if (k < nold)
+        {
+          line_p next;
+
+          lp = lp == NULL ? first : lforw (lp);
+          next = lforw (lp);
+          if (lreplace (lp, buf, p - buf) != TRUE)
+            goto out;
+          lp = lback (next);
+        }
+      else
+        {
+          curwp->w_dotp = lp;
+          curwp->w_doto = llength (lp);
+          if (lnewline () != TRUE
+              || lreplace (curwp->w_dotp, buf, p - buf) != TRUE)
+            goto out;
+          lp = curwp->w_dotp;
+        }
+    }
+
+  if (nold > nbrk)
+    {
+      line_p dp = lp;
+      long n = 0;
+
+      for (k = nbrk; k < nold; k++)
+        {
+          dp = lforw (dp);
+          n += llength (dp) + 1;
+        }
+      curwp->w_dotp = lp;
+      curwp->w_doto = llength (lp);
+      if (ldelete (n, FALSE) != TRUE)
+        goto out;
+    }
+
+  curwp->w_dotp = lforw (lp);
+  curwp->w_doto = 0;
+  status = TRUE;
+  goto out;
+
+nomem:
+  mloutstr ("%Memory exhausted");
+out:
+  free (text);
+  free (words);
+  free (brk);
+  free (buf);
+  return status;
+}
+
+/*
+ * Fill the paragraph of dot with reflow(), the lines after the first at
+ * column margin.  With just, the first line is kept up to margin.  If pn
+ * is not NULL, set it to the number of lines of the paragraph from that of
+ * dot on.
+ */
+static int
+fillat (bool just, bool balance, int margin, int *pn)
+{
+  line_p dotp = curwp->w_dotp;
+  line_p last;
+
+  gotoeop (FALSE, 1);
+  last = curwp->w_dotp;
+  if (pn != NULL)
+    {
+      line_p lp;
+
+      *pn = 1;
+      for (lp = dotp; lp != last && lp != curbp->b_linep; lp = lforw (lp))
+        ++*pn;
+    }
+
+  gotobop (FALSE, 1);
+  if (curwp->w_dotp == curbp->b_linep || last == curbp->b_linep)
+    return TRUE; /* No words.  */
+  if (just && margin < llength (curwp->w_dotp))
+    curwp->w_doto = margin;
+
+  return reflow (curwp->w_dotp, curwp->w_doto, last, margin, just, balance);
+}
+
 /*
  * Fill the current paragraph according to the current
- * fill column
+ * fill column.  With an argument, make its lines as even
+ * as they can be rather than as full.
  *
  * f and n - deFault flag and Numeric argument
  */
 int
 fillpara (bool f, int n)
 {
-  unicode_t c;             /* current char during scan    */
-  unicode_t wbuf[NSTRING]; /* buffer for current word      */
-  int wordlen;             /* length of current word       */
-  int clength;             /* position on line during fill */
-  int i;                   /* index during word copy       */
-  int newlength;           /* tentative new line length    */
-  int eopflag;             /* Are we at the End-Of-Paragraph? */
-  int firstflag;           /* first word? (needs no space) */
-  line_p eopline;          /* pointer to line just past EOP */
-  int dotflag;             /* was the last char a period?  */
-
   if (curbp->b_mode & MDVIEW) /* don't allow this command if      */
     return rdonly ();         /* we are in read only mode     */
   if (fillcol == 0)
@@ -415,85 +723,69 @@ fillpara (bool f, int n)
   justflag = FALSE;
 #endif
 
-  /* record the pointer to the line just past the EOP */
-  gotoeop (FALSE, 1);
-  eopline = lforw (curwp->w_dotp);
+  return fillat (FALSE, f, 0, NULL);
+}
 
-  /* and back top the beginning of the paragraph */
-  gotobop (FALSE, 1);
+/*
+ * Fill each paragraph in the region as fill-paragraph
+ * does, all of them undone as one.
+ *
+ * f and n - deFault flag and Numeric argument
+ */
+int
+fillregion (bool f, int n)
+{
+  struct region region;
+  line_p lp;
+  long size;
+  int nlines; /* # of lines of the region left */
+  int status;
 
-  /* initialize various info */
-  clength = curwp->w_doto;
-  if (clength && curwp->w_dotp->l_text[0] == TAB)
-    clength = 8;
-  wordlen = 0;
-  dotflag = FALSE;
-
-  /* scan through lines, filling words */
-  firstflag = TRUE;
-  eopflag = FALSE;
-  while (!eopflag)
-    {
-      int bytes = 1;
+  if (curbp->b_mode & MDVIEW) /* don't allow this command if      */
+    return rdonly ();         /* we are in read only mode     */
+  if (fillcol == 0)
+    { /* no fill column set */
+      mloutstr ("No fill column set");
+      return FALSE;
+    }
+  if ((status = getregion (&region)) != TRUE)
+    return status;
+#if PKCODE
+  justflag = FALSE;
+#endif
 
-      /* get the next character in the paragraph */
-      if (curwp->w_doto == llength (curwp->w_dotp))
-        {
-          c = ' ';
-          if (lforw (curwp->w_dotp) == eopline)
-            eopflag = TRUE;
-        }
-      else
-        bytes = lgetchar (&c);
+  nlines = 1;
+  size = region.r_offset + region.r_size;
+  for (lp = region.r_linep; size > llength (lp); lp = lforw (lp))
+    {
+      size -= llength (lp) + 1;
+      nlines++;
+    }
+  if (size == 0 && nlines > 1)
+    nlines--; /* Ends before the line.  */
 
-      /* and then delete it */
-      ldelete (bytes, FALSE);
+  curwp->w_dotp = region.r_linep;
+  curwp->w_doto = 0;
+  while (nlines > 0 && curwp->w_dotp != curbp->b_linep)
+    {
+      int i;
+      int k;
 
-      /* if not a separator, just add it in */
-      if (c != ' ' && c != '\t')
+      lp = curwp->w_dotp;
+      for (i = 0; i < llength (lp) && !isalnum (lgetc (lp, i)); i++)
+        ;
+      if (i == llength (lp))
         {
-          dotflag = (c == '.'); /* was it a dot */
-          if (wordlen < NSTRING - 1)
-            wbuf[wordlen++] = c;
+          /* Between paragraphs.  */
+          curwp->w_dotp = lforw (lp);
+          nlines--;
+          continue;
         }
-      else if (wordlen)
-        {
-          /* at a word break with a word waiting */
-          /* calculate tentitive new length with word added */
-          newlength = clength + 1 + wordlen;
-          if (newlength <= fillcol)
-            {
-              /* add word to current line */
-              if (!firstflag)
-                {
-                  linsert (1, ' '); /* the space */
-                  ++clength;
-                }
-              firstflag = FALSE;
-            }
-          else
-            {
-              /* start a new line */
-              lnewline ();
-              clength = 0;
-            }
 
-          /* and add the word in in either case */
-          for (i = 0; i < wordlen; i++)
-            {
-              linsert (1, wbuf[i]);
-              ++clength;
-            }
-          if (dotflag)
-            {
-              linsert (1, ' ');
-              ++clength;
-            }
-          wordlen = 0;
-        }
+      if ((status = fillat (FALSE, f, 0, &k)) != TRUE)
+        return status;
+      nlines -= k;
     }
-  /* and add a last newline for the end of our new paragraph */
-  lnewline ();
   return TRUE;
 }
 
@@ -506,16 +798,8 @@ fillpara (bool f, int n)
 int
 justpara (bool f, int n)
 {
-  unicode_t c;             /* current char durring scan    */
-  unicode_t wbuf[NSTRING]; /* buffer for current word      */
-  int wordlen;             /* length of current word       */
-  int clength;             /* position on line during fill */
-  int i;                   /* index during word copy       */
-  int newlength;           /* tentative new line length    */
-  int eopflag;             /* Are we at the End-Of-Paragraph? */
-  int firstflag;           /* first word? (needs no space) */
-  line_p eopline;    /* pointer to line just past EOP */
-  int leftmarg;            /* left marginal */
+  int leftmarg; /* left marginal */
+  int status;
 
   if (curbp->b_mode & MDVIEW) /* don't allow this command if      */
     return rdonly ();         /* we are in read only mode     */
@@ -533,84 +817,7 @@ justpara (bool f, int n)
       return FALSE;
     }
 
-  /* record the pointer to the line just past the EOP */
-  gotoeop (FALSE, 1);
-  eopline = lforw (curwp->w_dotp);
-
-  /* and back top the beginning of the paragraph */
-  gotobop (FALSE, 1);
-
-  /* initialize various info */
-  if (leftmarg < llength (curwp->w_dotp))
-    curwp->w_doto = leftmarg;
-
-  clength = curwp->w_doto;
-  if (clength && curwp->w_dotp->l_text[0] == TAB)
-    clength = 8;
-
-  wordlen = 0;
-
-  /* scan through lines, filling words */
-  firstflag = TRUE;
-  eopflag = FALSE;
-  while (!eopflag)
-    {
-      int bytes = 1;
-
-      /* get the next character in the paragraph */
-      if (curwp->w_doto == llength (curwp->w_dotp))
-        {
-          c = ' ';
-          if (lforw (curwp->w_dotp) == eopline)
-            eopflag = TRUE;
-        }
-      else
-        bytes = lgetchar (&c);
-
-      /* and then delete it */
-      ldelete (bytes, FALSE);
-
-      /* if not a separator, just add it in */
-      if (c != ' ' && c != '\t')
-        {
-          if (wordlen < NSTRING - 1)
-            wbuf[wordlen++] = c;
-        }
-      else if (wordlen)
-        {
-          /* at a word break with a word waiting */
-          /* calculate tentitive new length with word added */
-          newlength = clength + 1 + wordlen;
-          if (newlength <= fillcol)
-            {
-              /* add word to current line */
-              if (!firstflag)
-                {
-                  linsert (1, ' '); /* the space */
-                  ++clength;
-                }
-              firstflag = FALSE;
-            }
-          else
-            {
-              /* start a new line */
-              lnewline ();
-              for (i = 0; i < leftmarg; i++)
-                linsert (1, ' ');
-              clength = leftmarg;
-            }
-
-          /* and add the word in in either case */
-          for (i = 0; i < wordlen; i++)
-            {
-              linsert (1, wbuf[i]);
-              ++clength;
-            }
-          wordlen = 0;
-        }
-    }
-  /* and add a last newline for the end of our new paragraph */
-  lnewline ();
+  status = fillat (TRUE, f, leftmarg, NULL);
 
   forwword (FALSE, 1);
   if (llength (curwp->w_dotp) > leftmarg)
@@ -619,7 +826,7 @@ justpara (bool f, int n)
     curwp->w_doto = llength (curwp->w_dotp);
 
   justflag = FALSE;
-  return TRUE;
+  return status;
 }
 #endif
 
@@ -668,18 +875,14 @@ killpara (bool f, int n)
 int
 wordcount (bool f, int n)
 {
-  line_p lp;            /* current line to scan */
-  int offset;           /* current char to scan */
-  int size;             /* size of region left to count */
-  int ch;               /* current character to scan */
-  int wordflag;         /* are we in a word now? */
-  int lastword;         /* were we just in a word? */
-  size_t nwords;        /* total # of words */
-  size_t nchars;        /* total number of chars */
-  size_t nlines;           /* total number of lines in region */
-  size_t avgch;         /* average number of chars/word */
-  int status;           /* status return code */
-  struct region region; /* region to look at */
+  line_p lp;              /* current line to scan */
+  int offset;             /* current char to scan */
+  long size;              /* size of region left to count */
+  struct utf8_count count; /* chars and words so far */
+  long nlines;            /* total number of lines in region */
+  long avgch;             /* average number of chars/word */
+  int status;             /* status return code */
+  struct region region;   /* region to look at */
 
   /* make sure we have a region to count */
   if ((status = getregion (&region)) != TRUE)
@@ -688,44 +891,41 @@ wordcount (bool f, int n)
   offset = region.r_offset;
   size = region.r_size;
 
-  /* count up things */
-  lastword = FALSE;
-  nchars = 0;
-  nwords = 0;
+  /* count up things, a line of text at a time */
+  count.c_chars = 0;
+  count.c_words = 0;
+  count.c_inword = FALSE;
   nlines = 0;
-  while (size--)
+  while (size > 0)
     {
-      /* get the current character */
-      if (offset == llength (lp))
+      int span = llength (lp) - offset;
+
+      if (span > size)
+        span = size;
+      utf8_count (&count, &lp->l_text[offset], span);
+      size -= span;
+
+      if (size > 0)
         {
           /* End of line.  */
-          ch = '\n';
+          count.c_chars++;
+          count.c_inword = FALSE;
+          size--;
           lp = lforw (lp);
           offset = 0;
           nlines++;
         }
-      else
-        {
-          ch = lgetc (lp, offset);
-          offset++;
-        }
-
-      /* Tabulate it.  */
-      wordflag = isalnum (ch);
-      if (wordflag == TRUE && lastword == FALSE)
-        nwords++;
-      lastword = wordflag;
-      nchars++;
     }
 
   /* Report on the info.  */
-  if (nwords > 0)
-    avgch = 100L * nchars / nwords;
+  if (count.c_words > 0)
+    avgch = 100L * count.c_chars / count.c_words;
   else
     avgch = 0;
 
-  mloutfmt ("Words %D Chars %D Lines %d Avg chars/word %f", nwords, nchars,
-            nlines + 1, avgch);
+  mloutfmt ("Words %D Chars %D Bytes %D Lines %D Avg chars/word %f",
+            count.c_words, count.c_chars, (long) region.r_size, nlines + 1,
+            (int) avgch);
   return TRUE;
 }
 #endif
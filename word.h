@@ -17,6 +17,7 @@ int delbword (bool f, int n);
 int gotobop (bool f, int n);
 int gotoeop (bool f, int n);
 int fillpara (bool f, int n);
+int fillregion (bool f, int n);
 int justpara (bool f, int n);
 int killpara (bool f, int n);
 int wordcount (bool f, int n);